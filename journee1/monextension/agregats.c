@@ -0,0 +1,733 @@
+/*
+ * agregats.c
+ *
+ * Agrégats construits sur la division sans erreur :
+ *
+ * - safe_ratio_sum(num, den) vaut exactement sum(num) // sum(den) ;
+ * - safe_avg_ratio(num, den) vaut exactement avg(num // den), les lignes dont
+ *   le diviseur est nul étant ignorées comme les NULL par avg().
+ *
+ * Comme pour sum() et avg(), l'état est un tableau int8[] pour
+ * safe_ratio_sum(int4, int4), un tableau float8[] pour les entrées float8, et
+ * un état interne sérialisable pour les autres. Les ratios entiers étant des
+ * numeric, safe_avg_ratio() sur des entiers cumule une somme numeric comme
+ * avg(numeric). Tous ont une fonction de combinaison : les agrégations
+ * parallèles et partitionnées sont possibles.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include "catalog/pg_type.h"
+#include "common/int.h"
+#include "libpq/pqformat.h"
+#include "utils/array.h"
+#include "utils/fmgrprotos.h"
+
+#include "monextension.h"
+
+/* structure definitions */
+
+/* état de safe_ratio_sum(int4, int4), comme celui de sum(int4) */
+typedef struct
+{
+  int64     nombre_num;
+  int64     somme_num;
+  int64     nombre_den;
+  int64     somme_den;
+} RatioSommeInt8;
+
+/*
+ * État interne pour les entrées int8 et numeric. Pour safe_avg_ratio(), seul
+ * le numérateur sert. Les valeurs int8 sont d'abord cumulées dans un int64 et
+ * reportées dans la somme numeric lorsqu'il déborderait, ce qui évite un
+ * calcul numeric par ligne.
+ */
+typedef struct
+{
+  int64     nombre_num;
+  int64     nombre_den;
+  int64     partielle_num;
+  int64     partielle_den;
+  Numeric   somme_num;        /* NULL tant que rien n'est reporté */
+  Numeric   somme_den;
+} RatioEtat;
+
+/* function definitions */
+static int64 *tableau_int8(ArrayType *tableau, int nombre);
+static float8 *tableau_float8(ArrayType *tableau, int nombre);
+static RatioEtat *ratio_etat(FunctionCallInfo fcinfo, MemoryContext *aggcontext);
+static void ratio_ajoute_numeric(Numeric *somme, Numeric valeur,
+                                 MemoryContext aggcontext);
+static void ratio_ajoute_int8(int64 *partielle, Numeric *somme, int64 valeur,
+                              MemoryContext aggcontext);
+static Numeric ratio_total(Numeric somme, int64 partielle);
+static void ratio_ajoute_entier(RatioEtat *etat, int64 num, int64 den,
+                                MemoryContext aggcontext);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_int4_accum);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_int4_final);
+PG_FUNCTION_INFO_V1(safe_ratio_int8_combine);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_float8_accum);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_float8_final);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_float8_accum);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_float8_final);
+PG_FUNCTION_INFO_V1(safe_ratio_float8_combine);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_int8_accum);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_int4_accum);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_int8_accum);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_numeric_accum);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_numeric_accum);
+PG_FUNCTION_INFO_V1(safe_ratio_sum_numeric_final);
+PG_FUNCTION_INFO_V1(safe_avg_ratio_numeric_final);
+PG_FUNCTION_INFO_V1(safe_ratio_numeric_combine);
+PG_FUNCTION_INFO_V1(safe_ratio_numeric_serialize);
+PG_FUNCTION_INFO_V1(safe_ratio_numeric_deserialize);
+
+/* function code */
+
+/*
+ * tableau_int8
+ *
+ * Checks a transition array and returns its values.
+ */
+static int64 *
+tableau_int8(ArrayType *tableau, int nombre)
+{
+  if (ARR_NDIM(tableau) != 1 ||
+      ARR_DIMS(tableau)[0] != nombre ||
+      ARR_HASNULL(tableau) ||
+      ARR_ELEMTYPE(tableau) != INT8OID)
+    elog(ERROR, "expected %d-element int8 array", nombre);
+
+  return (int64 *) ARR_DATA_PTR(tableau);
+}
+
+/*
+ * tableau_float8
+ *
+ * Checks a transition array and returns its values.
+ */
+static float8 *
+tableau_float8(ArrayType *tableau, int nombre)
+{
+  if (ARR_NDIM(tableau) != 1 ||
+      ARR_DIMS(tableau)[0] != nombre ||
+      ARR_HASNULL(tableau) ||
+      ARR_ELEMTYPE(tableau) != FLOAT8OID)
+    elog(ERROR, "expected %d-element float8 array", nombre);
+
+  return (float8 *) ARR_DATA_PTR(tableau);
+}
+
+/*
+ * safe_ratio_sum_int4_accum
+ *
+ * Adds the numerator and denominator to their sums, each one ignoring its
+ * own NULLs like sum() does. Not strict for this reason.
+ *
+ * When called as an aggregate, we modify the array in place.
+ */
+Datum
+safe_ratio_sum_int4_accum(PG_FUNCTION_ARGS)
+{
+  ArrayType      *tableau;
+  RatioSommeInt8 *etat;
+
+  if (AggCheckCallContext(fcinfo, NULL))
+    tableau = PG_GETARG_ARRAYTYPE_P(0);
+  else
+    tableau = PG_GETARG_ARRAYTYPE_P_COPY(0);
+
+  etat = (RatioSommeInt8 *) tableau_int8(tableau, 4);
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->nombre_num++;
+    etat->somme_num += PG_GETARG_INT32(1);
+  }
+
+  if (!PG_ARGISNULL(2))
+  {
+    etat->nombre_den++;
+    etat->somme_den += PG_GETARG_INT32(2);
+  }
+
+  PG_RETURN_ARRAYTYPE_P(tableau);
+}
+
+/*
+ * safe_ratio_sum_int4_final
+ *
+ * sum(num) // sum(den), both sums being int8: the result is numeric.
+ */
+Datum
+safe_ratio_sum_int4_final(PG_FUNCTION_ARGS)
+{
+  RatioSommeInt8 *etat;
+  bool            est_null;
+  Numeric         resultat;
+
+  etat = (RatioSommeInt8 *) tableau_int8(PG_GETARG_ARRAYTYPE_P(0), 4);
+
+  /* une somme sans valeur vaut NULL */
+  if (etat->nombre_num == 0 || etat->nombre_den == 0)
+    PG_RETURN_NULL();
+
+  resultat = division_sans_erreur_entiere_interne(etat->somme_num,
+                                                  etat->somme_den,
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+/*
+ * safe_ratio_int8_combine
+ *
+ * Combines two int8[] states of any length: every value is a count or a sum.
+ */
+Datum
+safe_ratio_int8_combine(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau1;
+  ArrayType *tableau2 = PG_GETARG_ARRAYTYPE_P(1);
+  int64     *valeurs1;
+  int64     *valeurs2;
+  int        nombre = ARR_DIMS(tableau2)[0];
+
+  if (AggCheckCallContext(fcinfo, NULL))
+    tableau1 = PG_GETARG_ARRAYTYPE_P(0);
+  else
+    tableau1 = PG_GETARG_ARRAYTYPE_P_COPY(0);
+
+  valeurs1 = tableau_int8(tableau1, nombre);
+  valeurs2 = tableau_int8(tableau2, nombre);
+
+  for (int i = 0; i < nombre; i++)
+    valeurs1[i] += valeurs2[i];
+
+  PG_RETURN_ARRAYTYPE_P(tableau1);
+}
+
+/*
+ * safe_ratio_sum_float8_accum
+ *
+ * Same as safe_ratio_sum_int4_accum, with float8 sums checked for overflow
+ * like sum(float8).
+ */
+Datum
+safe_ratio_sum_float8_accum(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau;
+  float8    *etat;
+
+  if (AggCheckCallContext(fcinfo, NULL))
+    tableau = PG_GETARG_ARRAYTYPE_P(0);
+  else
+    tableau = PG_GETARG_ARRAYTYPE_P_COPY(0);
+
+  /* nombre et somme des numérateurs, puis des dénominateurs */
+  etat = tableau_float8(tableau, 4);
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat[0] += 1.0;
+    etat[1] = float8_pl(etat[1], PG_GETARG_FLOAT8(1));
+  }
+
+  if (!PG_ARGISNULL(2))
+  {
+    etat[2] += 1.0;
+    etat[3] = float8_pl(etat[3], PG_GETARG_FLOAT8(2));
+  }
+
+  PG_RETURN_ARRAYTYPE_P(tableau);
+}
+
+/*
+ * safe_ratio_sum_float8_final
+ *
+ * sum(num) // sum(den) on float8.
+ */
+Datum
+safe_ratio_sum_float8_final(PG_FUNCTION_ARGS)
+{
+  float8 *etat = tableau_float8(PG_GETARG_ARRAYTYPE_P(0), 4);
+  bool    est_null;
+  float8  resultat;
+
+  if (etat[0] == 0.0 || etat[2] == 0.0)
+    PG_RETURN_NULL();
+
+  resultat = division_sans_erreur_float8_interne(etat[1], etat[3], &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_FLOAT8(resultat);
+}
+
+/*
+ * safe_avg_ratio_float8_accum
+ *
+ * Adds num // den to the sum of ratios, unless it is NULL.
+ */
+Datum
+safe_avg_ratio_float8_accum(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau;
+  float8    *etat;
+  bool       est_null;
+  float8     ratio;
+
+  if (AggCheckCallContext(fcinfo, NULL))
+    tableau = PG_GETARG_ARRAYTYPE_P(0);
+  else
+    tableau = PG_GETARG_ARRAYTYPE_P_COPY(0);
+
+  if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+    PG_RETURN_ARRAYTYPE_P(tableau);
+
+  /* nombre et somme des ratios */
+  etat = tableau_float8(tableau, 2);
+
+  ratio = division_sans_erreur_float8_interne(PG_GETARG_FLOAT8(1),
+                                              PG_GETARG_FLOAT8(2),
+                                              &est_null);
+  if (!est_null)
+  {
+    etat[0] += 1.0;
+    etat[1] = float8_pl(etat[1], ratio);
+  }
+
+  PG_RETURN_ARRAYTYPE_P(tableau);
+}
+
+/*
+ * safe_avg_ratio_float8_final
+ *
+ * Same result as avg(float8).
+ */
+Datum
+safe_avg_ratio_float8_final(PG_FUNCTION_ARGS)
+{
+  float8 *etat = tableau_float8(PG_GETARG_ARRAYTYPE_P(0), 2);
+
+  if (etat[0] == 0.0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_FLOAT8(etat[1] / etat[0]);
+}
+
+/*
+ * safe_ratio_float8_combine
+ *
+ * Combines two float8[] states of any length.
+ */
+Datum
+safe_ratio_float8_combine(PG_FUNCTION_ARGS)
+{
+  ArrayType *tableau1;
+  ArrayType *tableau2 = PG_GETARG_ARRAYTYPE_P(1);
+  float8    *valeurs1;
+  float8    *valeurs2;
+  int        nombre = ARR_DIMS(tableau2)[0];
+
+  if (AggCheckCallContext(fcinfo, NULL))
+    tableau1 = PG_GETARG_ARRAYTYPE_P(0);
+  else
+    tableau1 = PG_GETARG_ARRAYTYPE_P_COPY(0);
+
+  valeurs1 = tableau_float8(tableau1, nombre);
+  valeurs2 = tableau_float8(tableau2, nombre);
+
+  for (int i = 0; i < nombre; i++)
+    valeurs1[i] = float8_pl(valeurs1[i], valeurs2[i]);
+
+  PG_RETURN_ARRAYTYPE_P(tableau1);
+}
+
+/*
+ * ratio_etat
+ *
+ * Returns the internal state, created in the aggregate context on first
+ * call.
+ */
+static RatioEtat *
+ratio_etat(FunctionCallInfo fcinfo, MemoryContext *aggcontext)
+{
+  if (!AggCheckCallContext(fcinfo, aggcontext))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  if (PG_ARGISNULL(0))
+    return (RatioEtat *) MemoryContextAllocZero(*aggcontext, sizeof(RatioEtat));
+
+  return (RatioEtat *) PG_GETARG_POINTER(0);
+}
+
+/*
+ * ratio_ajoute_numeric
+ *
+ * Adds a value to a numeric sum kept in the aggregate context.
+ */
+static void
+ratio_ajoute_numeric(Numeric *somme, Numeric valeur, MemoryContext aggcontext)
+{
+  MemoryContext oldcontext;
+  Numeric       nouvelle;
+
+  oldcontext = MemoryContextSwitchTo(aggcontext);
+
+  if (*somme == NULL)
+    nouvelle = DatumGetNumericCopy(NumericGetDatum(valeur));
+  else
+    nouvelle = DatumGetNumeric(DirectFunctionCall2(numeric_add,
+                                                   NumericGetDatum(*somme),
+                                                   NumericGetDatum(valeur)));
+
+  MemoryContextSwitchTo(oldcontext);
+
+  if (*somme != NULL)
+    pfree(*somme);
+  *somme = nouvelle;
+}
+
+/*
+ * ratio_ajoute_int8
+ *
+ * Adds a value to the int64 partial sum, moving it into the numeric sum
+ * first if the addition would overflow.
+ */
+static void
+ratio_ajoute_int8(int64 *partielle, Numeric *somme, int64 valeur,
+                  MemoryContext aggcontext)
+{
+  int64     resultat;
+
+  if (!pg_add_s64_overflow(*partielle, valeur, &resultat))
+  {
+    *partielle = resultat;
+    return;
+  }
+
+  ratio_ajoute_numeric(somme, int64_to_numeric(*partielle), aggcontext);
+  *partielle = valeur;
+}
+
+/*
+ * ratio_total
+ *
+ * Returns the numeric sum plus the int64 partial sum.
+ */
+static Numeric
+ratio_total(Numeric somme, int64 partielle)
+{
+  if (somme == NULL)
+    return int64_to_numeric(partielle);
+
+  if (partielle == 0)
+    return somme;
+
+  return DatumGetNumeric(DirectFunctionCall2(numeric_add,
+                                             NumericGetDatum(somme),
+                                             NumericGetDatum(int64_to_numeric(partielle))));
+}
+
+/*
+ * safe_ratio_sum_int8_accum
+ *
+ * sum(int8) is numeric: the sums are kept in int64 as long as possible.
+ */
+Datum
+safe_ratio_sum_int8_accum(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat = ratio_etat(fcinfo, &aggcontext);
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->nombre_num++;
+    ratio_ajoute_int8(&etat->partielle_num, &etat->somme_num,
+                      PG_GETARG_INT64(1), aggcontext);
+  }
+
+  if (!PG_ARGISNULL(2))
+  {
+    etat->nombre_den++;
+    ratio_ajoute_int8(&etat->partielle_den, &etat->somme_den,
+                      PG_GETARG_INT64(2), aggcontext);
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * ratio_ajoute_entier
+ *
+ * Adds the numeric ratio num // den to the sum, unless it is NULL.
+ */
+static void
+ratio_ajoute_entier(RatioEtat *etat, int64 num, int64 den,
+                    MemoryContext aggcontext)
+{
+  bool          est_null;
+  Numeric       ratio;
+
+  ratio = division_sans_erreur_entiere_interne(num, den, &est_null);
+  if (!est_null)
+  {
+    etat->nombre_num++;
+    ratio_ajoute_numeric(&etat->somme_num, ratio, aggcontext);
+  }
+}
+
+/*
+ * safe_avg_ratio_int4_accum
+ *
+ * Adds num // den to the sum of ratios, unless it is NULL.
+ */
+Datum
+safe_avg_ratio_int4_accum(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat = ratio_etat(fcinfo, &aggcontext);
+
+  if (!PG_ARGISNULL(1) && !PG_ARGISNULL(2))
+    ratio_ajoute_entier(etat, PG_GETARG_INT32(1), PG_GETARG_INT32(2),
+                        aggcontext);
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * safe_avg_ratio_int8_accum
+ *
+ * Adds num // den to the sum of ratios, unless it is NULL.
+ */
+Datum
+safe_avg_ratio_int8_accum(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat = ratio_etat(fcinfo, &aggcontext);
+
+  if (!PG_ARGISNULL(1) && !PG_ARGISNULL(2))
+    ratio_ajoute_entier(etat, PG_GETARG_INT64(1), PG_GETARG_INT64(2),
+                        aggcontext);
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * safe_ratio_sum_numeric_accum
+ *
+ * Adds the numerator and denominator to their numeric sums.
+ */
+Datum
+safe_ratio_sum_numeric_accum(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat = ratio_etat(fcinfo, &aggcontext);
+
+  if (!PG_ARGISNULL(1))
+  {
+    etat->nombre_num++;
+    ratio_ajoute_numeric(&etat->somme_num, PG_GETARG_NUMERIC(1), aggcontext);
+  }
+
+  if (!PG_ARGISNULL(2))
+  {
+    etat->nombre_den++;
+    ratio_ajoute_numeric(&etat->somme_den, PG_GETARG_NUMERIC(2), aggcontext);
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * safe_avg_ratio_numeric_accum
+ *
+ * Adds num // den to the sum of ratios, unless it is NULL.
+ */
+Datum
+safe_avg_ratio_numeric_accum(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat = ratio_etat(fcinfo, &aggcontext);
+  bool          est_null;
+  Numeric       ratio;
+
+  if (PG_ARGISNULL(1) || PG_ARGISNULL(2))
+    PG_RETURN_POINTER(etat);
+
+  ratio = division_sans_erreur_numeric_interne(PG_GETARG_NUMERIC(1),
+                                               PG_GETARG_NUMERIC(2),
+                                               &est_null);
+  if (!est_null)
+  {
+    etat->nombre_num++;
+    ratio_ajoute_numeric(&etat->somme_num, ratio, aggcontext);
+  }
+
+  PG_RETURN_POINTER(etat);
+}
+
+/*
+ * safe_ratio_sum_numeric_final
+ *
+ * sum(num) // sum(den), both sums being numeric.
+ */
+Datum
+safe_ratio_sum_numeric_final(PG_FUNCTION_ARGS)
+{
+  RatioEtat *etat;
+  bool       est_null;
+  Numeric    resultat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (RatioEtat *) PG_GETARG_POINTER(0);
+
+  if (etat == NULL || etat->nombre_num == 0 || etat->nombre_den == 0)
+    PG_RETURN_NULL();
+
+  resultat = division_sans_erreur_numeric_interne(ratio_total(etat->somme_num, etat->partielle_num),
+                                                  ratio_total(etat->somme_den, etat->partielle_den),
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+/*
+ * safe_avg_ratio_numeric_final
+ *
+ * Same result as avg(numeric), used for all types but float8.
+ */
+Datum
+safe_avg_ratio_numeric_final(PG_FUNCTION_ARGS)
+{
+  RatioEtat *etat;
+
+  etat = PG_ARGISNULL(0) ? NULL : (RatioEtat *) PG_GETARG_POINTER(0);
+
+  if (etat == NULL || etat->nombre_num == 0)
+    PG_RETURN_NULL();
+
+  PG_RETURN_DATUM(DirectFunctionCall2(numeric_div,
+                                      NumericGetDatum(ratio_total(etat->somme_num, etat->partielle_num)),
+                                      NumericGetDatum(int64_to_numeric(etat->nombre_num))));
+}
+
+/*
+ * safe_ratio_numeric_combine
+ *
+ * Combines two internal states, used by both aggregates.
+ */
+Datum
+safe_ratio_numeric_combine(PG_FUNCTION_ARGS)
+{
+  MemoryContext aggcontext;
+  RatioEtat    *etat1;
+  RatioEtat    *etat2;
+
+  if (!AggCheckCallContext(fcinfo, &aggcontext))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  etat1 = PG_ARGISNULL(0) ? NULL : (RatioEtat *) PG_GETARG_POINTER(0);
+  etat2 = PG_ARGISNULL(1) ? NULL : (RatioEtat *) PG_GETARG_POINTER(1);
+
+  if (etat2 == NULL)
+    PG_RETURN_POINTER(etat1);
+
+  /* le nouvel état doit vivre dans le contexte de l'agrégat */
+  if (etat1 == NULL)
+    etat1 = (RatioEtat *) MemoryContextAllocZero(aggcontext, sizeof(RatioEtat));
+
+  etat1->nombre_num += etat2->nombre_num;
+  etat1->nombre_den += etat2->nombre_den;
+
+  ratio_ajoute_int8(&etat1->partielle_num, &etat1->somme_num,
+                    etat2->partielle_num, aggcontext);
+  ratio_ajoute_int8(&etat1->partielle_den, &etat1->somme_den,
+                    etat2->partielle_den, aggcontext);
+
+  if (etat2->somme_num != NULL)
+    ratio_ajoute_numeric(&etat1->somme_num, etat2->somme_num, aggcontext);
+  if (etat2->somme_den != NULL)
+    ratio_ajoute_numeric(&etat1->somme_den, etat2->somme_den, aggcontext);
+
+  PG_RETURN_POINTER(etat1);
+}
+
+/*
+ * safe_ratio_numeric_serialize
+ *
+ * Serializes the internal state: both counts, then both sums in numeric's
+ * binary format.
+ */
+Datum
+safe_ratio_numeric_serialize(PG_FUNCTION_ARGS)
+{
+  RatioEtat     *etat;
+  StringInfoData buf;
+  bytea         *somme;
+
+  if (!AggCheckCallContext(fcinfo, NULL))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  etat = (RatioEtat *) PG_GETARG_POINTER(0);
+
+  pq_begintypsend(&buf);
+
+  pq_sendint64(&buf, etat->nombre_num);
+  pq_sendint64(&buf, etat->nombre_den);
+
+  somme = DatumGetByteaPP(DirectFunctionCall1(numeric_send,
+                                              NumericGetDatum(ratio_total(etat->somme_num, etat->partielle_num))));
+  pq_sendbytes(&buf, VARDATA_ANY(somme), VARSIZE_ANY_EXHDR(somme));
+
+  somme = DatumGetByteaPP(DirectFunctionCall1(numeric_send,
+                                              NumericGetDatum(ratio_total(etat->somme_den, etat->partielle_den))));
+  pq_sendbytes(&buf, VARDATA_ANY(somme), VARSIZE_ANY_EXHDR(somme));
+
+  PG_RETURN_BYTEA_P(pq_endtypsend(&buf));
+}
+
+/*
+ * safe_ratio_numeric_deserialize
+ *
+ * Rebuilds the internal state, in the current memory context.
+ */
+Datum
+safe_ratio_numeric_deserialize(PG_FUNCTION_ARGS)
+{
+  bytea         *serialise;
+  RatioEtat     *etat;
+  StringInfoData buf;
+
+  if (!AggCheckCallContext(fcinfo, NULL))
+    elog(ERROR, "aggregate function called in non-aggregate context");
+
+  serialise = PG_GETARG_BYTEA_PP(0);
+
+  initStringInfo(&buf);
+  appendBinaryStringInfo(&buf, VARDATA_ANY(serialise),
+                         VARSIZE_ANY_EXHDR(serialise));
+
+  etat = (RatioEtat *) palloc0(sizeof(RatioEtat));
+
+  etat->nombre_num = pq_getmsgint64(&buf);
+  etat->nombre_den = pq_getmsgint64(&buf);
+
+  etat->somme_num = DatumGetNumeric(DirectFunctionCall3(numeric_recv,
+                                                        PointerGetDatum(&buf),
+                                                        ObjectIdGetDatum(InvalidOid),
+                                                        Int32GetDatum(-1)));
+  etat->somme_den = DatumGetNumeric(DirectFunctionCall3(numeric_recv,
+                                                        PointerGetDatum(&buf),
+                                                        ObjectIdGetDatum(InvalidOid),
+                                                        Int32GetDatum(-1)));
+
+  pq_getmsgend(&buf);
+  pfree(buf.data);
+
+  PG_RETURN_POINTER(etat);
+}
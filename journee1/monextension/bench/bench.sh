@@ -0,0 +1,100 @@
+#!/bin/bash
+#
+# Mesure du coût par appel des fonctions de monextension : version SQL
+# (monextension--1.0.sql et monextension--1.0--2.0.sql), version C sans JIT et
+# version C avec JIT (inlining forcé), pour plusieurs volumétries.
+#
+# La connexion se règle avec les variables PGHOST, PGPORT, PGDATABASE...
+# Variables propres au script :
+#   LIGNES     volumétries testées (défaut : "10000 100000 1000000")
+#   DUREE      durée de chaque passe pgbench en secondes (défaut : 10)
+#   RESULTATS  répertoire des résultats (défaut : ./resultats)
+#
+
+set -e
+
+LIGNES=${LIGNES:-"10000 100000 1000000"}
+DUREE=${DUREE:-10}
+RESULTATS=${RESULTATS:-./resultats}
+REPERTOIRE=$(dirname "$0")
+
+JIT_OFF="-c jit=off"
+JIT_ON="-c jit=on -c jit_above_cost=0 -c jit_inline_above_cost=0 -c jit_optimize_above_cost=0"
+
+mkdir -p "$RESULTATS"
+
+# Sans bitcode installé, le JIT ne peut pas inliner les fonctions C
+PKGLIBDIR=$(pg_config --pkglibdir)
+if [ ! -f "$PKGLIBDIR/bitcode/monextension.index.bc" ]; then
+  echo "ATTENTION : pas de bitcode dans $PKGLIBDIR/bitcode/monextension," \
+       "le JIT n'inlinera pas les fonctions C (PostgreSQL compilé sans LLVM ?)" >&2
+fi
+
+psql -X -q -v ON_ERROR_STOP=1 <<SQL
+CREATE EXTENSION IF NOT EXISTS monextension;
+ALTER EXTENSION monextension UPDATE;
+
+-- copies des versions SQL d'origine
+CREATE OR REPLACE FUNCTION bench_incremente_sql(int)
+RETURNS int
+LANGUAGE sql
+AS 'SELECT \$1+1';
+
+CREATE OR REPLACE FUNCTION bench_division_sql(numeric, numeric)
+RETURNS numeric
+LANGUAGE sql
+AS 'SELECT CASE WHEN \$2=0 THEN NULL ELSE \$1/\$2 END';
+SQL
+
+for lignes in $LIGNES; do
+  psql -X -q -v ON_ERROR_STOP=1 <<SQL
+DROP TABLE IF EXISTS bench_$lignes;
+CREATE TABLE bench_$lignes AS
+  SELECT i AS a, i % 10 AS b FROM generate_series(1, $lignes) i;
+VACUUM ANALYZE bench_$lignes;
+SQL
+done
+
+# une ligne par mesure : script;lignes;jit;tps;latence moyenne (ms)
+echo "script;lignes;jit;tps;latence_ms" > "$RESULTATS/resultats.csv"
+
+passe()
+{
+  script=$1
+  lignes=$2
+  jit=$3
+  options=$4
+  sortie="$RESULTATS/$script-$lignes-$jit.log"
+
+  PGOPTIONS="$options" pgbench -n -M simple -T "$DUREE" \
+    -D table="bench_$lignes" -f "$REPERTOIRE/$script.sql" > "$sortie"
+
+  tps=$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' "$sortie")
+  latence=$(sed -n 's/^latency average = \([0-9.]*\) ms/\1/p' "$sortie")
+  echo "$script;$lignes;$jit;$tps;$latence" >> "$RESULTATS/resultats.csv"
+}
+
+for lignes in $LIGNES; do
+  passe incremente_sql "$lignes" off "$JIT_OFF"
+  passe incremente_c "$lignes" off "$JIT_OFF"
+  passe incremente_c "$lignes" on "$JIT_ON"
+  passe division_sql "$lignes" off "$JIT_OFF"
+  passe division_c "$lignes" off "$JIT_OFF"
+  passe division_c "$lignes" on "$JIT_ON"
+  passe division_c_int4 "$lignes" off "$JIT_OFF"
+  passe division_c_int4 "$lignes" on "$JIT_ON"
+done
+
+# l'inlining a-t-il eu lieu ?
+PGOPTIONS="$JIT_ON" psql -X -q > "$RESULTATS/jit.txt" <<SQL
+EXPLAIN (ANALYZE, COSTS OFF, TIMING OFF, SUMMARY OFF)
+  SELECT sum(incremente(a)) FROM bench_${LIGNES%% *};
+SQL
+
+# synthèse : coût par ligne en nanosecondes
+echo
+echo "Synthèse (ns par ligne) :"
+awk -F';' 'NR > 1 { printf "%-16s %10s lignes  jit=%-3s %10.1f ns\n", $1, $2, $3, $5 * 1000000 / $2 }' \
+  "$RESULTATS/resultats.csv" | tee "$RESULTATS/synthese.txt"
+echo
+grep -A 4 "^ JIT:" "$RESULTATS/jit.txt" || echo "JIT non utilisé (voir $RESULTATS/jit.txt)"
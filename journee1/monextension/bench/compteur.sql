@@ -0,0 +1 @@
+SELECT compteur_suivant('bench');
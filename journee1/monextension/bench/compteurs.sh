@@ -0,0 +1,70 @@
+#!/bin/bash
+#
+# Passage à l'échelle de compteur_suivant() comparé à nextval(), selon le
+# nombre de clients. monextension doit être dans shared_preload_libraries.
+#
+# La connexion se règle avec les variables PGHOST, PGPORT, PGDATABASE...
+# Variables propres au script :
+#   CLIENTS    nombres de clients testés (défaut : "1 2 4 8 16 32 64")
+#   BLOCS      valeurs de monextension.compteurs_bloc (défaut : "1 100")
+#   DUREE      durée de chaque passe pgbench en secondes (défaut : 10)
+#   RESULTATS  répertoire des résultats (défaut : ./resultats)
+#
+
+set -e
+
+CLIENTS=${CLIENTS:-"1 2 4 8 16 32 64"}
+BLOCS=${BLOCS:-"1 100"}
+DUREE=${DUREE:-10}
+RESULTATS=${RESULTATS:-./resultats}
+REPERTOIRE=$(dirname "$0")
+
+mkdir -p "$RESULTATS"
+
+psql -X -q -v ON_ERROR_STOP=1 <<SQL
+CREATE EXTENSION IF NOT EXISTS monextension;
+ALTER EXTENSION monextension UPDATE;
+SELECT compteur_supprime(nom) FROM compteurs() WHERE nom = 'bench';
+SELECT compteur_cree('bench');
+DROP SEQUENCE IF EXISTS bench_sequence;
+CREATE SEQUENCE bench_sequence;
+SQL
+
+# une ligne par mesure : methode;bloc;clients;tps
+echo "methode;bloc;clients;tps" > "$RESULTATS/compteurs.csv"
+
+passe()
+{
+  script=$1
+  bloc=$2
+  clients=$3
+  sortie="$RESULTATS/$script-$bloc-$clients.log"
+  options=""
+
+  if [ "$bloc" != "-" ]; then
+    options="-c monextension.compteurs_bloc=$bloc"
+  fi
+
+  PGOPTIONS="$options" \
+    pgbench -n -M prepared -T "$DUREE" -c "$clients" -j "$clients" \
+    -f "$REPERTOIRE/$script.sql" > "$sortie"
+
+  tps=$(sed -n 's/^tps = \([0-9.]*\).*/\1/p' "$sortie")
+  echo "$script;$bloc;$clients;$tps" >> "$RESULTATS/compteurs.csv"
+}
+
+for clients in $CLIENTS; do
+  passe sequence - "$clients"
+  for bloc in $BLOCS; do
+    passe compteur "$bloc" "$clients"
+  done
+done
+
+# synthèse : débit et efficacité par rapport à un client
+echo
+echo "Synthèse (appels par seconde, efficacité par client) :"
+awk -F';' 'NR > 1 {
+  cle = $1 " bloc=" $2
+  if (!(cle in base)) base[cle] = $4 / $3
+  printf "%-20s %4s clients %12.0f tps  %5.1f %%\n", cle, $3, $4, 100 * $4 / $3 / base[cle]
+}' "$RESULTATS/compteurs.csv" | tee "$RESULTATS/synthese_compteurs.txt"
@@ -0,0 +1 @@
+SELECT sum(a::numeric // b::numeric) FROM :table;
@@ -0,0 +1 @@
+SELECT sum(a // b) FROM :table;
@@ -0,0 +1 @@
+SELECT sum(bench_division_sql(a, b)) FROM :table;
@@ -0,0 +1 @@
+SELECT sum(incremente(a)) FROM :table;
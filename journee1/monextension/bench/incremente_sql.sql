@@ -0,0 +1 @@
+SELECT sum(bench_incremente_sql(a)) FROM :table;
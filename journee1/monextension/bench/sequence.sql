@@ -0,0 +1 @@
+SELECT nextval('bench_sequence');
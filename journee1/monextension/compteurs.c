@@ -0,0 +1,884 @@
+/*
+ * compteurs.c
+ *
+ * Compteurs nommés en mémoire partagée, avec la sémantique de incremente().
+ *
+ * Contrairement aux séquences, un appel à compteur_suivant() ne prend aucun
+ * verrou et n'écrit aucun WAL : la valeur est incrémentée par une addition
+ * atomique sur une ligne de cache qui n'est partagée avec aucun autre
+ * compteur. Avec monextension.compteurs_bloc > 1, chaque processus réserve un
+ * bloc de valeurs et les distribue localement, comme le CACHE d'une séquence.
+ *
+ * Les compteurs sont communs à toute l'instance et ne sont pas
+ * transactionnels. Comme une séquence écrit dans le WAL des valeurs d'avance,
+ * chaque compteur a un plafond écrit sur disque avant qu'une valeur le
+ * dépasse : le processus qui le franchit l'avance de
+ * monextension.compteurs_marge et synchronise le fichier des compteurs. Après
+ * un arrêt brutal, les compteurs reprennent à leur plafond et ne peuvent pas
+ * redistribuer une valeur déjà donnée. Le postmaster sauvegarde les valeurs
+ * exactes à l'arrêt.
+ */
+#include "postgres.h"
+#include "fmgr.h"
+
+#include <unistd.h>
+
+#include "funcapi.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "port/atomics.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+
+#include "compteurs.h"
+
+#define COMPTEURS_FICHIER	PGSTAT_STAT_PERMANENT_DIRECTORY "/monextension_compteurs.stat"
+#define COMPTEURS_MAGIC		0x4d4f4e43	/* "MONC" */
+#define COMPTEURS_VERSION	1
+
+/* structure definitions */
+
+/* valeur d'un compteur, seule sur sa ligne de cache avec son plafond */
+typedef struct
+{
+  pg_atomic_uint64 valeur;
+  /* plus grande valeur qu'on peut distribuer, déjà écrite sur disque */
+  pg_atomic_uint64 plafond;
+  char             pad[PG_CACHE_LINE_SIZE - 2 * sizeof(pg_atomic_uint64)];
+} CompteurValeur;
+
+/* description d'un compteur, lue à chaque appel mais rarement modifiée */
+typedef struct
+{
+  char             nom[NAMEDATALEN];
+  bool             utilise;
+  /* change à chaque création, suppression ou repositionnement */
+  pg_atomic_uint32 generation;
+} CompteurEntete;
+
+typedef struct
+{
+  LWLock   *lock;             /* protège les entêtes */
+  LWLock   *sauvegarde_lock;  /* protège le fichier et les plafonds */
+} CompteursEtat;
+
+/* bloc de valeurs réservé par ce processus pour un compteur */
+typedef struct
+{
+  char      nom[NAMEDATALEN]; /* clé de la table de hachage */
+  int       indice;
+  uint32    generation;
+  uint64    prochaine;
+  uint64    fin;
+} CompteurLocal;
+
+/* format du fichier de sauvegarde */
+typedef struct
+{
+  uint32    magic;
+  uint32    version;
+  bool      propre;           /* écrit à l'arrêt du postmaster ? */
+  int32     nombre;
+} CompteursFichierEntete;
+
+typedef struct
+{
+  char      nom[NAMEDATALEN];
+  uint64    valeur;
+  uint64    plafond;
+} CompteurSauvegarde;
+
+/* variable definitions */
+static int  compteurs_max = 64;
+static int  compteurs_bloc = 1;
+static int  compteurs_marge = 100000;
+
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static CompteursEtat  *etat = NULL;
+static CompteurEntete *entetes = NULL;
+static CompteurValeur *valeurs = NULL;
+
+static HTAB *compteurs_locaux = NULL;
+
+/* function definitions */
+static Size compteurs_memsize(void);
+static void compteurs_shmem_request(void);
+static void compteurs_shmem_startup(void);
+static void compteurs_shmem_shutdown(int code, Datum arg);
+static void compteurs_charge(void);
+static bool compteurs_sauvegarde(bool propre, int indice, uint64 plafond,
+                                 int elevel);
+static int  compteur_indice(const char *nom);
+static CompteurLocal *compteur_local(const char *nom);
+static bool compteur_reserve(CompteurLocal *local, int nombre);
+static void compteur_avance_plafond(int indice, uint64 fin);
+static char *compteur_nom(text *texte);
+PG_FUNCTION_INFO_V1(compteur_cree);
+PG_FUNCTION_INFO_V1(compteur_suivant);
+PG_FUNCTION_INFO_V1(compteur_valeur);
+PG_FUNCTION_INFO_V1(compteur_positionne);
+PG_FUNCTION_INFO_V1(compteur_supprime);
+PG_FUNCTION_INFO_V1(compteurs);
+
+/* function code */
+
+/*
+ * compteurs_init
+ *
+ * Declares our GUCs and shared memory. Only possible when loaded via
+ * shared_preload_libraries.
+ */
+void
+compteurs_init(void)
+{
+  if (!process_shared_preload_libraries_in_progress)
+    return;
+
+  DefineCustomIntVariable("monextension.compteurs_max",
+    "Nombre maximum de compteurs.",
+    NULL,
+    &compteurs_max,
+    64,
+    1, 65536,
+    PGC_POSTMASTER,
+    0,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("monextension.compteurs_bloc",
+    "Nombre de valeurs réservées à la fois par un processus.",
+    "Avec 1, les valeurs sont distribuées dans l'ordre à tous les processus.",
+    &compteurs_bloc,
+    1,
+    1, 1000000,
+    PGC_USERSET,
+    0,
+    NULL, NULL, NULL);
+
+  DefineCustomIntVariable("monextension.compteurs_marge",
+    "Nombre de valeurs réservées sur disque à chaque avance d'un plafond.",
+    "Chaque avance synchronise le fichier des compteurs. Les valeurs "
+    "réservées et non distribuées sont sautées après un arrêt brutal.",
+    &compteurs_marge,
+    100000,
+    0, INT_MAX,
+    PGC_SIGHUP,
+    0,
+    NULL, NULL, NULL);
+
+  MarkGUCPrefixReserved("monextension");
+
+  prev_shmem_request_hook = shmem_request_hook;
+  shmem_request_hook = compteurs_shmem_request;
+  prev_shmem_startup_hook = shmem_startup_hook;
+  shmem_startup_hook = compteurs_shmem_startup;
+}
+
+/*
+ * compteurs_memsize
+ *
+ * Size of the shared memory: state, headers, then one cache line per value.
+ */
+static Size
+compteurs_memsize(void)
+{
+  Size      taille;
+
+  taille = CACHELINEALIGN(sizeof(CompteursEtat));
+  taille = add_size(taille,
+                    CACHELINEALIGN(mul_size(compteurs_max, sizeof(CompteurEntete))));
+  taille = add_size(taille, mul_size(compteurs_max, sizeof(CompteurValeur)));
+
+  /* pour aligner le début sur une ligne de cache */
+  return add_size(taille, PG_CACHE_LINE_SIZE);
+}
+
+/*
+ * compteurs_shmem_request
+ *
+ * Requests shared memory and our locks.
+ */
+static void
+compteurs_shmem_request(void)
+{
+  if (prev_shmem_request_hook)
+    prev_shmem_request_hook();
+
+  RequestAddinShmemSpace(compteurs_memsize());
+  RequestNamedLWLockTranche("monextension", 2);
+}
+
+/*
+ * compteurs_shmem_startup
+ *
+ * Initializes shared memory, and loads the saved counters when done by the
+ * postmaster.
+ */
+static void
+compteurs_shmem_startup(void)
+{
+  bool      trouve;
+  char     *base;
+
+  if (prev_shmem_startup_hook)
+    prev_shmem_startup_hook();
+
+  LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+
+  base = ShmemInitStruct("monextension compteurs", compteurs_memsize(), &trouve);
+  base = (char *) CACHELINEALIGN(base);
+  etat = (CompteursEtat *) base;
+  base += CACHELINEALIGN(sizeof(CompteursEtat));
+  entetes = (CompteurEntete *) base;
+  base += CACHELINEALIGN(mul_size(compteurs_max, sizeof(CompteurEntete)));
+  valeurs = (CompteurValeur *) base;
+
+  if (!trouve)
+  {
+    LWLockPadded *locks = GetNamedLWLockTranche("monextension");
+
+    etat->lock = &locks[0].lock;
+    etat->sauvegarde_lock = &locks[1].lock;
+
+    for (int i = 0; i < compteurs_max; i++)
+    {
+      entetes[i].nom[0] = '\0';
+      entetes[i].utilise = false;
+      pg_atomic_init_u32(&entetes[i].generation, 0);
+      pg_atomic_init_u64(&valeurs[i].valeur, 0);
+      pg_atomic_init_u64(&valeurs[i].plafond, 0);
+    }
+  }
+
+  LWLockRelease(AddinShmemInitLock);
+
+  /* seul le postmaster lit et écrit le fichier au démarrage et à l'arrêt */
+  if (!IsUnderPostmaster)
+    on_shmem_exit(compteurs_shmem_shutdown, (Datum) 0);
+
+  if (!trouve)
+    compteurs_charge();
+}
+
+/*
+ * compteurs_shmem_shutdown
+ *
+ * Saves the counters when the postmaster stops. Every other process is gone
+ * at this point, so this is the only clean save.
+ */
+static void
+compteurs_shmem_shutdown(int code, Datum arg)
+{
+  /* pas de sauvegarde lors d'un arrêt brutal */
+  if (code)
+    return;
+
+  if (!etat)
+    return;
+
+  (void) compteurs_sauvegarde(true, -1, 0, LOG);
+}
+
+/*
+ * compteurs_charge
+ *
+ * Reads the saved counters. If the file was not written by a clean shutdown,
+ * the values handed out since the last save are unknown: every counter
+ * restarts at its ceiling, that no value handed out could exceed.
+ */
+static void
+compteurs_charge(void)
+{
+  FILE     *fichier;
+  CompteursFichierEntete entete;
+  CompteurSauvegarde sauvegarde;
+  int       charges = 0;
+
+  fichier = AllocateFile(COMPTEURS_FICHIER, PG_BINARY_R);
+  if (fichier == NULL)
+  {
+    if (errno != ENOENT)
+      ereport(LOG,
+              (errcode_for_file_access(),
+               errmsg("could not read file \"%s\": %m", COMPTEURS_FICHIER)));
+    return;
+  }
+
+  if (fread(&entete, sizeof(entete), 1, fichier) != 1 ||
+      entete.magic != COMPTEURS_MAGIC ||
+      entete.version != COMPTEURS_VERSION)
+  {
+    ereport(LOG,
+            (errmsg("ignoring invalid file \"%s\"", COMPTEURS_FICHIER)));
+    FreeFile(fichier);
+    return;
+  }
+
+  for (int i = 0; i < entete.nombre; i++)
+  {
+    uint64    valeur;
+
+    if (fread(&sauvegarde, sizeof(sauvegarde), 1, fichier) != 1)
+    {
+      ereport(LOG,
+              (errmsg("file \"%s\" is truncated", COMPTEURS_FICHIER)));
+      break;
+    }
+
+    if (charges >= compteurs_max)
+    {
+      ereport(LOG,
+              (errmsg("%d compteurs ignorés, monextension.compteurs_max trop petit",
+                      entete.nombre - charges)));
+      break;
+    }
+
+    valeur = entete.propre ? sauvegarde.valeur : sauvegarde.plafond;
+
+    sauvegarde.nom[NAMEDATALEN - 1] = '\0';
+    strlcpy(entetes[charges].nom, sauvegarde.nom, NAMEDATALEN);
+    entetes[charges].utilise = true;
+    pg_atomic_write_u64(&valeurs[charges].valeur, valeur);
+    /* le prochain plafond sera écrit avant la première valeur distribuée */
+    pg_atomic_write_u64(&valeurs[charges].plafond, valeur);
+    charges++;
+  }
+
+  FreeFile(fichier);
+
+  if (!entete.propre)
+    ereport(LOG,
+            (errmsg("arrêt brutal détecté, %d compteurs repris à leur plafond",
+                    charges)));
+
+  /*
+   * Le fichier ne décrit plus un arrêt propre : en cas de nouvel arrêt
+   * brutal, les compteurs doivent reprendre à leur plafond.
+   */
+  (void) compteurs_sauvegarde(false, -1, 0, LOG);
+}
+
+/*
+ * compteurs_sauvegarde
+ *
+ * Writes every counter into a temporary file, then renames it durably. The
+ * ceiling saved for the counter "indice" is "plafond", not the one in shared
+ * memory, which the caller only raises once it is on disk. Failures are
+ * reported at "elevel".
+ *
+ * The caller holds sauvegarde_lock, except the postmaster, alone at startup
+ * and shutdown.
+ */
+static bool
+compteurs_sauvegarde(bool propre, int indice, uint64 plafond, int elevel)
+{
+  FILE     *fichier;
+  CompteursFichierEntete entete;
+  CompteurSauvegarde *sauvegardes;
+  int       save_errno;
+
+  sauvegardes = palloc(compteurs_max * sizeof(CompteurSauvegarde));
+
+  entete.magic = COMPTEURS_MAGIC;
+  entete.version = COMPTEURS_VERSION;
+  entete.propre = propre;
+  entete.nombre = 0;
+
+  /* le postmaster n'a pas de PGPROC, mais il est alors seul */
+  if (IsUnderPostmaster)
+    LWLockAcquire(etat->lock, LW_SHARED);
+
+  for (int i = 0; i < compteurs_max; i++)
+  {
+    if (!entetes[i].utilise)
+      continue;
+
+    memset(&sauvegardes[entete.nombre], 0, sizeof(CompteurSauvegarde));
+    strlcpy(sauvegardes[entete.nombre].nom, entetes[i].nom, NAMEDATALEN);
+    sauvegardes[entete.nombre].valeur = pg_atomic_read_u64(&valeurs[i].valeur);
+    sauvegardes[entete.nombre].plafond =
+      (i == indice ? plafond : pg_atomic_read_u64(&valeurs[i].plafond));
+    entete.nombre++;
+  }
+
+  if (IsUnderPostmaster)
+    LWLockRelease(etat->lock);
+
+  fichier = AllocateFile(COMPTEURS_FICHIER ".tmp", PG_BINARY_W);
+  if (fichier == NULL)
+    goto erreur;
+
+  if (fwrite(&entete, sizeof(entete), 1, fichier) != 1 ||
+      fwrite(sauvegardes, sizeof(CompteurSauvegarde), entete.nombre, fichier) != entete.nombre)
+  {
+    FreeFile(fichier);
+    goto erreur;
+  }
+
+  if (FreeFile(fichier))
+    goto erreur;
+
+  pfree(sauvegardes);
+
+  return durable_rename(COMPTEURS_FICHIER ".tmp", COMPTEURS_FICHIER,
+                        elevel) == 0;
+
+erreur:
+  /* avec ERROR, ereport() ne revient pas : on nettoie avant */
+  save_errno = errno;
+  unlink(COMPTEURS_FICHIER ".tmp");
+  pfree(sauvegardes);
+  errno = save_errno;
+  ereport(elevel,
+          (errcode_for_file_access(),
+           errmsg("could not write file \"%s\": %m",
+                  COMPTEURS_FICHIER ".tmp")));
+  return false;
+}
+
+/*
+ * compteur_indice
+ *
+ * Returns the slot of a counter, -1 if it does not exist. The caller holds
+ * the lock.
+ */
+static int
+compteur_indice(const char *nom)
+{
+  for (int i = 0; i < compteurs_max; i++)
+  {
+    if (entetes[i].utilise && strcmp(entetes[i].nom, nom) == 0)
+      return i;
+  }
+
+  return -1;
+}
+
+/*
+ * compteur_nom
+ *
+ * Checks the counter name given by the user.
+ */
+static char *
+compteur_nom(text *texte)
+{
+  char     *nom = text_to_cstring(texte);
+
+  if (etat == NULL)
+    ereport(ERROR,
+            (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+             errmsg("monextension doit être chargée via shared_preload_libraries")));
+
+  if (strlen(nom) >= NAMEDATALEN)
+    ereport(ERROR,
+            (errcode(ERRCODE_NAME_TOO_LONG),
+             errmsg("nom de compteur trop long (%d caractères maximum)",
+                    NAMEDATALEN - 1)));
+
+  return nom;
+}
+
+/*
+ * compteur_local
+ *
+ * Returns this process' entry for a counter. The shared memory is only
+ * searched, under lock, on first use or when the counter was changed since.
+ */
+static CompteurLocal *
+compteur_local(const char *nom)
+{
+  CompteurLocal *local;
+  bool      trouve;
+  int       indice;
+
+  if (compteurs_locaux == NULL)
+  {
+    HASHCTL   ctl;
+
+    ctl.keysize = NAMEDATALEN;
+    ctl.entrysize = sizeof(CompteurLocal);
+    compteurs_locaux = hash_create("monextension compteurs locaux", 64,
+                                   &ctl, HASH_ELEM | HASH_STRINGS);
+  }
+
+  local = hash_search(compteurs_locaux, nom, HASH_ENTER, &trouve);
+  if (trouve &&
+      pg_atomic_read_u32(&entetes[local->indice].generation) == local->generation)
+    return local;
+
+  LWLockAcquire(etat->lock, LW_SHARED);
+
+  indice = compteur_indice(nom);
+  if (indice < 0)
+  {
+    LWLockRelease(etat->lock);
+    hash_search(compteurs_locaux, nom, HASH_REMOVE, NULL);
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("le compteur \"%s\" n'existe pas", nom)));
+  }
+
+  /* un éventuel bloc réservé auparavant n'est plus valable */
+  local->indice = indice;
+  local->generation = pg_atomic_read_u32(&entetes[indice].generation);
+  local->prochaine = 1;
+  local->fin = 0;
+
+  LWLockRelease(etat->lock);
+
+  return local;
+}
+
+/*
+ * compteur_reserve
+ *
+ * Reserves the next "nombre" values of a counter with a single atomic
+ * addition. Past PG_INT64_MAX, the addition is undone and, like incremente(),
+ * we raise an error.
+ *
+ * Values beyond the ceiling of the counter are only handed out once
+ * compteur_avance_plafond() wrote a higher one on disk.
+ *
+ * Returns false if the counter was changed or dropped since compteur_local()
+ * looked it up: the values may belong to another counter and the caller must
+ * look it up again. Those values are lost, as with a sequence.
+ */
+static bool
+compteur_reserve(CompteurLocal *local, int nombre)
+{
+  pg_atomic_uint64 *valeur = &valeurs[local->indice].valeur;
+  pg_atomic_uint32 *generation = &entetes[local->indice].generation;
+  uint64    ancienne;
+
+  /* l'addition est une barrière : la génération est relue après elle */
+  ancienne = pg_atomic_fetch_add_u64(valeur, nombre);
+
+  if (ancienne > (uint64) PG_INT64_MAX - nombre)
+  {
+    pg_atomic_fetch_sub_u64(valeur, nombre);
+
+    if (pg_atomic_read_u32(generation) != local->generation)
+      return false;
+
+    /* il reste peut-être quelques valeurs, mais pas un bloc complet */
+    if (nombre > 1)
+      return compteur_reserve(local, 1);
+
+    elog(ERROR, "valeur maximale dépassée après incrément");
+  }
+
+  if (ancienne + nombre > pg_atomic_read_u64(&valeurs[local->indice].plafond))
+    compteur_avance_plafond(local->indice, ancienne + nombre);
+
+  if (pg_atomic_read_u32(generation) != local->generation)
+    return false;
+
+  local->prochaine = ancienne + 1;
+  local->fin = ancienne + nombre;
+
+  return true;
+}
+
+/*
+ * compteur_avance_plafond
+ *
+ * Raises the ceiling of a counter to "fin" plus compteurs_marge, once it is
+ * on disk: like a sequence logging values ahead, a crash can never bring the
+ * counter back below a value handed out. The processes crossing the ceiling
+ * at the same time wait for the first one, and most find it raised already.
+ */
+static void
+compteur_avance_plafond(int indice, uint64 fin)
+{
+  pg_atomic_uint64 *plafond = &valeurs[indice].plafond;
+  uint64    nouveau;
+
+  LWLockAcquire(etat->sauvegarde_lock, LW_EXCLUSIVE);
+
+  if (pg_atomic_read_u64(plafond) < fin)
+  {
+    nouveau = Min(fin + compteurs_marge, (uint64) PG_INT64_MAX);
+
+    /* ERROR : aucune valeur au-delà de l'ancien plafond n'est distribuée */
+    (void) compteurs_sauvegarde(false, indice, nouveau, ERROR);
+    pg_atomic_write_u64(plafond, nouveau);
+  }
+
+  LWLockRelease(etat->sauvegarde_lock);
+}
+
+/*
+ * compteur_cree
+ *
+ * Creates a counter. The first value returned will be the given one plus 1.
+ */
+Datum
+compteur_cree(PG_FUNCTION_ARGS)
+{
+  char     *nom = compteur_nom(PG_GETARG_TEXT_PP(0));
+  int64     valeur = PG_GETARG_INT64(1);
+  int       libre = -1;
+
+  if (valeur < 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("la valeur d'un compteur ne peut pas être négative")));
+
+  LWLockAcquire(etat->sauvegarde_lock, LW_EXCLUSIVE);
+  LWLockAcquire(etat->lock, LW_EXCLUSIVE);
+
+  for (int i = 0; i < compteurs_max; i++)
+  {
+    if (!entetes[i].utilise)
+    {
+      if (libre < 0)
+        libre = i;
+    }
+    else if (strcmp(entetes[i].nom, nom) == 0)
+    {
+      LWLockRelease(etat->lock);
+      LWLockRelease(etat->sauvegarde_lock);
+      ereport(ERROR,
+              (errcode(ERRCODE_DUPLICATE_OBJECT),
+               errmsg("le compteur \"%s\" existe déjà", nom)));
+    }
+  }
+
+  if (libre < 0)
+  {
+    LWLockRelease(etat->lock);
+    LWLockRelease(etat->sauvegarde_lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+             errmsg("nombre maximum de compteurs atteint"),
+             errhint("Augmentez monextension.compteurs_max.")));
+  }
+
+  strlcpy(entetes[libre].nom, nom, NAMEDATALEN);
+  pg_atomic_write_u64(&valeurs[libre].valeur, valeur);
+  pg_atomic_write_u64(&valeurs[libre].plafond, valeur);
+  pg_atomic_fetch_add_u32(&entetes[libre].generation, 1);
+  entetes[libre].utilise = true;
+
+  LWLockRelease(etat->lock);
+
+  /* le compteur existe déjà en mémoire : un échec n'est qu'un avertissement */
+  (void) compteurs_sauvegarde(false, -1, 0, WARNING);
+  LWLockRelease(etat->sauvegarde_lock);
+
+  PG_RETURN_VOID();
+}
+
+/*
+ * compteur_suivant
+ *
+ * Increments a counter and returns the new value, taken from this process'
+ * block when compteurs_bloc > 1.
+ */
+Datum
+compteur_suivant(PG_FUNCTION_ARGS)
+{
+  char     *nom = compteur_nom(PG_GETARG_TEXT_PP(0));
+  CompteurLocal *local;
+
+  /* compteur_local() cherche à nouveau un compteur modifié entre-temps */
+  do
+    local = compteur_local(nom);
+  while (local->prochaine > local->fin &&
+         !compteur_reserve(local, compteurs_bloc));
+
+  PG_RETURN_INT64((int64) local->prochaine++);
+}
+
+/*
+ * compteur_valeur
+ *
+ * Returns the last value handed out, or reserved in a block, for a counter.
+ */
+Datum
+compteur_valeur(PG_FUNCTION_ARGS)
+{
+  char     *nom = compteur_nom(PG_GETARG_TEXT_PP(0));
+  CompteurLocal *local;
+  uint64    valeur;
+
+  /* comme dans compteur_reserve(), la valeur doit être celle du compteur */
+  do
+  {
+    local = compteur_local(nom);
+    valeur = pg_atomic_read_u64(&valeurs[local->indice].valeur);
+    pg_read_barrier();
+  } while (pg_atomic_read_u32(&entetes[local->indice].generation) != local->generation);
+
+  PG_RETURN_INT64((int64) valeur);
+}
+
+/*
+ * compteur_positionne
+ *
+ * Sets the value of a counter, as its ceiling. Blocks reserved by other
+ * processes are discarded on their next call.
+ */
+Datum
+compteur_positionne(PG_FUNCTION_ARGS)
+{
+  char     *nom = compteur_nom(PG_GETARG_TEXT_PP(0));
+  int64     valeur = PG_GETARG_INT64(1);
+  int       indice;
+
+  if (valeur < 0)
+    ereport(ERROR,
+            (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+             errmsg("la valeur d'un compteur ne peut pas être négative")));
+
+  LWLockAcquire(etat->sauvegarde_lock, LW_EXCLUSIVE);
+  LWLockAcquire(etat->lock, LW_EXCLUSIVE);
+
+  indice = compteur_indice(nom);
+  if (indice < 0)
+  {
+    LWLockRelease(etat->lock);
+    LWLockRelease(etat->sauvegarde_lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("le compteur \"%s\" n'existe pas", nom)));
+  }
+
+  pg_atomic_write_u64(&valeurs[indice].valeur, valeur);
+  pg_atomic_write_u64(&valeurs[indice].plafond, valeur);
+  pg_atomic_fetch_add_u32(&entetes[indice].generation, 1);
+
+  LWLockRelease(etat->lock);
+
+  (void) compteurs_sauvegarde(false, -1, 0, WARNING);
+  LWLockRelease(etat->sauvegarde_lock);
+
+  PG_RETURN_VOID();
+}
+
+/*
+ * compteur_supprime
+ *
+ * Drops a counter.
+ */
+Datum
+compteur_supprime(PG_FUNCTION_ARGS)
+{
+  char     *nom = compteur_nom(PG_GETARG_TEXT_PP(0));
+  int       indice;
+
+  LWLockAcquire(etat->sauvegarde_lock, LW_EXCLUSIVE);
+  LWLockAcquire(etat->lock, LW_EXCLUSIVE);
+
+  indice = compteur_indice(nom);
+  if (indice < 0)
+  {
+    LWLockRelease(etat->lock);
+    LWLockRelease(etat->sauvegarde_lock);
+    ereport(ERROR,
+            (errcode(ERRCODE_UNDEFINED_OBJECT),
+             errmsg("le compteur \"%s\" n'existe pas", nom)));
+  }
+
+  entetes[indice].utilise = false;
+  entetes[indice].nom[0] = '\0';
+  pg_atomic_fetch_add_u32(&entetes[indice].generation, 1);
+
+  LWLockRelease(etat->lock);
+
+  (void) compteurs_sauvegarde(false, -1, 0, WARNING);
+  LWLockRelease(etat->sauvegarde_lock);
+
+  PG_RETURN_VOID();
+}
+
+/*
+ * compteurs
+ *
+ * Returns every counter with its current value.
+ */
+Datum
+compteurs(PG_FUNCTION_ARGS)
+{
+  FuncCallContext    *funcctx;
+  CompteurSauvegarde *liste;
+
+  if (SRF_IS_FIRSTCALL())
+  {
+    MemoryContext oldcontext;
+    TupleDesc     tupdesc;
+    int           nombre = 0;
+
+    if (etat == NULL)
+      ereport(ERROR,
+              (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+               errmsg("monextension doit être chargée via shared_preload_libraries")));
+
+    /* create a function context for cross-call persistence */
+    funcctx = SRF_FIRSTCALL_INIT();
+
+    /* switch to memory context appropriate for multiple function calls */
+    oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+    /* construct tuple descriptor */
+    if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+      ereport(ERROR,
+          (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+           errmsg("function returning record called in context that cannot accept type record")));
+    funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+    /* copy the counters, the lock is not kept between calls */
+    liste = palloc(compteurs_max * sizeof(CompteurSauvegarde));
+
+    LWLockAcquire(etat->lock, LW_SHARED);
+    for (int i = 0; i < compteurs_max; i++)
+    {
+      if (!entetes[i].utilise)
+        continue;
+
+      strlcpy(liste[nombre].nom, entetes[i].nom, NAMEDATALEN);
+      liste[nombre].valeur = pg_atomic_read_u64(&valeurs[i].valeur);
+      nombre++;
+    }
+    LWLockRelease(etat->lock);
+
+    funcctx->max_calls = nombre;
+    funcctx->user_fctx = liste;
+
+    /* switch back to old memory context */
+    MemoryContextSwitchTo(oldcontext);
+  }
+
+  /* stuff done on every call of the function */
+  funcctx = SRF_PERCALL_SETUP();
+  liste = funcctx->user_fctx;
+
+  /* do while there are more left to send */
+  if (funcctx->call_cntr < funcctx->max_calls)
+  {
+    Datum     values[2];
+    bool      nulls[2] = {false, false};
+    HeapTuple tuple;
+
+    /* column 1 is counter name */
+    values[0] = CStringGetTextDatum(liste[funcctx->call_cntr].nom);
+
+    /* column 2 is counter value */
+    values[1] = Int64GetDatum((int64) liste[funcctx->call_cntr].valeur);
+
+    /* build tuple */
+    tuple = heap_form_tuple(funcctx->tuple_desc, values, nulls);
+
+    /* return tuple */
+    SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+  }
+
+  /* all done */
+  SRF_RETURN_DONE(funcctx);
+}
@@ -0,0 +1,11 @@
+/*
+ * compteurs.h
+ *
+ * Compteurs nommés en mémoire partagée.
+ */
+#ifndef COMPTEURS_H
+#define COMPTEURS_H
+
+extern void compteurs_init(void);
+
+#endif							/* COMPTEURS_H */
@@ -0,0 +1,74 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+-- La version numeric garde sa signature : l'opérateur // existant et les
+-- requêtes qui l'utilisent continuent de fonctionner, seule l'implémentation
+-- change. Les versions entières renvoient aussi un numeric : les appels sur
+-- des entiers, qui passaient par la version numeric, gardent leur résultat
+-- (10 // 4 vaut 2.5, pas 2).
+--
+-- Les versions entières sont LEAKPROOF : la division par zéro donne NULL et
+-- le quotient numeric ne peut pas dépasser, aucune erreur ne dépend donc des
+-- valeurs reçues. Les versions float4 et float8 ne le sont pas : comme
+-- l'opérateur /, elles lèvent une erreur de dépassement qui en dépend. La
+-- version numeric non plus, la division numeric pouvant dépasser l'échelle
+-- maximale du type.
+CREATE OR REPLACE FUNCTION division_sans_erreur(numeric, numeric)
+RETURNS numeric
+AS '$libdir/monextension', 'division_sans_erreur_numeric'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION division_sans_erreur(int2, int2)
+RETURNS numeric
+AS '$libdir/monextension', 'division_sans_erreur_int2'
+LANGUAGE C
+IMMUTABLE STRICT LEAKPROOF PARALLEL SAFE;
+
+CREATE FUNCTION division_sans_erreur(int4, int4)
+RETURNS numeric
+AS '$libdir/monextension', 'division_sans_erreur_int4'
+LANGUAGE C
+IMMUTABLE STRICT LEAKPROOF PARALLEL SAFE;
+
+CREATE FUNCTION division_sans_erreur(int8, int8)
+RETURNS numeric
+AS '$libdir/monextension', 'division_sans_erreur_int8'
+LANGUAGE C
+IMMUTABLE STRICT LEAKPROOF PARALLEL SAFE;
+
+CREATE FUNCTION division_sans_erreur(float4, float4)
+RETURNS float4
+AS '$libdir/monextension', 'division_sans_erreur_float4'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION division_sans_erreur(float8, float8)
+RETURNS float8
+AS '$libdir/monextension', 'division_sans_erreur_float8'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=int2,
+   RIGHTARG=int2);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=int4,
+   RIGHTARG=int4);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=int8,
+   RIGHTARG=int8);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=float4,
+   RIGHTARG=float4);
+
+CREATE OPERATOR //
+  (FUNCTION=division_sans_erreur,
+   LEFTARG=float8,
+   RIGHTARG=float8);
@@ -0,0 +1,14 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+CREATE FUNCTION incremente_support(internal)
+RETURNS internal
+AS '$libdir/monextension', 'incremente_support'
+LANGUAGE C
+STRICT;
+
+-- incremente() ne dépend que de son argument. Elle n'est pas LEAKPROOF car
+-- elle lève une erreur pour PG_INT32_MAX.
+ALTER FUNCTION incremente(int)
+  IMMUTABLE
+  PARALLEL SAFE
+  SUPPORT incremente_support;
@@ -0,0 +1,48 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+-- Compteurs en mémoire partagée : monextension doit être dans
+-- shared_preload_libraries. Ils sont communs à toute l'instance et ne sont
+-- pas transactionnels.
+
+CREATE FUNCTION compteur_cree(nom text, valeur bigint DEFAULT 0)
+RETURNS void
+AS '$libdir/monextension', 'compteur_cree'
+LANGUAGE C
+STRICT;
+
+-- compteur_suivant() modifie l'état partagé, et un worker parallèle
+-- abandonnerait en sortant le bloc qu'il a réservé : elle ne s'exécute que
+-- dans le processus principal.
+CREATE FUNCTION compteur_suivant(nom text)
+RETURNS bigint
+AS '$libdir/monextension', 'compteur_suivant'
+LANGUAGE C
+STRICT PARALLEL RESTRICTED;
+
+CREATE FUNCTION compteur_valeur(nom text)
+RETURNS bigint
+AS '$libdir/monextension', 'compteur_valeur'
+LANGUAGE C
+STRICT PARALLEL SAFE;
+
+CREATE FUNCTION compteur_positionne(nom text, valeur bigint)
+RETURNS void
+AS '$libdir/monextension', 'compteur_positionne'
+LANGUAGE C
+STRICT;
+
+CREATE FUNCTION compteur_supprime(nom text)
+RETURNS void
+AS '$libdir/monextension', 'compteur_supprime'
+LANGUAGE C
+STRICT;
+
+CREATE FUNCTION compteurs(OUT nom text, OUT valeur bigint)
+RETURNS SETOF record
+AS '$libdir/monextension', 'compteurs'
+LANGUAGE C;
+
+-- les compteurs sont partagés par toutes les bases
+REVOKE EXECUTE ON FUNCTION compteur_cree(text, bigint) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION compteur_positionne(text, bigint) FROM PUBLIC;
+REVOKE EXECUTE ON FUNCTION compteur_supprime(text) FROM PUBLIC;
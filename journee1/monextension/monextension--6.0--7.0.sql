@@ -0,0 +1,204 @@
+\echo Ne pas exécuter ce script, mais passer par CREATE EXTENSION
+
+-- safe_ratio_sum(num, den) vaut sum(num) // sum(den) et safe_avg_ratio(num, den)
+-- vaut avg(num // den), avec les mêmes types de résultat. Les fonctions de
+-- combinaison (et de sérialisation pour l'état interne) permettent
+-- l'agrégation parallèle et partitionnée.
+
+-- int4 : état int8[] pour la somme, comme sum(int4). Les ratios entiers sont
+-- des numeric : la moyenne utilise l'état interne, comme avg(numeric).
+
+CREATE FUNCTION safe_ratio_sum_int4_accum(int8[], int4, int4)
+RETURNS int8[]
+AS '$libdir/monextension', 'safe_ratio_sum_int4_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_sum_int4_final(int8[])
+RETURNS numeric
+AS '$libdir/monextension', 'safe_ratio_sum_int4_final'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_int8_combine(int8[], int8[])
+RETURNS int8[]
+AS '$libdir/monextension', 'safe_ratio_int8_combine'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE AGGREGATE safe_ratio_sum(int4, int4) (
+  SFUNC = safe_ratio_sum_int4_accum,
+  STYPE = int8[],
+  FINALFUNC = safe_ratio_sum_int4_final,
+  COMBINEFUNC = safe_ratio_int8_combine,
+  INITCOND = '{0,0,0,0}',
+  PARALLEL = SAFE
+);
+
+-- float8 : état float8[], comme sum(float8) et avg(float8)
+
+CREATE FUNCTION safe_ratio_sum_float8_accum(float8[], float8, float8)
+RETURNS float8[]
+AS '$libdir/monextension', 'safe_ratio_sum_float8_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_sum_float8_final(float8[])
+RETURNS float8
+AS '$libdir/monextension', 'safe_ratio_sum_float8_final'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION safe_avg_ratio_float8_accum(float8[], float8, float8)
+RETURNS float8[]
+AS '$libdir/monextension', 'safe_avg_ratio_float8_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_avg_ratio_float8_final(float8[])
+RETURNS float8
+AS '$libdir/monextension', 'safe_avg_ratio_float8_final'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_float8_combine(float8[], float8[])
+RETURNS float8[]
+AS '$libdir/monextension', 'safe_ratio_float8_combine'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE AGGREGATE safe_ratio_sum(float8, float8) (
+  SFUNC = safe_ratio_sum_float8_accum,
+  STYPE = float8[],
+  FINALFUNC = safe_ratio_sum_float8_final,
+  COMBINEFUNC = safe_ratio_float8_combine,
+  INITCOND = '{0,0,0,0}',
+  PARALLEL = SAFE
+);
+
+CREATE AGGREGATE safe_avg_ratio(float8, float8) (
+  SFUNC = safe_avg_ratio_float8_accum,
+  STYPE = float8[],
+  FINALFUNC = safe_avg_ratio_float8_final,
+  COMBINEFUNC = safe_ratio_float8_combine,
+  INITCOND = '{0,0}',
+  PARALLEL = SAFE
+);
+
+-- int8 et numeric, et moyenne des int4 : état interne, comme sum(int8) et
+-- sum(numeric)
+
+CREATE FUNCTION safe_avg_ratio_int4_accum(internal, int4, int4)
+RETURNS internal
+AS '$libdir/monextension', 'safe_avg_ratio_int4_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_sum_int8_accum(internal, int8, int8)
+RETURNS internal
+AS '$libdir/monextension', 'safe_ratio_sum_int8_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_avg_ratio_int8_accum(internal, int8, int8)
+RETURNS internal
+AS '$libdir/monextension', 'safe_avg_ratio_int8_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_sum_numeric_accum(internal, numeric, numeric)
+RETURNS internal
+AS '$libdir/monextension', 'safe_ratio_sum_numeric_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_avg_ratio_numeric_accum(internal, numeric, numeric)
+RETURNS internal
+AS '$libdir/monextension', 'safe_avg_ratio_numeric_accum'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_sum_numeric_final(internal)
+RETURNS numeric
+AS '$libdir/monextension', 'safe_ratio_sum_numeric_final'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_avg_ratio_numeric_final(internal)
+RETURNS numeric
+AS '$libdir/monextension', 'safe_avg_ratio_numeric_final'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_numeric_combine(internal, internal)
+RETURNS internal
+AS '$libdir/monextension', 'safe_ratio_numeric_combine'
+LANGUAGE C
+IMMUTABLE PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_numeric_serialize(internal)
+RETURNS bytea
+AS '$libdir/monextension', 'safe_ratio_numeric_serialize'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE FUNCTION safe_ratio_numeric_deserialize(bytea, internal)
+RETURNS internal
+AS '$libdir/monextension', 'safe_ratio_numeric_deserialize'
+LANGUAGE C
+IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE AGGREGATE safe_avg_ratio(int4, int4) (
+  SFUNC = safe_avg_ratio_int4_accum,
+  STYPE = internal,
+  SSPACE = 128,
+  FINALFUNC = safe_avg_ratio_numeric_final,
+  COMBINEFUNC = safe_ratio_numeric_combine,
+  SERIALFUNC = safe_ratio_numeric_serialize,
+  DESERIALFUNC = safe_ratio_numeric_deserialize,
+  PARALLEL = SAFE
+);
+
+CREATE AGGREGATE safe_ratio_sum(int8, int8) (
+  SFUNC = safe_ratio_sum_int8_accum,
+  STYPE = internal,
+  SSPACE = 128,
+  FINALFUNC = safe_ratio_sum_numeric_final,
+  COMBINEFUNC = safe_ratio_numeric_combine,
+  SERIALFUNC = safe_ratio_numeric_serialize,
+  DESERIALFUNC = safe_ratio_numeric_deserialize,
+  PARALLEL = SAFE
+);
+
+CREATE AGGREGATE safe_avg_ratio(int8, int8) (
+  SFUNC = safe_avg_ratio_int8_accum,
+  STYPE = internal,
+  SSPACE = 128,
+  FINALFUNC = safe_avg_ratio_numeric_final,
+  COMBINEFUNC = safe_ratio_numeric_combine,
+  SERIALFUNC = safe_ratio_numeric_serialize,
+  DESERIALFUNC = safe_ratio_numeric_deserialize,
+  PARALLEL = SAFE
+);
+
+CREATE AGGREGATE safe_ratio_sum(numeric, numeric) (
+  SFUNC = safe_ratio_sum_numeric_accum,
+  STYPE = internal,
+  SSPACE = 128,
+  FINALFUNC = safe_ratio_sum_numeric_final,
+  COMBINEFUNC = safe_ratio_numeric_combine,
+  SERIALFUNC = safe_ratio_numeric_serialize,
+  DESERIALFUNC = safe_ratio_numeric_deserialize,
+  PARALLEL = SAFE
+);
+
+CREATE AGGREGATE safe_avg_ratio(numeric, numeric) (
+  SFUNC = safe_avg_ratio_numeric_accum,
+  STYPE = internal,
+  SSPACE = 128,
+  FINALFUNC = safe_avg_ratio_numeric_final,
+  COMBINEFUNC = safe_ratio_numeric_combine,
+  SERIALFUNC = safe_ratio_numeric_serialize,
+  DESERIALFUNC = safe_ratio_numeric_deserialize,
+  PARALLEL = SAFE
+);
@@ -1,9 +1,37 @@
 #include "postgres.h"
 #include "fmgr.h"
 
+#include "access/stratnum.h"
+#include "catalog/pg_opfamily.h"
+#include "catalog/pg_type.h"
+#include "nodes/makefuncs.h"
+#include "nodes/nodeFuncs.h"
+#include "nodes/supportnodes.h"
+#include "optimizer/optimizer.h"
+#include "optimizer/planner.h"
+#include "utils/fmgrprotos.h"
+#include "utils/lsyscache.h"
+
+#include "compteurs.h"
+#include "monextension.h"
+
 PG_MODULE_MAGIC;
 
+static planner_hook_type prev_planner_hook = NULL;
+
+static PlannedStmt *incremente_planner(Query *parse, const char *query_string,
+                                       int cursorOptions,
+                                       ParamListInfo boundParams);
+static Node *incremente_mutator(Node *node, void *context);
+
 PG_FUNCTION_INFO_V1(incremente);
+PG_FUNCTION_INFO_V1(incremente_support);
+PG_FUNCTION_INFO_V1(division_sans_erreur_int2);
+PG_FUNCTION_INFO_V1(division_sans_erreur_int4);
+PG_FUNCTION_INFO_V1(division_sans_erreur_int8);
+PG_FUNCTION_INFO_V1(division_sans_erreur_float4);
+PG_FUNCTION_INFO_V1(division_sans_erreur_float8);
+PG_FUNCTION_INFO_V1(division_sans_erreur_numeric);
 
 Datum
 incremente(PG_FUNCTION_ARGS)
@@ -22,3 +50,337 @@ incremente(PG_FUNCTION_ARGS)
 
   PG_RETURN_INT32(valeur + 1);
 }
+
+void
+_PG_init(void)
+{
+  prev_planner_hook = planner_hook;
+  planner_hook = incremente_planner;
+
+  compteurs_init();
+}
+
+/*
+ * Fonction support de incremente().
+ *
+ * Le planificateur ne consulte que la fonction support de l'opérateur (int4eq,
+ * int4lt...) pour construire une condition d'index, jamais celle de ses
+ * arguments. La réécriture de "incremente(x) op c" en "x op c-1" est donc
+ * faite dans incremente_planner(), qui reconnaît incremente() grâce à cette
+ * fonction support. Ici, on ne fournit que le coût d'un appel.
+ */
+Datum
+incremente_support(PG_FUNCTION_ARGS)
+{
+  Node   *rawreq = (Node *) PG_GETARG_POINTER(0);
+  Node   *ret = NULL;
+
+  if (IsA(rawreq, SupportRequestCost))
+  {
+    SupportRequestCost *req = (SupportRequestCost *) rawreq;
+
+    /* une comparaison et une addition, soit le coût d'un opérateur */
+    req->startup = 0;
+    req->per_tuple = cpu_operator_cost;
+    ret = (Node *) req;
+  }
+
+  PG_RETURN_POINTER(ret);
+}
+
+/*
+ * Est-ce un appel à incremente(), autrement dit à une fonction dont la
+ * fonction support est incremente_support() ? incremente_null() n'a pas de
+ * fonction support et n'est donc jamais réécrite.
+ */
+static bool
+est_appel_incremente(Node *node)
+{
+  FuncExpr *fexpr;
+  Oid       support;
+  FmgrInfo  finfo;
+
+  if (!IsA(node, FuncExpr))
+    return false;
+
+  fexpr = (FuncExpr *) node;
+  if (fexpr->funcresulttype != INT4OID || list_length(fexpr->args) != 1)
+    return false;
+
+  support = get_func_support(fexpr->funcid);
+  if (!OidIsValid(support))
+    return false;
+
+  fmgr_info(support, &finfo);
+  return finfo.fn_addr == incremente_support;
+}
+
+/*
+ * Opérateur de comparaison entre deux int4 : =, <>, <, <=, > ou >=. Tous
+ * sont invariants par translation, ce qui permet de décaler la constante.
+ */
+static bool
+est_comparaison_int4(Oid opno)
+{
+  Oid       negateur;
+
+  if (get_op_opfamily_strategy(opno, INTEGER_BTREE_FAM_OID) != 0)
+    return true;
+
+  negateur = get_negator(opno);
+  return OidIsValid(negateur) &&
+    get_op_opfamily_strategy(negateur, INTEGER_BTREE_FAM_OID) == BTEqualStrategyNumber;
+}
+
+/*
+ * Réécrit "incremente(x) op c" en "x op c-1" (et "c op incremente(x)" en
+ * "c-1 op x"), ce qui permet d'utiliser un index et les statistiques de x.
+ * Renvoie NULL si la réécriture n'est pas possible.
+ *
+ * Si c vaut PG_INT32_MIN, c-1 n'existe pas : on ne touche à rien. La
+ * réécriture peut en revanche supprimer l'erreur de incremente(PG_INT32_MAX)
+ * pour les lignes où x vaut PG_INT32_MAX, jamais en ajouter une.
+ */
+static Node *
+reecrit_comparaison(OpExpr *opexpr)
+{
+  Node     *gauche;
+  Node     *droite;
+  FuncExpr *appel;
+  Const    *constante;
+  Const    *decalee;
+  OpExpr   *resultat;
+  int32     valeur;
+  bool      appel_a_gauche;
+
+  if (list_length(opexpr->args) != 2)
+    return NULL;
+
+  gauche = linitial(opexpr->args);
+  droite = lsecond(opexpr->args);
+
+  if (IsA(droite, Const) && est_appel_incremente(gauche))
+  {
+    appel = (FuncExpr *) gauche;
+    constante = (Const *) droite;
+    appel_a_gauche = true;
+  }
+  else if (IsA(gauche, Const) && est_appel_incremente(droite))
+  {
+    appel = (FuncExpr *) droite;
+    constante = (Const *) gauche;
+    appel_a_gauche = false;
+  }
+  else
+    return NULL;
+
+  if (constante->constisnull || constante->consttype != INT4OID)
+    return NULL;
+
+  if (!est_comparaison_int4(opexpr->opno))
+    return NULL;
+
+  valeur = DatumGetInt32(constante->constvalue);
+  if (valeur == PG_INT32_MIN)
+    return NULL;
+
+  decalee = makeConst(INT4OID, -1, InvalidOid, sizeof(int32),
+                      Int32GetDatum(valeur - 1), false, true);
+  decalee->location = constante->location;
+
+  resultat = (OpExpr *) copyObject(opexpr);
+  if (appel_a_gauche)
+    resultat->args = list_make2(linitial(appel->args), decalee);
+  else
+    resultat->args = list_make2(decalee, linitial(appel->args));
+
+  return (Node *) resultat;
+}
+
+static Node *
+incremente_mutator(Node *node, void *context)
+{
+  if (node == NULL)
+    return NULL;
+
+  if (IsA(node, Query))
+    return (Node *) query_tree_mutator((Query *) node, incremente_mutator,
+                                       context, 0);
+
+  if (IsA(node, OpExpr))
+  {
+    Node   *reecrit = reecrit_comparaison((OpExpr *) node);
+
+    if (reecrit)
+      node = reecrit;
+  }
+
+  return expression_tree_mutator(node, incremente_mutator, context);
+}
+
+/*
+ * Le hook n'est installé qu'au chargement de la bibliothèque. Pour qu'il
+ * s'applique dès la première requête d'une session, monextension doit être
+ * dans shared_preload_libraries ou session_preload_libraries.
+ */
+static PlannedStmt *
+incremente_planner(Query *parse, const char *query_string, int cursorOptions,
+                   ParamListInfo boundParams)
+{
+  parse = query_tree_mutator(parse, incremente_mutator, NULL,
+                             QTW_DONT_COPY_QUERY);
+
+  if (prev_planner_hook)
+    return prev_planner_hook(parse, query_string, cursorOptions, boundParams);
+
+  return standard_planner(parse, query_string, cursorOptions, boundParams);
+}
+
+/*
+ * Division sans erreur : voir monextension.h. Les fonctions sont STRICT, les
+ * arguments NULL ne sont donc jamais vus ici.
+ */
+Datum
+division_sans_erreur_int2(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  Numeric resultat;
+
+  resultat = division_sans_erreur_entiere_interne(PG_GETARG_INT16(0),
+                                                  PG_GETARG_INT16(1),
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+Datum
+division_sans_erreur_int4(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  Numeric resultat;
+
+  resultat = division_sans_erreur_entiere_interne(PG_GETARG_INT32(0),
+                                                  PG_GETARG_INT32(1),
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+Datum
+division_sans_erreur_int8(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  Numeric resultat;
+
+  resultat = division_sans_erreur_entiere_interne(PG_GETARG_INT64(0),
+                                                  PG_GETARG_INT64(1),
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+Datum
+division_sans_erreur_float4(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  float4  resultat;
+
+  resultat = division_sans_erreur_float4_interne(PG_GETARG_FLOAT4(0),
+                                                 PG_GETARG_FLOAT4(1),
+                                                 &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_FLOAT4(resultat);
+}
+
+Datum
+division_sans_erreur_float8(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  float8  resultat;
+
+  resultat = division_sans_erreur_float8_interne(PG_GETARG_FLOAT8(0),
+                                                 PG_GETARG_FLOAT8(1),
+                                                 &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_FLOAT8(resultat);
+}
+
+Datum
+division_sans_erreur_numeric(PG_FUNCTION_ARGS)
+{
+  bool    est_null;
+  Numeric resultat;
+
+  resultat = division_sans_erreur_numeric_interne(PG_GETARG_NUMERIC(0),
+                                                  PG_GETARG_NUMERIC(1),
+                                                  &est_null);
+  if (est_null)
+    PG_RETURN_NULL();
+
+  PG_RETURN_NUMERIC(resultat);
+}
+
+/*
+ * Pour les entiers, le résultat est numeric, comme avec la version numeric
+ * qu'utilisaient ces appels avant l'arrivée des versions par type : 10 // 4
+ * vaut 2.5 et non 2. Le test à zéro se fait sur l'entier, avant toute
+ * conversion, et la division ne peut plus dépasser.
+ */
+Numeric
+division_sans_erreur_entiere_interne(int64 dividende, int64 diviseur,
+                                     bool *est_null)
+{
+  *est_null = (diviseur == 0);
+  if (*est_null)
+    return NULL;
+
+  return numeric_div_opt_error(int64_to_numeric(dividende),
+                               int64_to_numeric(diviseur), NULL);
+}
+
+/*
+ * Pour le type numeric, on tente directement la division : le test à zéro
+ * n'est fait que lorsque la division échoue ou renvoie NaN, ce qui évite une
+ * comparaison supplémentaire pour chaque ligne.
+ */
+Numeric
+division_sans_erreur_numeric_interne(Numeric dividende, Numeric diviseur,
+                                     bool *est_null)
+{
+  Numeric resultat;
+  bool    erreur = false;
+
+  *est_null = false;
+
+  resultat = numeric_div_opt_error(dividende, diviseur, &erreur);
+
+  if (erreur || numeric_is_nan(resultat))
+  {
+    /* l'ancienne version SQL renvoyait NULL dès que $2 = 0, même pour NaN */
+    if (DatumGetBool(DirectFunctionCall2(numeric_eq,
+                                         NumericGetDatum(diviseur),
+                                         NumericGetDatum(int64_to_numeric(0)))))
+    {
+      *est_null = true;
+      return NULL;
+    }
+
+    /* seul le dépassement de capacité reste possible */
+    if (erreur)
+      ereport(ERROR,
+              (errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+               errmsg("value overflows numeric format")));
+  }
+
+  return resultat;
+}
@@ -0,0 +1,45 @@
+/*
+ * monextension.h
+ *
+ * Division sans erreur, partagée entre l'opérateur // et les agrégats.
+ *
+ * Chaque fonction renvoie le même résultat que l'opérateur / du type (celui
+ * de numeric pour les entiers), sauf quand le diviseur vaut zéro : *est_null
+ * passe alors à true. Les autres erreurs (dépassement de capacité) sont
+ * conservées.
+ */
+#ifndef MONEXTENSION_H
+#define MONEXTENSION_H
+
+#include "utils/float.h"
+#include "utils/numeric.h"
+
+/* float4_div et float8_div vérifient les dépassements comme l'opérateur / */
+static inline float4
+division_sans_erreur_float4_interne(float4 dividende, float4 diviseur, bool *est_null)
+{
+  *est_null = (diviseur == 0.0);
+  if (*est_null)
+    return 0.0;
+
+  return float4_div(dividende, diviseur);
+}
+
+static inline float8
+division_sans_erreur_float8_interne(float8 dividende, float8 diviseur, bool *est_null)
+{
+  *est_null = (diviseur == 0.0);
+  if (*est_null)
+    return 0.0;
+
+  return float8_div(dividende, diviseur);
+}
+
+extern Numeric division_sans_erreur_entiere_interne(int64 dividende,
+                                                    int64 diviseur,
+                                                    bool *est_null);
+extern Numeric division_sans_erreur_numeric_interne(Numeric dividende,
+                                                    Numeric diviseur,
+                                                    bool *est_null);
+
+#endif							/* MONEXTENSION_H */
@@ -0,0 +1,37 @@
+-- safe_ratio_sum(num, den) = sum(num) // sum(den)
+-- safe_avg_ratio(num, den) = avg(num // den)
+SELECT safe_ratio_sum(x, y), safe_avg_ratio(x, y)
+  FROM (VALUES (10, 2), (5, 3), (1, 0), (NULL, 4)) v(x, y);
+CREATE TABLE t_ratios (groupe int, a int4, b int4, c int8, d int8,
+                       e numeric, f numeric, x float8, y float8);
+INSERT INTO t_ratios
+  SELECT i % 4, i, i % 5, i, i % 5, i, i % 5, i, i % 5
+  FROM generate_series(1, 10000) i;
+INSERT INTO t_ratios VALUES
+  (0, NULL, 3, NULL, 3, NULL, 3, NULL, 3),
+  (1, 7, NULL, 7, NULL, 7, NULL, 7, NULL),
+  (4, 1, 0, 1, 0, 1, 0, 1, 0);
+ANALYZE t_ratios;
+-- agrégation parallèle si possible
+SET parallel_setup_cost TO 0;
+SET parallel_tuple_cost TO 0;
+SET min_parallel_table_scan_size TO 0;
+SET max_parallel_workers_per_gather TO 2;
+SELECT groupe,
+       safe_ratio_sum(a, b) IS NOT DISTINCT FROM sum(a) // sum(b) AS int4_somme,
+       safe_avg_ratio(a, b) IS NOT DISTINCT FROM avg(a // b) AS int4_moyenne,
+       safe_ratio_sum(c, d) IS NOT DISTINCT FROM sum(c) // sum(d) AS int8_somme,
+       safe_avg_ratio(c, d) IS NOT DISTINCT FROM avg(c // d) AS int8_moyenne,
+       safe_ratio_sum(e, f) IS NOT DISTINCT FROM sum(e) // sum(f) AS numeric_somme,
+       safe_avg_ratio(e, f) IS NOT DISTINCT FROM avg(e // f) AS numeric_moyenne,
+       safe_ratio_sum(x, y) IS NOT DISTINCT FROM sum(x) // sum(y) AS float8_somme,
+       safe_avg_ratio(x, y) IS NOT DISTINCT FROM avg(x // y) AS float8_moyenne
+  FROM t_ratios
+  GROUP BY groupe
+  ORDER BY groupe;
+SELECT safe_ratio_sum(e, f), safe_avg_ratio(e, f) FROM t_ratios WHERE groupe = 4;
+RESET parallel_setup_cost;
+RESET parallel_tuple_cost;
+RESET min_parallel_table_scan_size;
+RESET max_parallel_workers_per_gather;
+DROP TABLE t_ratios;
@@ -0,0 +1,26 @@
+-- monextension.conf charge la bibliothèque avec monextension.compteurs_bloc = 1
+CREATE EXTENSION monextension;
+SELECT compteur_cree('c1');
+SELECT compteur_suivant('c1');
+SELECT compteur_suivant('c1');
+SELECT compteur_valeur('c1');
+SELECT compteur_cree('c1');
+SELECT compteur_cree('c2', -1);
+-- un bloc réservé est abandonné quand le compteur est repositionné
+SET monextension.compteurs_bloc TO 10;
+SELECT compteur_suivant('c1');
+SELECT compteur_valeur('c1');
+SELECT compteur_positionne('c1', 100);
+SELECT compteur_suivant('c1');
+-- ou quand il est supprimé, puis recréé à la même place
+SELECT compteur_supprime('c1');
+SELECT compteur_suivant('c1');
+SELECT compteur_cree('c1', 1000);
+SELECT compteur_suivant('c1');
+RESET monextension.compteurs_bloc;
+-- valeur maximale
+SELECT compteur_positionne('c1', 9223372036854775806);
+SELECT compteur_suivant('c1');
+SELECT compteur_suivant('c1');
+SELECT * FROM compteurs();
+SELECT compteur_supprime('c1');
@@ -0,0 +1,28 @@
+-- version SQL de l'opérateur //
+DROP EXTENSION monextension;
+CREATE EXTENSION monextension VERSION '2.0';
+CREATE VIEW v_division AS SELECT 10::numeric // 4::numeric AS resultat;
+SELECT * FROM v_division;
+-- passage aux fonctions C, la vue doit continuer de fonctionner
+ALTER EXTENSION monextension UPDATE;
+SELECT * FROM v_division;
+DROP VIEW v_division;
+-- une version par type
+SELECT pg_typeof(10 // 4);
+SELECT 10 // 4 AS resultat;
+SELECT 10 // 0 AS resultat;
+SELECT 10::int2 // 4::int2 AS resultat;
+SELECT 10::int8 // 0::int8 AS resultat;
+SELECT 10::float8 // 4 AS resultat;
+SELECT 10::float4 // 0::float4 AS resultat;
+SELECT 10::numeric // 0 AS resultat;
+SELECT 'NaN'::numeric // 0 AS resultat;
+-- les entiers donnent un numeric, sans dépassement possible
+SELECT (-2147483648)::int4 // -1 AS resultat;
+-- les dépassements des flottants restent des erreurs
+SELECT 1e308::float8 // 1e-308::float8 AS resultat;
+-- seules les versions entières sont LEAKPROOF
+SELECT p.oid::regprocedure::text AS fonction, p.proleakproof
+  FROM pg_proc p
+ WHERE p.proname = 'division_sans_erreur'
+ ORDER BY 1;
@@ -0,0 +1,17 @@
+-- le hook de réécriture n'est actif qu'une fois la bibliothèque chargée
+LOAD 'monextension';
+CREATE TABLE t_incremente (id int, libelle text);
+INSERT INTO t_incremente SELECT i, 'ligne ' || i FROM generate_series(1, 1000) i;
+CREATE INDEX ON t_incremente (id);
+ANALYZE t_incremente;
+SET enable_seqscan TO off;
+SET enable_bitmapscan TO off;
+-- incremente(x) op c devient x op c-1
+EXPLAIN (COSTS OFF) SELECT * FROM t_incremente WHERE incremente(id) = 42;
+EXPLAIN (COSTS OFF) SELECT * FROM t_incremente WHERE 3 > incremente(id);
+SELECT id FROM t_incremente WHERE incremente(id) <= 3 ORDER BY id;
+-- c-1 déborde : pas de réécriture
+SELECT count(*) FROM t_incremente WHERE incremente(id) > '-2147483648'::int4;
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+DROP TABLE t_incremente;
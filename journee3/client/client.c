@@ -9,13 +9,22 @@
 
 // #include
 #include "libpq-fe.h"
+#include <limits.h>
+#include <sys/select.h>
 #include "postgres_fe.h"
 #include "common/logging.h"
 #include "common/string.h"
+#include "fe_utils/option_utils.h"
+#include "getopt_long.h"
+
+#include "client.h"
+
+static void help(const char *progname);
 
 int
 main(int argc, char **argv)
 {
+  const char *progname;
   char     *conninfo;
   PGconn   *conn;
   char     *password = NULL;
@@ -23,23 +32,329 @@ main(int argc, char **argv)
   char     *query;
   PGresult *res;
   int       res_async;
+  static struct option long_options[] = {
+    {"file", required_argument, NULL, 'f'},
+    {"count", required_argument, NULL, 'n'},
+    {"pipeline", required_argument, NULL, 'P'},
+    {"sync-every", required_argument, NULL, 'S'},
+    {"prepared", no_argument, NULL, 'M'},
+    {"param-types", required_argument, NULL, 't'},
+    {"param", required_argument, NULL, 'a'},
+    {"params-file", required_argument, NULL, 1},
+    {"binary", no_argument, NULL, 'b'},
+    {"clients", required_argument, NULL, 'c'},
+    {"rate", required_argument, NULL, 'R'},
+    {"time", required_argument, NULL, 'T'},
+    {"progress", required_argument, NULL, 2},
+    {"single-row", no_argument, NULL, 3},
+    {"output", required_argument, NULL, 'o'},
+    {"output-format", required_argument, NULL, 4},
+    {"export", required_argument, NULL, 'e'},
+    {"compress", required_argument, NULL, 'Z'},
+    {"chunk-rows", required_argument, NULL, 5},
+    {"row-report", no_argument, NULL, 6},
+    {"load", required_argument, NULL, 'L'},
+    {"table", required_argument, NULL, 7},
+    {"load-format", required_argument, NULL, 8},
+    {"header", no_argument, NULL, 9},
+    {"transaction", no_argument, NULL, 10},
+    {"check", no_argument, NULL, 11},
+    {"race", no_argument, NULL, 12},
+    {"profile", required_argument, NULL, 13},
+    {NULL, 0, NULL, 0}
+  };
+  int       optindex;
+  int       c;
+  char     *filename = NULL;
+  int       count = 1000;
+  int       pipeline_depth = 0;
+  int       sync_every = 0;
+  bool      prepared = false;
+  bool      binary = false;
+  char     *param_types = NULL;
+  char     *params_filename = NULL;
+  char    **params = NULL;
+  int       nparams = 0;
+  char    **type_names = NULL;
+  int       ntypes = 0;
+  int64     n = 0;
+  QueryList list;
+  LoadOptions load = {0};
+  ExportOptions export = {0};
+  int       default_chunk = 1;
+  int      *chunks = &default_chunk;
+  int       nchunks = 1;
+  bool      row_report = false;
+  LoaderOptions loader = {0};
+  bool      loader_format = false;
+  bool      race = false;
+  int       profile_runs = 0;
 
   pg_logging_init(argv[0]);
   pg_logging_set_level(PG_LOG_DEBUG);
+  progname = get_progname(argv[0]);
+
+  handle_help_version_opts(argc, argv, "client", help);
+
+  while ((c = getopt_long(argc, argv, "f:n:P:S:Mt:a:bc:R:T:o:e:Z:L:", long_options, &optindex)) != -1)
+  {
+    switch (c)
+    {
+      case 'f':
+        filename = pg_strdup(optarg);
+        break;
+      case 'n':
+        if (!option_parse_int(optarg, "-n/--count", 1, INT_MAX, &count))
+          exit(1);
+        break;
+      case 'P':
+        if (!option_parse_int(optarg, "-P/--pipeline", 1, INT_MAX, &pipeline_depth))
+          exit(1);
+        break;
+      case 'S':
+        if (!option_parse_int(optarg, "-S/--sync-every", 1, INT_MAX, &sync_every))
+          exit(1);
+        break;
+      case 'M':
+        prepared = true;
+        break;
+      case 't':
+        param_types = pg_strdup(optarg);
+        break;
+      case 'a':
+        params = pg_realloc(params, (nparams + 1) * sizeof(char *));
+        params[nparams++] = pg_strdup(optarg);
+        break;
+      case 1:
+        params_filename = pg_strdup(optarg);
+        break;
+      case 'b':
+        binary = true;
+        break;
+      case 'c':
+        if (!option_parse_int(optarg, "-c/--clients", 1, INT_MAX, &load.clients))
+          exit(1);
+        break;
+      case 'R':
+        if (!option_parse_int(optarg, "-R/--rate", 1, INT_MAX, &load.rate))
+          exit(1);
+        break;
+      case 'T':
+        if (!option_parse_int(optarg, "-T/--time", 1, INT_MAX / 1000, &load.duration))
+          exit(1);
+        break;
+      case 2:
+        if (!option_parse_int(optarg, "--progress", 1, INT_MAX / 1000, &load.progress))
+          exit(1);
+        break;
+      case 3:
+        load.single_row = true;
+        break;
+      case 'o':
+        load.output = pg_strdup(optarg);
+        break;
+      case 4:
+        if (strcmp(optarg, "json") == 0)
+          load.json = true;
+        else if (strcmp(optarg, "csv") != 0)
+          pg_fatal("invalid output format \"%s\", must be \"csv\" or \"json\"", optarg);
+        break;
+      case 'e':
+        if (strcmp(optarg, "text") != 0 && strcmp(optarg, "csv") != 0 &&
+            strcmp(optarg, "binary") != 0)
+          pg_fatal("invalid export format \"%s\", must be \"text\", \"csv\" or \"binary\"", optarg);
+        export.format = pg_strdup(optarg);
+        break;
+      case 'Z':
+#ifdef USE_ZSTD
+        if (!option_parse_int(optarg, "-Z/--compress", 1, 22, &export.compress))
+          exit(1);
+#else
+        pg_fatal("this build does not support zstd compression");
+#endif
+        break;
+      case 5:
+      {
+        char   *chunk;
+
+        // Comma-separated list of chunk sizes
+        chunks = NULL;
+        nchunks = 0;
+        for (chunk = strtok(optarg, ","); chunk; chunk = strtok(NULL, ","))
+        {
+          chunks = pg_realloc(chunks, (nchunks + 1) * sizeof(int));
+          if (!option_parse_int(chunk, "--chunk-rows", 0, INT_MAX, &chunks[nchunks]))
+            exit(1);
+          nchunks++;
+        }
+        if (nchunks == 0)
+          pg_fatal("--chunk-rows needs at least one chunk size");
+        break;
+      }
+      case 6:
+        row_report = true;
+        break;
+      case 'L':
+        loader.file = pg_strdup(optarg);
+        break;
+      case 7:
+        loader.table = pg_strdup(optarg);
+        break;
+      case 8:
+        if (strcmp(optarg, "csv") == 0)
+          loader.csv = true;
+        else if (strcmp(optarg, "text") != 0)
+          pg_fatal("invalid load format \"%s\", must be \"csv\" or \"text\"", optarg);
+        loader_format = true;
+        break;
+      case 9:
+        loader.header = true;
+        break;
+      case 10:
+        loader.transaction = true;
+        break;
+      case 11:
+        loader.check = true;
+        break;
+      case 12:
+        race = true;
+        break;
+      case 13:
+        if (!option_parse_int(optarg, "--profile", 1, INT_MAX, &profile_runs))
+          exit(1);
+        break;
+      default:
+        /* getopt_long already emitted a complaint */
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+    }
+  }
+
+  if (argc - optind > 2)
+  {
+    pg_log_error("too many command-line arguments (first is \"%s\")",
+           argv[optind + 2]);
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (params && params_filename)
+  {
+    pg_log_error("options -a/--param and --params-file cannot be used together");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (load.clients > 0 && pipeline_depth > 0)
+  {
+    pg_log_error("options -c/--clients and -P/--pipeline cannot be used together");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (export.format && (load.clients > 0 || pipeline_depth > 0 ||
+                        nparams > 0 || params_filename || prepared))
+  {
+    pg_log_error("option -e/--export cannot be used with load, pipeline, parameters or prepared statements");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (loader.file)
+  {
+    if (!loader.table)
+      pg_fatal("option -L/--load needs --table");
+    if (export.format || pipeline_depth > 0 || row_report ||
+        load.rate > 0 || load.duration > 0 || load.progress > 0 || load.output)
+    {
+      pg_log_error("option -L/--load cannot be used with other modes");
+      pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+      exit(1);
+    }
+
+    // -c gives the number of connections, the extension the format
+    loader.connections = load.clients > 0 ? load.clients : 4;
+    load.clients = 0;
+    if (!loader_format)
+    {
+      const char *ext = strrchr(loader.file, '.');
+
+      loader.csv = ext && pg_strcasecmp(ext, ".csv") == 0;
+    }
+  }
+  else if (loader.table || loader_format || loader.header ||
+           loader.transaction || loader.check)
+  {
+    pg_log_error("options --table, --load-format, --header, --transaction and --check need -L/--load");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (row_report && (export.format || load.clients > 0 || pipeline_depth > 0))
+  {
+    pg_log_error("option --row-report cannot be used with export, load or pipeline modes");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (profile_runs > 0 && (export.format || load.clients > 0 ||
+                           pipeline_depth > 0 || row_report || loader.file))
+  {
+    pg_log_error("option --profile cannot be used with other modes");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (export.compress > 0 && !export.format)
+  {
+    pg_log_error("option -Z/--compress needs -e/--export");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (load.clients == 0 && (load.rate > 0 || load.duration > 0 ||
+                            load.progress > 0 ||
+                            (load.output && !export.format && !profile_runs)))
+  {
+    pg_log_error("options -R, -T, --progress and -o need -c/--clients, -e/--export or --profile");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (load.duration == 0)
+    load.duration = 10;
+
+  // Parameter types, separated by commas
+  if (param_types)
+  {
+    char   *type;
+
+    for (type = strtok(param_types, ","); type; type = strtok(NULL, ","))
+    {
+      type_names = pg_realloc(type_names, (ntypes + 1) * sizeof(char *));
+      type_names[ntypes++] = type;
+    }
+  }
+
+  if (ntypes > 0 && params && ntypes != nparams)
+    pg_fatal("%d parameter types given for %d parameters", ntypes, nparams);
 
   // Trying to connect
   do
   {
-    if (argc > 1)
-      conninfo = argv[1];
+    if (argc > optind)
+      conninfo = argv[optind];
     else
       conninfo = "";
 
     if (password)
-      sprintf(conninfo, "%s password=%s", conninfo, password);
+      conninfo = psprintf("%s password=%s", conninfo, password);
 
     new_password = false;
-    conn = PQconnectdb(conninfo);
+    if (race)
+      conn = race_connect(conninfo);
+    else
+      conn = PQconnectdb(conninfo);
 
     if (!conn)
     {
@@ -64,35 +379,134 @@ main(int argc, char **argv)
 
   pg_log_debug("Connection successfull! (backend PID is %d)", PQbackendPID(conn));
 
-  if (argc > 2)
-    query = argv[2];
+  // Other connections go to the host that won the race
+  if (race)
+    conninfo = winner_conninfo(conninfo, conn);
+
+  if (argc > optind + 1)
+    query = argv[optind + 1];
   else
     query = "SELECT version()";
 
+  if (filename)
+    read_queries(filename, &list);
+  else
+  {
+    list.queries = &query;
+    list.count = 1;
+  }
+
+  // Parameters, prepared statements and result format
+  list.nparams = ntypes > 0 ? ntypes : nparams;
+  list.param_sets = NULL;
+  list.nsets = 0;
+  list.prepared = false;
+  list.result_format = binary ? 1 : 0;
+
+  if (params_filename)
+    read_params(params_filename, &list);
+  else if (params)
+  {
+    list.param_sets = &params;
+    list.nsets = 1;
+  }
+
+  list.param_types = pg_malloc0((list.nparams + 1) * sizeof(Oid));
+  if (ntypes > 0 && !resolve_param_types(conn, &list, type_names))
+  {
+    PQfinish(conn);
+    return 1;
+  }
+
+  if (prepared && !prepare_queries(conn, &list))
+  {
+    PQfinish(conn);
+    return 1;
+  }
+
+  // Loader mode: one file loaded on many connections
+  if (loader.file)
+  {
+    int   result;
+
+    result = run_loader(conninfo, &loader);
+    PQfinish(conn);
+    return result;
+  }
+
+  // Export mode: COPY data straight to a file
+  if (export.format)
+  {
+    int   result;
+
+    export.output = load.output;
+    result = run_export(conn, &list, &export);
+    PQfinish(conn);
+    return result;
+  }
+
+  // Row report: one run per chunk size, then a report
+  if (row_report)
+  {
+    int   failed;
+
+    failed = run_row_report(conninfo, &list, chunks, nchunks);
+    PQfinish(conn);
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Profile mode: traced runs, then where the time went
+  if (profile_runs > 0)
+  {
+    int   failed;
+
+    failed = run_profile(conn, &list, profile_runs, chunks[0], load.output);
+    PQfinish(conn);
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Load mode: many connections, then a report
+  if (load.clients > 0)
+  {
+    int   failed;
+
+    failed = run_load(conninfo, &list, &load);
+    PQfinish(conn);
+    return failed == 0 ? 0 : 1;
+  }
+
+  // Pipeline mode: many queries in flight, then a report
+  if (pipeline_depth > 0)
+  {
+    int   failed;
+
+    failed = run_pipeline(conn, &list, pipeline_depth,
+                          sync_every > 0 ? sync_every : pipeline_depth,
+                          count);
+    PQfinish(conn);
+    return failed == 0 ? 0 : 1;
+  }
+
   // Trying to execute query
   while (true)
   {
-    res_async = PQsendQuery(conn, query);
+    res_async = send_query(conn, &list, n++);
 
     if (!res_async)
     {
       pg_log_error("query failed: %s", PQerrorMessage(conn));
     }
 
-    res_async = PQsetSingleRowMode(conn);
-    pg_log_debug("single mode %sactivated", res_async ? "" : "not ");
+    res_async = set_row_mode(conn, chunks[0]);
+    if (row_mode_chunk(chunks[0]) > 1)
+      pg_log_debug("chunked rows mode (%d rows) %sactivated", chunks[0],
+                   res_async ? "" : "not ");
+    else if (chunks[0] > 0)
+      pg_log_debug("single mode %sactivated", res_async ? "" : "not ");
 
     while ((res = PQgetResult(conn)))
     {
-      for (int ligne = 0 ; ligne < PQntuples(res) ; ligne++)
-      {
-        for (int colonne = 0 ; colonne < PQnfields(res) ; colonne++)
-        {
-          printf("%s - ", PQgetvalue(res, ligne, colonne));
-        }
-        printf("\n");
-      }
-
+      print_result(res);
       PQclear(res);
     }
 
@@ -105,3 +519,136 @@ main(int argc, char **argv)
 
   return 0;
 }
+
+/*
+ * Reads queries from a file, one per line. Empty lines and lines starting
+ * with "--" are ignored.
+ */
+void
+read_queries(const char *filename, QueryList *list)
+{
+  FILE     *file;
+  char      line[8192];
+  int       allocated = 16;
+
+  file = fopen(filename, "r");
+  if (!file)
+    pg_fatal("could not open file \"%s\": %m", filename);
+
+  list->queries = pg_malloc(allocated * sizeof(char *));
+  list->count = 0;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    (void) pg_strip_crlf(line);
+
+    if (line[0] == '\0' || strncmp(line, "--", 2) == 0)
+      continue;
+
+    if (list->count == allocated)
+    {
+      allocated *= 2;
+      list->queries = pg_realloc(list->queries, allocated * sizeof(char *));
+    }
+    list->queries[list->count++] = pg_strdup(line);
+  }
+
+  fclose(file);
+
+  if (list->count == 0)
+    pg_fatal("no query found in file \"%s\"", filename);
+
+  pg_log_debug("%d queries read from \"%s\"", list->count, filename);
+}
+
+/*
+ * Waits until the connection's socket is readable, or writable too if
+ * "forwrite" is set. A negative timeout waits forever. Returns false on
+ * error or timeout.
+ */
+bool
+wait_for_socket(PGconn *conn, bool forwrite, int timeout_ms)
+{
+  int       sock = PQsocket(conn);
+  fd_set    input_mask;
+  fd_set    output_mask;
+  struct timeval timeout;
+  int       rc;
+
+  if (sock < 0)
+  {
+    pg_log_error("invalid socket: %s", PQerrorMessage(conn));
+    return false;
+  }
+
+  FD_ZERO(&input_mask);
+  FD_ZERO(&output_mask);
+  FD_SET(sock, &input_mask);
+  if (forwrite)
+    FD_SET(sock, &output_mask);
+
+  timeout.tv_sec = timeout_ms / 1000;
+  timeout.tv_usec = (timeout_ms % 1000) * 1000;
+
+  rc = select(sock + 1, &input_mask, &output_mask, NULL,
+              timeout_ms < 0 ? NULL : &timeout);
+  if (rc < 0 && errno != EINTR)
+  {
+    pg_log_error("select() failed: %m");
+    return false;
+  }
+
+  return rc != 0;
+}
+
+static void
+help(const char *progname)
+{
+	printf("%s runs queries on a PostgreSQL server.\n\n", progname);
+	printf("Usage:\n");
+	printf("  %s [OPTION]... [CONNINFO [QUERY]]\n", progname);
+	printf("\nOptions:\n");
+	printf("  -f, --file=FILE           read queries from FILE, one per line\n");
+	printf("  -n, --count=N             number of queries to run in pipeline mode (default: 1000)\n");
+	printf("  -P, --pipeline=DEPTH      pipeline mode, with up to DEPTH queries in flight\n");
+	printf("  -S, --sync-every=N        send a pipeline sync every N queries (default: DEPTH)\n");
+	printf("  -M, --prepared            prepare queries once, then execute them\n");
+	printf("  -t, --param-types=TYPES   comma-separated parameter types (default: guessed by the server)\n");
+	printf("  -a, --param=VALUE         value of the next query parameter ($1, $2...)\n");
+	printf("      --params-file=FILE    read parameters from FILE, one tab-separated set per line\n");
+	printf("  -b, --binary              ask for results in binary format\n");
+	printf("      --race                connect to all hosts of CONNINFO at once, keep the\n"
+		   "                            first matching target_session_attrs\n");
+	printf("      --chunk-rows=LIST     comma-separated rows per result: 0 for all at once,\n"
+		   "                            1 for single-row mode, more for chunked rows mode\n"
+		   "                            (default: 1)\n");
+	printf("      --row-report          run the query once per chunk size and report rows/s\n"
+		   "                            and peak memory\n");
+	printf("      --profile=RUNS        run each query RUNS times traced, and report time to\n"
+		   "                            first byte and row, bytes and time per layer\n");
+	printf("  -o, --output=FILE         write to FILE final results in load mode, data in\n"
+		   "                            export mode (default: stdout), and phases as flame\n"
+		   "                            graph stacks with --profile\n");
+	printf("\nLoad mode:\n");
+	printf("  -c, --clients=N           run queries on N concurrent connections (also the\n"
+		   "                            number of connections of the loader mode)\n");
+	printf("  -R, --rate=QPS            open loop at QPS queries/s, latencies corrected for\n"
+		   "                            coordinated omission (default: closed loop)\n");
+	printf("  -T, --time=SECONDS        duration of the load (default: 10)\n");
+	printf("      --progress=SECONDS    show a summary every SECONDS\n");
+	printf("      --single-row          read results in single-row mode\n");
+	printf("      --output-format=FMT   csv (default) or json\n");
+	printf("\nLoader mode:\n");
+	printf("  -L, --load=FILE           load FILE with COPY, split on -c connections (default: 4)\n");
+	printf("      --table=TABLE         table to load, with its column list if needed\n");
+	printf("      --load-format=FORMAT  csv or text (default: csv for .csv files, text otherwise)\n");
+	printf("      --header              skip the first line of the file\n");
+	printf("      --transaction         commit only if every part was loaded\n");
+	printf("      --check               compare the row count of the table before and after\n");
+	printf("\nExport mode:\n");
+	printf("  -e, --export=FORMAT       export query results with COPY, in text, csv or binary\n");
+	printf("  -Z, --compress=LEVEL      compress exported data with zstd at LEVEL (1-22)\n");
+	printf("  -V, --version             output version information, then exit\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("\nReport bugs to <guillaume@lelarge.info>.\n");
+}
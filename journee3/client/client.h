@@ -0,0 +1,126 @@
+/*
+ * client.h, shared declarations between client's modes
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+#ifndef CLIENT_H
+#define CLIENT_H
+
+#include "libpq-fe.h"
+
+// Queries to run, from the command line or from a file
+typedef struct QueryList
+{
+  char  **queries;
+  int     count;
+
+  // Parameters: types (0 lets the server infer them) and sets of values
+  int     nparams;
+  Oid    *param_types;
+  char ***param_sets;
+  int     nsets;
+
+  bool    prepared;       // queries prepared as "client_<number>"
+  int     result_format;  // 0 for text, 1 for binary
+} QueryList;
+
+// Latency histogram, in microseconds
+#define HIST_SUB_BITS   8
+#define HIST_SUB_COUNT  (1 << HIST_SUB_BITS)
+#define HIST_HALF       (HIST_SUB_COUNT / 2)
+#define HIST_MAX        INT64CONST(3600000000)   // one hour, below 2^32
+#define HIST_BUCKETS    ((32 - HIST_SUB_BITS + 2) * HIST_HALF)
+
+typedef struct Histogram
+{
+  int64   counts[HIST_BUCKETS];
+  int64   total;
+  int64   min;
+  int64   max;
+  double  sum;
+} Histogram;
+
+// Load mode settings
+typedef struct LoadOptions
+{
+  int     clients;        // number of connections
+  int     rate;           // queries per second, 0 for closed loop
+  int     duration;       // in seconds
+  int     progress;       // seconds between summaries, 0 for none
+  bool    single_row;     // read results in single-row mode
+  char   *output;         // file for final results, or NULL
+  bool    json;           // JSON rather than CSV
+} LoadOptions;
+
+// Export mode settings
+typedef struct ExportOptions
+{
+  char   *format;         // text, csv or binary
+  char   *output;         // file, or NULL for stdout
+  int     compress;       // zstd level, 0 for none
+} ExportOptions;
+
+// Loader mode settings
+typedef struct LoaderOptions
+{
+  char   *file;           // file to load
+  char   *table;          // target table, with its columns if needed
+  bool    csv;            // CSV rather than text format
+  bool    header;         // skip the first line
+  int     connections;
+  bool    transaction;    // commit only if all parts were loaded
+  bool    check;          // compare count(*) before and after
+} LoaderOptions;
+
+// client.c
+extern void read_queries(const char *filename, QueryList *list);
+extern bool wait_for_socket(PGconn *conn, bool forwrite, int timeout_ms);
+
+// client_query.c
+extern void read_params(const char *filename, QueryList *list);
+extern bool resolve_param_types(PGconn *conn, QueryList *list,
+                                char **type_names);
+extern bool prepare_queries(PGconn *conn, QueryList *list);
+extern int send_query(PGconn *conn, QueryList *list, int64 n);
+extern int set_row_mode(PGconn *conn, int chunk);
+extern int row_mode_chunk(int chunk);
+extern void print_result(PGresult *res);
+
+// client_histogram.c
+extern void hist_reset(Histogram *hist);
+extern void hist_record(Histogram *hist, int64 value);
+extern int64 hist_percentile(const Histogram *hist, double percentile);
+extern double hist_mean(const Histogram *hist);
+extern int hist_next_bucket(const Histogram *hist, int index, int64 *value,
+                            int64 *count);
+
+// client_connect.c
+extern PGconn *race_connect(const char *conninfo);
+extern char *winner_conninfo(const char *conninfo, PGconn *conn);
+
+// client_export.c
+extern int run_export(PGconn *conn, QueryList *list, ExportOptions *options);
+
+// client_rows.c
+extern int run_row_report(const char *conninfo, QueryList *list, int *chunks,
+                          int nchunks);
+
+// client_profile.c
+extern int run_profile(PGconn *conn, QueryList *list, int runs, int chunk,
+                       const char *output);
+
+// client_loader.c
+extern int run_loader(const char *conninfo, LoaderOptions *options);
+
+// client_load.c
+extern int run_load(const char *conninfo, QueryList *list, LoadOptions *options);
+
+// client_pipeline.c
+extern int run_pipeline(PGconn *conn, QueryList *list, int depth,
+                        int sync_every, int64 total);
+
+#endif              /* CLIENT_H */
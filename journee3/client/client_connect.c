@@ -0,0 +1,450 @@
+/*
+ * client_connect.c, connects to all hosts of a conninfo at once
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <poll.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "pqexpbuffer.h"
+#include "portability/instr_time.h"
+
+#include "client.h"
+
+// One attempt, on one host
+typedef struct RaceAttempt
+{
+  PGconn     *conn;
+  PostgresPollingStatusType status;
+  char       *label;      // host:port, for the report
+  double      latency;    // in milliseconds, once done
+  bool        done;
+} RaceAttempt;
+
+// Hosts of the conninfo, shared by the attempts of one or two races
+typedef struct RaceHosts
+{
+  PQconninfoOption *options;
+  char      **hosts;
+  char      **hostaddrs;
+  char      **ports;
+  int         nhosts;
+  int         nhostaddrs;
+  int         nports;
+  int         nattempts;
+  int         timeout;    // in milliseconds, -1 for none
+  instr_time  start;      // of the current race
+  bool        timed_out;  // the current race timed out
+} RaceHosts;
+
+/*
+ * Splits a comma-separated list of hosts or ports, like libpq does. Empty
+ * elements stay, as empty strings.
+ */
+static int
+split_list(const char *value, char ***items)
+{
+  const char *p = value;
+  int         count = 0;
+
+  *items = NULL;
+  if (value == NULL || value[0] == '\0')
+    return 0;
+
+  while (true)
+  {
+    const char *comma = strchr(p, ',');
+    size_t      length = comma ? (size_t) (comma - p) : strlen(p);
+
+    *items = pg_realloc(*items, (count + 1) * sizeof(char *));
+    (*items)[count] = pg_malloc(length + 1);
+    memcpy((*items)[count], p, length);
+    (*items)[count][length] = '\0';
+    count++;
+
+    if (!comma)
+      break;
+    p = comma + 1;
+  }
+
+  return count;
+}
+
+static void
+free_list(char **items, int count)
+{
+  for (int i = 0; i < count; i++)
+    pg_free(items[i]);
+  pg_free(items);
+}
+
+/*
+ * Milliseconds elapsed since "start"
+ */
+static double
+elapsed_ms(instr_time start)
+{
+  instr_time  now;
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  return INSTR_TIME_GET_MILLISEC(now);
+}
+
+/*
+ * Starts a connection on the i-th host of the conninfo: same options, only
+ * host, hostaddr and port are replaced by the i-th ones, and
+ * target_session_attrs by "session_attrs" if not NULL.
+ */
+static PGconn *
+start_attempt(RaceHosts *race, const char *session_attrs, int i)
+{
+  const char **keywords;
+  const char **values;
+  int         n = 0;
+  int         noptions = 0;
+  PGconn     *conn;
+
+  for (PQconninfoOption *option = race->options; option->keyword; option++)
+    noptions++;
+
+  keywords = pg_malloc0((noptions + 2) * sizeof(char *));
+  values = pg_malloc0((noptions + 2) * sizeof(char *));
+
+  for (PQconninfoOption *option = race->options; option->keyword; option++)
+  {
+    const char *value = option->val;
+
+    if (strcmp(option->keyword, "host") == 0)
+      value = i < race->nhosts ? race->hosts[i] : NULL;
+    else if (strcmp(option->keyword, "hostaddr") == 0)
+      value = i < race->nhostaddrs ? race->hostaddrs[i] : NULL;
+    else if (strcmp(option->keyword, "port") == 0)
+      value = race->nports == 1 ? race->ports[0] :
+        i < race->nports ? race->ports[i] : NULL;
+    else if (strcmp(option->keyword, "target_session_attrs") == 0 &&
+             session_attrs)
+      continue;
+
+    if (value == NULL || value[0] == '\0')
+      continue;
+
+    keywords[n] = option->keyword;
+    values[n] = value;
+    n++;
+  }
+
+  // Also overrides PGTARGETSESSIONATTRS
+  if (session_attrs)
+  {
+    keywords[n] = "target_session_attrs";
+    values[n] = session_attrs;
+    n++;
+  }
+
+  conn = PQconnectStartParams(keywords, values, 0);
+
+  pg_free(keywords);
+  pg_free(values);
+
+  return conn;
+}
+
+/*
+ * Connects to every host of the conninfo at the same time, keeps the first
+ * connection that succeeds and closes the others. See race_connect(); on
+ * timeout, returns NULL even if some hosts failed.
+ */
+static PGconn *
+run_race(RaceHosts *race, const char *session_attrs)
+{
+  int         remaining;
+  RaceAttempt *attempts;
+  struct pollfd *fds;
+  int        *polled;
+  int         winner = -1;
+  int         failed = -1;
+  PGconn     *conn = NULL;
+
+  // Each race has the whole connect_timeout
+  INSTR_TIME_SET_CURRENT(race->start);
+  race->timed_out = false;
+
+  attempts = pg_malloc0(race->nattempts * sizeof(RaceAttempt));
+  fds = pg_malloc(race->nattempts * sizeof(struct pollfd));
+  polled = pg_malloc(race->nattempts * sizeof(int));
+
+  for (int i = 0; i < race->nattempts; i++)
+  {
+    RaceAttempt *attempt = &attempts[i];
+
+    attempt->conn = start_attempt(race, session_attrs, i);
+    attempt->label = psprintf("%s:%s",
+                              i < race->nhosts && race->hosts[i][0] ? race->hosts[i] :
+                              i < race->nhostaddrs && race->hostaddrs[i][0] ? race->hostaddrs[i] :
+                              "(default)",
+                              race->nports == 1 ? race->ports[0] :
+                              i < race->nports && race->ports[i][0] ? race->ports[i] : "(default)");
+
+    // Before the first poll, libpq wants to write
+    attempt->status = PGRES_POLLING_WRITING;
+    if (!attempt->conn || PQstatus(attempt->conn) == CONNECTION_BAD)
+    {
+      attempt->status = PGRES_POLLING_FAILED;
+      attempt->done = true;
+    }
+  }
+
+  pg_log_debug("racing %d hosts%s%s", race->nattempts,
+               session_attrs ? ", target_session_attrs=" : "",
+               session_attrs ? session_attrs : "");
+
+  remaining = race->nattempts;
+  while (winner < 0 && remaining > 0)
+  {
+    int     npolled = 0;
+    int     wait = -1;
+    int     rc;
+
+    remaining = 0;
+    for (int i = 0; i < race->nattempts; i++)
+    {
+      if (attempts[i].done)
+        continue;
+
+      // The socket may change when libpq tries the next address
+      fds[npolled].fd = PQsocket(attempts[i].conn);
+      fds[npolled].events = attempts[i].status == PGRES_POLLING_READING ?
+        POLLIN : POLLOUT;
+      fds[npolled].revents = 0;
+      polled[npolled++] = i;
+      remaining++;
+    }
+
+    if (remaining == 0)
+      break;
+
+    if (race->timeout >= 0)
+    {
+      wait = race->timeout - (int) elapsed_ms(race->start);
+      if (wait <= 0)
+      {
+        race->timed_out = true;
+        break;
+      }
+    }
+
+    rc = poll(fds, npolled, wait);
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_log_error("poll() failed: %m");
+      break;
+    }
+
+    for (int k = 0; k < npolled; k++)
+    {
+      RaceAttempt *attempt = &attempts[polled[k]];
+
+      if (fds[k].revents == 0)
+        continue;
+
+      attempt->status = PQconnectPoll(attempt->conn);
+      if (attempt->status == PGRES_POLLING_OK ||
+          attempt->status == PGRES_POLLING_FAILED)
+      {
+        attempt->done = true;
+        attempt->latency = elapsed_ms(race->start);
+      }
+
+      if (attempt->status == PGRES_POLLING_OK)
+      {
+        winner = polled[k];
+        break;
+      }
+    }
+  }
+
+  // Report, then keep only one connection
+  for (int i = 0; i < race->nattempts; i++)
+  {
+    RaceAttempt *attempt = &attempts[i];
+
+    if (i == winner)
+      pg_log_info("%s: connected in %.3f ms (backend PID is %d)",
+                  attempt->label, attempt->latency,
+                  PQbackendPID(attempt->conn));
+    else if (attempt->status == PGRES_POLLING_FAILED)
+    {
+      char   *message = attempt->conn ? PQerrorMessage(attempt->conn) : "out of memory\n";
+
+      pg_log_info("%s: failed after %.3f ms: %.*s", attempt->label,
+                  attempt->latency, (int) strcspn(message, "\n"), message);
+
+      if (winner < 0 && !race->timed_out && attempt->conn &&
+          (failed < 0 || PQconnectionNeedsPassword(attempt->conn)))
+        failed = i;
+    }
+    else
+      pg_log_info("%s: cancelled after %.3f ms", attempt->label,
+                  elapsed_ms(race->start));
+  }
+
+  for (int i = 0; i < race->nattempts; i++)
+  {
+    if (i != winner && i != failed && attempts[i].conn)
+      PQfinish(attempts[i].conn);
+    pg_free(attempts[i].label);
+  }
+
+  if (winner >= 0)
+    conn = attempts[winner].conn;
+  else if (failed >= 0)
+    conn = attempts[failed].conn;
+
+  pg_free(attempts);
+  pg_free(fds);
+  pg_free(polled);
+
+  return conn;
+}
+
+/*
+ * Connects to every host of the conninfo at the same time, keeps the first
+ * connection that succeeds and closes the others. Each connection has a
+ * single host, so libpq itself checks target_session_attrs on it: a host
+ * that does not match fails like a dead one.
+ *
+ * With target_session_attrs=prefer-standby, a single-host connection would
+ * accept a primary at once, so a primary could win against a standby: the
+ * race is run with "standby" first, then again with "any" if no standby
+ * answered in time, as libpq does with several hosts.
+ *
+ * The connect latency of each host is reported. connect_timeout bounds each
+ * race, as libpq only enforces it in blocking connections: an unreachable
+ * standby must not use up the time of the race for any server.
+ *
+ * Returns the winning connection. If all failed, returns one of the failed
+ * connections, preferably one that needs a password, so that the caller
+ * can report the error or ask for the password. Returns NULL on timeout or
+ * invalid conninfo.
+ */
+PGconn *
+race_connect(const char *conninfo)
+{
+  RaceHosts   race = {0};
+  PQconninfoOption *option;
+  const char *session_attrs = getenv("PGTARGETSESSIONATTRS");
+  char       *errmsg = NULL;
+  PGconn     *conn = NULL;
+
+  race.options = PQconninfoParse(conninfo, &errmsg);
+  if (!race.options)
+  {
+    pg_log_error("invalid connection string: %s", errmsg ? errmsg : "out of memory");
+    PQfreemem(errmsg);
+    return NULL;
+  }
+
+  race.timeout = -1;
+  for (option = race.options; option->keyword; option++)
+  {
+    if (strcmp(option->keyword, "host") == 0)
+      race.nhosts = split_list(option->val, &race.hosts);
+    else if (strcmp(option->keyword, "hostaddr") == 0)
+      race.nhostaddrs = split_list(option->val, &race.hostaddrs);
+    else if (strcmp(option->keyword, "port") == 0)
+      race.nports = split_list(option->val, &race.ports);
+    else if (strcmp(option->keyword, "connect_timeout") == 0 && option->val)
+      race.timeout = atoi(option->val) > 0 ? Max(atoi(option->val), 2) * 1000 : -1;
+    else if (strcmp(option->keyword, "target_session_attrs") == 0 && option->val)
+      session_attrs = option->val;
+  }
+
+  race.nattempts = Max(Max(race.nhosts, race.nhostaddrs), 1);
+  if (race.nports > 1 && race.nports != race.nattempts)
+  {
+    pg_log_error("could not match %d port numbers to %d hosts", race.nports, race.nattempts);
+    PQconninfoFree(race.options);
+    free_list(race.hosts, race.nhosts);
+    free_list(race.hostaddrs, race.nhostaddrs);
+    free_list(race.ports, race.nports);
+    return NULL;
+  }
+
+  if (session_attrs && strcmp(session_attrs, "prefer-standby") == 0)
+  {
+    conn = run_race(&race, "standby");
+
+    // NULL is a timeout, the race for any server has its own
+    if (!conn || PQstatus(conn) != CONNECTION_OK)
+    {
+      PQfinish(conn);
+      if (race.timed_out)
+        pg_log_info("no standby answered within %d ms, racing again for any server",
+                    race.timeout);
+      else
+        pg_log_info("no standby available, racing again for any server");
+      conn = run_race(&race, "any");
+    }
+  }
+  else
+    conn = run_race(&race, NULL);
+
+  if (race.timed_out)
+    pg_log_error("timeout expired after %d ms", race.timeout);
+
+  PQconninfoFree(race.options);
+  free_list(race.hosts, race.nhosts);
+  free_list(race.hostaddrs, race.nhostaddrs);
+  free_list(race.ports, race.nports);
+
+  return conn;
+}
+
+/*
+ * Appends keyword='value' to a conninfo, quoting the value
+ */
+static void
+append_option(PQExpBuffer buf, const char *keyword, const char *value)
+{
+  appendPQExpBuffer(buf, " %s='", keyword);
+  for (const char *p = value; *p; p++)
+  {
+    if (*p == '\'' || *p == '\\')
+      appendPQExpBufferChar(buf, '\\');
+    appendPQExpBufferChar(buf, *p);
+  }
+  appendPQExpBufferChar(buf, '\'');
+}
+
+/*
+ * Conninfo pointing at the host of an established connection, so that the
+ * next connections go straight to the winner of the race. Later keywords
+ * override earlier ones; URIs cannot be extended and are kept as they are.
+ */
+char *
+winner_conninfo(const char *conninfo, PGconn *conn)
+{
+  PQExpBufferData buf;
+  char       *hostaddr = PQhostaddr(conn);
+
+  if (strncmp(conninfo, "postgresql://", 13) == 0 ||
+      strncmp(conninfo, "postgres://", 11) == 0)
+    return pg_strdup(conninfo);
+
+  initPQExpBuffer(&buf);
+  appendPQExpBufferStr(&buf, conninfo);
+  append_option(&buf, "host", PQhost(conn));
+  append_option(&buf, "hostaddr", hostaddr ? hostaddr : "");
+  append_option(&buf, "port", PQport(conn));
+
+  return buf.data;
+}
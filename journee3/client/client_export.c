@@ -0,0 +1,371 @@
+/*
+ * client_export.c, export mode for client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "pqexpbuffer.h"
+#include "portability/instr_time.h"
+
+#ifdef USE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "client.h"
+
+// Data is written by blocks of this size, only the last one may be shorter
+#define EXPORT_BUFFER_SIZE  (4 * 1024 * 1024)
+
+// Where exported data goes
+typedef struct ExportOutput
+{
+  int       fd;
+  char     *buffer;       // raw COPY data
+  size_t    used;
+  int64     written;      // bytes written to fd
+#ifdef USE_ZSTD
+  ZSTD_CCtx *cctx;
+  char     *zbuffer;      // compressed data
+  size_t    zused;
+#endif
+} ExportOutput;
+
+/*
+ * Writes all "length" bytes, whatever the size of each write()
+ */
+static bool
+write_all(ExportOutput *out, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t   rc = write(out->fd, data, length);
+
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_log_error("could not write exported data: %m");
+      return false;
+    }
+
+    data += rc;
+    length -= rc;
+    out->written += rc;
+  }
+
+  return true;
+}
+
+#ifdef USE_ZSTD
+/*
+ * Compresses the raw buffer in the compressed one, writing the latter each
+ * time it is full. With "end", the zstd frame is also completed.
+ */
+static bool
+compress_buffer(ExportOutput *out, bool end)
+{
+  ZSTD_inBuffer  input = {out->buffer, out->used, 0};
+  ZSTD_EndDirective mode = end ? ZSTD_e_end : ZSTD_e_continue;
+  size_t    remaining;
+
+  do
+  {
+    ZSTD_outBuffer output = {out->zbuffer, EXPORT_BUFFER_SIZE, out->zused};
+
+    remaining = ZSTD_compressStream2(out->cctx, &output, &input, mode);
+    if (ZSTD_isError(remaining))
+    {
+      pg_log_error("could not compress exported data: %s",
+                   ZSTD_getErrorName(remaining));
+      return false;
+    }
+    out->zused = output.pos;
+
+    if (out->zused == EXPORT_BUFFER_SIZE)
+    {
+      if (!write_all(out, out->zbuffer, out->zused))
+        return false;
+      out->zused = 0;
+    }
+  } while (input.pos < input.size || (end && remaining > 0));
+
+  out->used = 0;
+
+  return true;
+}
+#endif
+
+/*
+ * Empties the raw buffer, compressing it first if asked to. With "end",
+ * everything is written.
+ */
+static bool
+flush_output(ExportOutput *out, bool end)
+{
+#ifdef USE_ZSTD
+  if (out->cctx)
+  {
+    if (!compress_buffer(out, end))
+      return false;
+    if (end && out->zused > 0)
+    {
+      if (!write_all(out, out->zbuffer, out->zused))
+        return false;
+      out->zused = 0;
+    }
+    return true;
+  }
+#endif
+
+  if (!write_all(out, out->buffer, out->used))
+    return false;
+  out->used = 0;
+
+  return true;
+}
+
+/*
+ * Adds a chunk of COPY data to the raw buffer, flushing it when full
+ */
+static bool
+append_output(ExportOutput *out, const char *data, size_t length)
+{
+  while (length > 0)
+  {
+    size_t    room = EXPORT_BUFFER_SIZE - out->used;
+    size_t    n = Min(room, length);
+
+    memcpy(out->buffer + out->used, data, n);
+    out->used += n;
+    data += n;
+    length -= n;
+
+    if (out->used == EXPORT_BUFFER_SIZE && !flush_output(out, false))
+      return false;
+  }
+
+  return true;
+}
+
+/*
+ * Exports the result of one query, wrapped in COPY ... TO STDOUT unless it
+ * already is a COPY. Returns the number of bytes of COPY data, -1 on error.
+ */
+static int64
+export_query(PGconn *conn, const char *query, const char *format,
+             ExportOutput *out)
+{
+  PQExpBufferData copy;
+  PGresult   *res;
+  char       *data;
+  int         length;
+  int64       bytes = 0;
+  size_t      querylen;
+
+  while (isspace((unsigned char) *query))
+    query++;
+  querylen = strlen(query);
+
+  // Trailing semicolons and spaces would end the COPY too early
+  while (querylen > 0 && (query[querylen - 1] == ';' ||
+                          isspace((unsigned char) query[querylen - 1])))
+    querylen--;
+
+  // COPY as a whole word: a table such as COPYRIGHT must still be wrapped.
+  // The newline ends a trailing -- comment before the closing parenthesis.
+  initPQExpBuffer(&copy);
+  if (pg_strncasecmp(query, "COPY", 4) == 0 &&
+      !isalnum((unsigned char) query[4]) && query[4] != '_')
+    appendBinaryPQExpBuffer(&copy, query, querylen);
+  else
+  {
+    appendPQExpBufferStr(&copy, "COPY (");
+    appendBinaryPQExpBuffer(&copy, query, querylen);
+    appendPQExpBuffer(&copy, "\n) TO STDOUT WITH (FORMAT %s)", format);
+  }
+
+  pg_log_debug("exporting: %s", copy.data);
+
+  if (!PQsendQuery(conn, copy.data))
+  {
+    pg_log_error("could not send query: %s", PQerrorMessage(conn));
+    termPQExpBuffer(&copy);
+    return -1;
+  }
+  termPQExpBuffer(&copy);
+
+  res = PQgetResult(conn);
+  if (PQresultStatus(res) != PGRES_COPY_OUT)
+  {
+    pg_log_error("export failed: %s", PQerrorMessage(conn));
+    PQclear(res);
+    while ((res = PQgetResult(conn)))
+      PQclear(res);
+    return -1;
+  }
+  PQclear(res);
+
+  // One chunk per row: read all those already received, then wait
+  while (true)
+  {
+    length = PQgetCopyData(conn, &data, 1);
+
+    if (length > 0)
+    {
+      bool    ok = append_output(out, data, length);
+
+      PQfreemem(data);
+      if (!ok)
+        return -1;
+      bytes += length;
+      continue;
+    }
+
+    if (length == -1)
+      break;
+
+    if (length == -2)
+    {
+      pg_log_error("could not read exported data: %s", PQerrorMessage(conn));
+      return -1;
+    }
+
+    // Nothing more for now
+    if (!wait_for_socket(conn, false, -1))
+      return -1;
+    if (!PQconsumeInput(conn))
+    {
+      pg_log_error("could not read exported data: %s", PQerrorMessage(conn));
+      return -1;
+    }
+  }
+
+  // End of COPY, then the final status of the query
+  while ((res = PQgetResult(conn)))
+  {
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+      pg_log_error("export failed: %s", PQresultErrorMessage(res));
+      bytes = -1;
+    }
+    PQclear(res);
+  }
+
+  return bytes;
+}
+
+/*
+ * Exports the results of the queries of the list, one after the other, in
+ * the same output: a file, or stdout. A binary export takes a single query.
+ *
+ * COPY data is gathered in a large buffer, written (or compressed with
+ * zstd, then written) only when full: the number of write() calls does not
+ * depend on the number of rows.
+ */
+int
+run_export(PGconn *conn, QueryList *list, ExportOptions *options)
+{
+  ExportOutput out = {0};
+  instr_time  start;
+  instr_time  now;
+  int64       bytes = 0;
+  double      elapsed;
+  int         result = 1;
+
+  // Each binary COPY has its own header and trailer: they cannot be chained
+  if (strcmp(options->format, "binary") == 0 && list->count > 1)
+  {
+    pg_log_error("binary export needs a single query, %d given", list->count);
+    return 1;
+  }
+
+  if (options->output && strcmp(options->output, "-") != 0)
+  {
+    out.fd = open(options->output, O_WRONLY | O_CREAT | O_TRUNC | PG_BINARY,
+                  0644);
+    if (out.fd < 0)
+    {
+      pg_log_error("could not open file \"%s\": %m", options->output);
+      return 1;
+    }
+  }
+  else
+    out.fd = fileno(stdout);
+
+  out.buffer = pg_malloc(EXPORT_BUFFER_SIZE);
+
+#ifdef USE_ZSTD
+  if (options->compress > 0)
+  {
+    size_t    rc;
+
+    out.cctx = ZSTD_createCCtx();
+    if (!out.cctx)
+      pg_fatal("could not create zstd compression context");
+
+    rc = ZSTD_CCtx_setParameter(out.cctx, ZSTD_c_compressionLevel,
+                                options->compress);
+    if (ZSTD_isError(rc))
+      pg_fatal("could not set zstd compression level %d: %s",
+               options->compress, ZSTD_getErrorName(rc));
+
+    out.zbuffer = pg_malloc(EXPORT_BUFFER_SIZE);
+  }
+#endif
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  for (int i = 0; i < list->count; i++)
+  {
+    int64   n = export_query(conn, list->queries[i], options->format, &out);
+
+    if (n < 0)
+      goto done;
+    bytes += n;
+  }
+
+  if (!flush_output(&out, true))
+    goto done;
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  elapsed = INSTR_TIME_GET_DOUBLE(now);
+
+  pg_log_info("exported " INT64_FORMAT " bytes in %.3f s (%.1f MB/s)",
+              bytes, elapsed,
+              elapsed > 0 ? bytes / elapsed / (1024 * 1024) : 0);
+#ifdef USE_ZSTD
+  if (out.cctx)
+    pg_log_info("compressed to " INT64_FORMAT " bytes (%.1f%%)",
+                out.written, bytes > 0 ? 100.0 * out.written / bytes : 0);
+#endif
+
+  result = 0;
+
+done:
+  if (out.fd != fileno(stdout) && close(out.fd) != 0)
+  {
+    pg_log_error("could not close file \"%s\": %m", options->output);
+    result = 1;
+  }
+
+  pg_free(out.buffer);
+#ifdef USE_ZSTD
+  if (out.cctx)
+  {
+    ZSTD_freeCCtx(out.cctx);
+    pg_free(out.zbuffer);
+  }
+#endif
+
+  return result;
+}
@@ -0,0 +1,129 @@
+/*
+ * client_histogram.c, latency histograms
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "postgres_fe.h"
+#include "port/pg_bitutils.h"
+
+#include "client.h"
+
+/*
+ * Buckets work like HDR histograms: values below HIST_SUB_COUNT have their
+ * own bucket, then every power of two is split in HIST_HALF buckets. The
+ * relative error is below 1/HIST_HALF, less than 1%, whatever the value.
+ */
+static int
+hist_index(int64 value)
+{
+  int     shift;
+
+  if (value < HIST_SUB_COUNT)
+    return (int) value;
+
+  // (value >> shift) is between HIST_HALF and HIST_SUB_COUNT - 1
+  shift = pg_leftmost_one_pos64((uint64) value) - (HIST_SUB_BITS - 1);
+  return (shift + 1) * HIST_HALF + (int) ((value >> shift) - HIST_HALF);
+}
+
+/*
+ * Highest value counted in a bucket
+ */
+static int64
+hist_value(int index)
+{
+  int     shift;
+  int64   sub;
+
+  if (index < HIST_SUB_COUNT)
+    return index;
+
+  shift = index / HIST_HALF - 1;
+  sub = index % HIST_HALF + HIST_HALF;
+  return ((sub + 1) << shift) - 1;
+}
+
+void
+hist_reset(Histogram *hist)
+{
+  memset(hist, 0, sizeof(Histogram));
+}
+
+/*
+ * Records a value, in microseconds. Values above HIST_MAX are counted as
+ * HIST_MAX.
+ */
+void
+hist_record(Histogram *hist, int64 value)
+{
+  if (value < 0)
+    value = 0;
+  if (value > HIST_MAX)
+    value = HIST_MAX;
+
+  hist->counts[hist_index(value)]++;
+
+  if (hist->total == 0 || value < hist->min)
+    hist->min = value;
+  if (value > hist->max)
+    hist->max = value;
+  hist->sum += value;
+  hist->total++;
+}
+
+/*
+ * Value below which "percentile" percent of the recorded values are
+ */
+int64
+hist_percentile(const Histogram *hist, double percentile)
+{
+  int64   wanted;
+  int64   seen = 0;
+
+  if (hist->total == 0)
+    return 0;
+
+  wanted = (int64) (hist->total * percentile / 100.0 + 0.5);
+  if (wanted < 1)
+    wanted = 1;
+
+  for (int i = 0; i < HIST_BUCKETS; i++)
+  {
+    seen += hist->counts[i];
+    if (seen >= wanted)
+      return Min(hist_value(i), hist->max);
+  }
+
+  return hist->max;
+}
+
+double
+hist_mean(const Histogram *hist)
+{
+  return hist->total > 0 ? hist->sum / hist->total : 0;
+}
+
+/*
+ * Walks the non-empty buckets: returns the next one after "index" (start
+ * with -1), or -1 once done. Its highest value and count are returned too.
+ */
+int
+hist_next_bucket(const Histogram *hist, int index, int64 *value, int64 *count)
+{
+  for (index++; index < HIST_BUCKETS; index++)
+  {
+    if (hist->counts[index] > 0)
+    {
+      *value = Min(hist_value(index), hist->max);
+      *count = hist->counts[index];
+      return index;
+    }
+  }
+
+  return -1;
+}
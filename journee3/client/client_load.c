@@ -0,0 +1,542 @@
+/*
+ * client_load.c, load mode for client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <poll.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "portability/instr_time.h"
+
+#include "client.h"
+
+// One connection of the load mode
+typedef struct LoadConnection
+{
+  PGconn   *conn;
+  bool      busy;         // a query is in flight
+  bool      flushing;     // the query is not completely sent yet
+  bool      failed;       // the query in flight failed
+  int64     intended;     // when the query should have been sent
+  int64     sent;         // when it was really sent
+} LoadConnection;
+
+// Results of a run
+typedef struct LoadStats
+{
+  int64     queries;
+  int64     failed;
+  int64     rows;
+  int64     not_sent;     // open loop: queries still waiting at the end
+  double    elapsed;      // in seconds
+  Histogram latency;      // from the intended time, not sent ones included
+  Histogram service;      // from the real send time
+} LoadStats;
+
+static const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+
+static void print_progress(double elapsed, double interval, Histogram *hist,
+                           int64 failed, int64 backlog);
+static void print_stats(LoadOptions *options, LoadStats *stats);
+static bool write_stats(LoadOptions *options, LoadStats *stats);
+
+/*
+ * Microseconds elapsed since "start"
+ */
+static int64
+elapsed_since(instr_time start)
+{
+  instr_time  now;
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  return (int64) INSTR_TIME_GET_MICROSEC(now);
+}
+
+/*
+ * Sends the n-th query on a connection
+ */
+static bool
+start_query(LoadConnection *lc, QueryList *list, LoadOptions *options,
+            int64 n, int64 intended, int64 now)
+{
+  int     flush;
+
+  if (!send_query(lc->conn, list, n))
+  {
+    pg_log_error("could not send query: %s", PQerrorMessage(lc->conn));
+    return false;
+  }
+
+  if (options->single_row && !PQsetSingleRowMode(lc->conn))
+    pg_log_warning("could not activate single-row mode");
+
+  flush = PQflush(lc->conn);
+  if (flush < 0)
+  {
+    pg_log_error("could not send data: %s", PQerrorMessage(lc->conn));
+    return false;
+  }
+
+  lc->busy = true;
+  lc->flushing = flush == 1;
+  lc->failed = false;
+  lc->intended = intended;
+  lc->sent = now;
+
+  return true;
+}
+
+/*
+ * Reads what the server sent on a connection. Returns true once the query
+ * in flight is complete, its results in "rows" and lc->failed.
+ */
+static bool
+read_results(LoadConnection *lc, int64 *rows, bool *error)
+{
+  PGresult *res;
+
+  *error = false;
+
+  if (!PQconsumeInput(lc->conn))
+  {
+    pg_log_error("could not read results: %s", PQerrorMessage(lc->conn));
+    *error = true;
+    return false;
+  }
+
+  while (!PQisBusy(lc->conn))
+  {
+    res = PQgetResult(lc->conn);
+
+    // NULL ends the results of the query
+    if (!res)
+      return true;
+
+    switch (PQresultStatus(res))
+    {
+      case PGRES_TUPLES_OK:
+      case PGRES_SINGLE_TUPLE:
+        *rows += PQntuples(res);
+        break;
+
+      case PGRES_FATAL_ERROR:
+        if (!lc->failed)
+          pg_log_error("query failed: %s", PQresultErrorMessage(res));
+        lc->failed = true;
+        break;
+
+      default:
+        break;
+    }
+
+    PQclear(res);
+  }
+
+  return false;
+}
+
+/*
+ * Runs the queries of the list on options->clients connections, for
+ * options->duration seconds, all multiplexed with poll().
+ *
+ * In closed loop (no rate), each connection sends its next query as soon
+ * as the previous one is done. In open loop, queries are scheduled at a
+ * fixed rate whatever the response time: a late query waits for a free
+ * connection, and its latency is counted from its scheduled time. This
+ * corrects the coordinated omission of the closed loop, where a slow
+ * server also slows the load down and hides its own latency. Queries still
+ * waiting at the end count too, with their wait until then: leaving them
+ * out would hide the overload again.
+ *
+ * Returns the number of failed queries, -1 on connection failure.
+ */
+int
+run_load(const char *conninfo, QueryList *list, LoadOptions *options)
+{
+  LoadConnection *conns;
+  LoadStats  *stats;
+  Histogram  *interval;
+  struct pollfd *fds;
+  int        *polled;
+  int        *idle;
+  int         nidle = 0;
+  int         busy = 0;
+  instr_time  start;
+  int64       end = (int64) options->duration * 1000000;
+  int64       next_progress = (int64) options->progress * 1000000;
+  int64       last_progress = 0;
+  int64       interval_failed = 0;
+  int64       started = 0;
+  int64       now;
+  int         result = -1;
+
+  conns = pg_malloc0(options->clients * sizeof(LoadConnection));
+  fds = pg_malloc(options->clients * sizeof(struct pollfd));
+  polled = pg_malloc(options->clients * sizeof(int));
+  idle = pg_malloc(options->clients * sizeof(int));
+  stats = pg_malloc0(sizeof(LoadStats));
+  interval = pg_malloc0(sizeof(Histogram));
+
+  // Opening connections
+  for (int i = 0; i < options->clients; i++)
+  {
+    conns[i].conn = PQconnectdb(conninfo);
+    if (PQstatus(conns[i].conn) == CONNECTION_BAD)
+    {
+      pg_log_error("could not connect: %s", PQerrorMessage(conns[i].conn));
+      goto done;
+    }
+
+    if (list->prepared && !prepare_queries(conns[i].conn, list))
+      goto done;
+
+    if (PQsetnonblocking(conns[i].conn, 1) != 0)
+    {
+      pg_log_error("could not set non-blocking mode: %s",
+                   PQerrorMessage(conns[i].conn));
+      goto done;
+    }
+
+    idle[nidle++] = i;
+  }
+
+  if (options->rate > 0)
+    pg_log_debug("load mode, %d connections, open loop at %d queries/s for %d s",
+                 options->clients, options->rate, options->duration);
+  else
+    pg_log_debug("load mode, %d connections, closed loop for %d s",
+                 options->clients, options->duration);
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  while (true)
+  {
+    int     npolled = 0;
+    int     timeout;
+    int64   wake = end;
+    int     rc;
+
+    now = elapsed_since(start);
+
+    if (now >= end && busy == 0)
+      break;
+
+    // Send queries on idle connections
+    if (now < end)
+    {
+      if (options->rate > 0)
+      {
+        // query k is scheduled at k / rate seconds
+        int64   scheduled = now * options->rate / 1000000 + 1;
+
+        while (started < scheduled && nidle > 0)
+        {
+          LoadConnection *lc = &conns[idle[--nidle]];
+
+          if (!start_query(lc, list, options, started,
+                           started * 1000000 / options->rate, now))
+            goto done;
+          started++;
+          busy++;
+        }
+
+        if (nidle > 0)
+          wake = Min(wake, started * 1000000 / options->rate);
+      }
+      else
+      {
+        while (nidle > 0)
+        {
+          LoadConnection *lc = &conns[idle[--nidle]];
+
+          if (!start_query(lc, list, options, started, now, now))
+            goto done;
+          started++;
+          busy++;
+        }
+      }
+    }
+
+    // Periodic summary
+    if (next_progress > 0)
+    {
+      if (now >= next_progress)
+      {
+        int64   backlog = 0;
+
+        if (options->rate > 0 && now < end)
+          backlog = now * options->rate / 1000000 + 1 - started;
+
+        print_progress(now / 1000000.0, (now - last_progress) / 1000000.0,
+                       interval, stats->failed - interval_failed, backlog);
+        hist_reset(interval);
+        interval_failed = stats->failed;
+        last_progress = now;
+        next_progress += (int64) options->progress * 1000000;
+      }
+      wake = Min(wake, next_progress);
+    }
+
+    // Wait for results, the next scheduled query or the next summary
+    for (int i = 0; i < options->clients; i++)
+    {
+      if (!conns[i].busy)
+        continue;
+
+      fds[npolled].fd = PQsocket(conns[i].conn);
+      fds[npolled].events = POLLIN | (conns[i].flushing ? POLLOUT : 0);
+      fds[npolled].revents = 0;
+      polled[npolled++] = i;
+    }
+
+    if (now >= end)
+      timeout = 1000;
+    else
+      timeout = (int) Max((wake - now + 999) / 1000, 0);
+
+    rc = poll(fds, npolled, timeout);
+    if (rc < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_log_error("poll() failed: %m");
+      goto done;
+    }
+
+    for (int k = 0; k < npolled && rc > 0; k++)
+    {
+      LoadConnection *lc = &conns[polled[k]];
+      bool    error;
+
+      if (fds[k].revents == 0)
+        continue;
+
+      if (lc->flushing && (fds[k].revents & POLLOUT))
+      {
+        int   flush = PQflush(lc->conn);
+
+        if (flush < 0)
+        {
+          pg_log_error("could not send data: %s", PQerrorMessage(lc->conn));
+          goto done;
+        }
+        lc->flushing = flush == 1;
+      }
+
+      if (!(fds[k].revents & (POLLIN | POLLERR | POLLHUP)))
+        continue;
+
+      if (!read_results(lc, &stats->rows, &error))
+      {
+        if (error)
+          goto done;
+        continue;
+      }
+
+      // The query is complete
+      now = elapsed_since(start);
+      if (lc->failed)
+        stats->failed++;
+      else
+      {
+        hist_record(&stats->latency, now - lc->intended);
+        hist_record(&stats->service, now - lc->sent);
+        hist_record(interval, now - lc->intended);
+      }
+      stats->queries++;
+
+      lc->busy = false;
+      idle[nidle++] = polled[k];
+      busy--;
+    }
+  }
+
+  now = elapsed_since(start);
+  stats->elapsed = now / 1000000.0;
+  if (options->rate > 0)
+  {
+    stats->not_sent = Max(end * options->rate / 1000000 - started, 0);
+
+    // their latency is at least their wait until now
+    for (int64 k = started; k < started + stats->not_sent; k++)
+      hist_record(&stats->latency, now - k * 1000000 / options->rate);
+  }
+
+  print_stats(options, stats);
+  if (options->output && !write_stats(options, stats))
+    goto done;
+
+  result = (int) stats->failed;
+
+done:
+  for (int i = 0; i < options->clients; i++)
+    if (conns[i].conn)
+      PQfinish(conns[i].conn);
+
+  pg_free(conns);
+  pg_free(fds);
+  pg_free(polled);
+  pg_free(idle);
+  pg_free(stats);
+  pg_free(interval);
+
+  return result;
+}
+
+static void
+print_progress(double elapsed, double interval, Histogram *hist,
+               int64 failed, int64 backlog)
+{
+  fprintf(stderr, "progress: %.1f s, %.1f queries/s, latency p50 %.3f ms, p99 %.3f ms, max %.3f ms, "
+          INT64_FORMAT " failed",
+          elapsed, interval > 0 ? hist->total / interval : 0,
+          hist_percentile(hist, 50) / 1000.0,
+          hist_percentile(hist, 99) / 1000.0,
+          hist->max / 1000.0, failed);
+  if (backlog > 0)
+    fprintf(stderr, ", " INT64_FORMAT " late", backlog);
+  fprintf(stderr, "\n");
+}
+
+static void
+print_histogram_line(const char *label, Histogram *hist)
+{
+  printf("%s (ms):", label);
+  for (int i = 0; i < lengthof(percentiles); i++)
+    printf(" p%g %.3f,", percentiles[i], hist_percentile(hist, percentiles[i]) / 1000.0);
+  printf(" max %.3f, avg %.3f\n", hist->max / 1000.0, hist_mean(hist) / 1000.0);
+}
+
+static void
+print_stats(LoadOptions *options, LoadStats *stats)
+{
+  if (options->rate > 0)
+    printf("clients: %d, open loop at %d queries/s, duration: %.3f s\n",
+           options->clients, options->rate, stats->elapsed);
+  else
+    printf("clients: %d, closed loop, duration: %.3f s\n",
+           options->clients, stats->elapsed);
+
+  printf("queries: " INT64_FORMAT " (" INT64_FORMAT " failed), rows: " INT64_FORMAT ", throughput: %.1f queries/s\n",
+         stats->queries, stats->failed, stats->rows,
+         stats->elapsed > 0 ? stats->queries / stats->elapsed : 0);
+
+  if (stats->latency.total == 0)
+    return;
+
+  if (options->rate > 0)
+  {
+    if (stats->not_sent > 0)
+      printf("not sent: " INT64_FORMAT " (no free connection in time, counted in latency until the end)\n",
+             stats->not_sent);
+    print_histogram_line("latency", &stats->latency);
+    print_histogram_line("service time", &stats->service);
+  }
+  else
+    print_histogram_line("latency", &stats->latency);
+}
+
+/*
+ * Writes the final results, one CSV line (with a header) or a JSON object
+ * holding the percentiles and the non-empty buckets of the histograms.
+ */
+static void
+write_histogram_json(FILE *file, const char *name, Histogram *hist)
+{
+  int     index = -1;
+  int64   value;
+  int64   count;
+  bool    first = true;
+
+  fprintf(file, "  \"%s\": {\n", name);
+  for (int i = 0; i < lengthof(percentiles); i++)
+    fprintf(file, "    \"p%g\": %.3f,\n", percentiles[i],
+            hist_percentile(hist, percentiles[i]) / 1000.0);
+  fprintf(file, "    \"min\": %.3f,\n    \"max\": %.3f,\n    \"avg\": %.3f,\n",
+          hist->min / 1000.0, hist->max / 1000.0, hist_mean(hist) / 1000.0);
+
+  fprintf(file, "    \"buckets\": [");
+  while ((index = hist_next_bucket(hist, index, &value, &count)) >= 0)
+  {
+    fprintf(file, "%s[%.3f, " INT64_FORMAT "]", first ? "" : ", ",
+            value / 1000.0, count);
+    first = false;
+  }
+  fprintf(file, "]\n  }");
+}
+
+static void
+write_histogram_csv(FILE *file, Histogram *hist, bool header, const char *name)
+{
+  for (int i = 0; i < lengthof(percentiles); i++)
+  {
+    if (header)
+      fprintf(file, ",%s_p%g_ms", name, percentiles[i]);
+    else
+      fprintf(file, ",%.3f", hist_percentile(hist, percentiles[i]) / 1000.0);
+  }
+
+  if (header)
+    fprintf(file, ",%s_max_ms,%s_avg_ms", name, name);
+  else
+    fprintf(file, ",%.3f,%.3f", hist->max / 1000.0, hist_mean(hist) / 1000.0);
+}
+
+static bool
+write_stats(LoadOptions *options, LoadStats *stats)
+{
+  FILE     *file;
+
+  file = fopen(options->output, "w");
+  if (!file)
+  {
+    pg_log_error("could not open file \"%s\": %m", options->output);
+    return false;
+  }
+
+  if (options->json)
+  {
+    fprintf(file, "{\n");
+    fprintf(file, "  \"clients\": %d,\n  \"rate\": %d,\n  \"duration\": %.3f,\n",
+            options->clients, options->rate, stats->elapsed);
+    fprintf(file, "  \"queries\": " INT64_FORMAT ",\n  \"failed\": " INT64_FORMAT ",\n"
+            "  \"rows\": " INT64_FORMAT ",\n  \"not_sent\": " INT64_FORMAT ",\n",
+            stats->queries, stats->failed, stats->rows, stats->not_sent);
+    fprintf(file, "  \"throughput\": %.1f,\n",
+            stats->elapsed > 0 ? stats->queries / stats->elapsed : 0);
+    write_histogram_json(file, "latency_ms", &stats->latency);
+    fprintf(file, ",\n");
+    write_histogram_json(file, "service_ms", &stats->service);
+    fprintf(file, "\n}\n");
+  }
+  else
+  {
+    fprintf(file, "clients,rate,duration,queries,failed,rows,not_sent,throughput");
+    write_histogram_csv(file, &stats->latency, true, "latency");
+    write_histogram_csv(file, &stats->service, true, "service");
+    fprintf(file, "\n");
+
+    fprintf(file, "%d,%d,%.3f," INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT "," INT64_FORMAT ",%.1f",
+            options->clients, options->rate, stats->elapsed,
+            stats->queries, stats->failed, stats->rows, stats->not_sent,
+            stats->elapsed > 0 ? stats->queries / stats->elapsed : 0);
+    write_histogram_csv(file, &stats->latency, false, "latency");
+    write_histogram_csv(file, &stats->service, false, "service");
+    fprintf(file, "\n");
+  }
+
+  if (fclose(file) != 0)
+  {
+    pg_log_error("could not write file \"%s\": %m", options->output);
+    return false;
+  }
+
+  return true;
+}
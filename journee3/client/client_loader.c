@@ -0,0 +1,474 @@
+/*
+ * client_loader.c, loads a file with COPY on several connections
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "portability/instr_time.h"
+
+#include "client.h"
+
+// Size of each PQputCopyData() call
+#define LOADER_CHUNK_SIZE   (256 * 1024)
+
+typedef enum LoaderPhase
+{
+  LOADER_COPYING,         // sending data
+  LOADER_ENDING,          // sending the end of COPY
+  LOADER_WAITING,         // waiting for the result of COPY
+  LOADER_DONE
+} LoaderPhase;
+
+// One connection, and the part of the file it loads
+typedef struct LoaderConnection
+{
+  PGconn     *conn;
+  LoaderPhase phase;
+  bool        flushing;   // libpq still has data to send
+  bool        failed;
+  const char *start;
+  const char *end;
+  const char *pos;
+  int64       records;    // found by the scanner
+  int64       loaded;     // reported by COPY
+} LoaderConnection;
+
+/*
+ * Scans the file for record boundaries and counts the records. Each part
+ * starts at the first boundary after i * size / nparts, "bounds" gets the
+ * nparts + 1 limits of the parts and "records" their number of records.
+ * With "header", the first record is left out of the first part.
+ *
+ * In CSV, a newline between quotes belongs to the value. Quotes are only
+ * counted: an escaped quote ("") toggles the state twice, so the parity
+ * tells whether a newline is inside a value. In text format, a newline
+ * preceded by a backslash belongs to the value.
+ *
+ * Newlines and quotes are found with memchr(), which is vectorized by the
+ * C library, rather than by looking at each byte.
+ */
+static void
+scan_records(const char *data, size_t size, bool csv, bool header,
+             int nparts, const char **bounds, int64 *records)
+{
+  const char *p = data;
+  const char *last = data + size;
+  bool        in_quotes = false;
+  int         part = 0;
+
+  bounds[0] = data;
+  for (int i = 0; i < nparts; i++)
+    records[i] = 0;
+
+  while (p < last)
+  {
+    const char *newline = memchr(p, '\n', last - p);
+    const char *record_end = newline ? newline + 1 : last;
+
+    if (csv)
+    {
+      // quotes before this newline
+      for (const char *q = p; (q = memchr(q, '"', record_end - q)); q++)
+        in_quotes = !in_quotes;
+    }
+    else if (newline)
+    {
+      int     backslashes = 0;
+
+      for (const char *b = newline - 1; b >= p && *b == '\\'; b--)
+        backslashes++;
+      in_quotes = backslashes % 2 == 1;
+    }
+
+    p = record_end;
+
+    // inside a value: the record goes on
+    if (in_quotes && newline)
+      continue;
+
+    if (header)
+    {
+      bounds[0] = p;
+      header = false;
+      continue;
+    }
+
+    records[part]++;
+
+    // a new part starts here once past its share of the file
+    while (part + 1 < nparts && p < last &&
+           (size_t) (p - data) >= (size_t) ((double) size * (part + 1) / nparts))
+    {
+      bounds[++part] = p;
+      records[part] = 0;
+    }
+  }
+
+  // parts left without data are empty
+  while (part + 1 <= nparts)
+    bounds[++part] = last;
+}
+
+/*
+ * Runs a command in blocking mode, returns false on error
+ */
+static bool
+loader_command(PGconn *conn, const char *command)
+{
+  PGresult *res = PQexec(conn, command);
+  bool      ok = PQresultStatus(res) == PGRES_COMMAND_OK ||
+                 PQresultStatus(res) == PGRES_TUPLES_OK;
+
+  if (!ok)
+    pg_log_error("%s failed: %s", command, PQerrorMessage(conn));
+  PQclear(res);
+
+  return ok;
+}
+
+/*
+ * Returns the number of rows of the table, -1 on error
+ */
+static int64
+count_rows(PGconn *conn, const char *table)
+{
+  PGresult *res;
+  char     *query = psprintf("SELECT count(*) FROM %s", table);
+  int64     count = -1;
+
+  res = PQexec(conn, query);
+  if (PQresultStatus(res) == PGRES_TUPLES_OK)
+    count = strtoll(PQgetvalue(res, 0, 0), NULL, 10);
+  else
+    pg_log_error("could not count rows of %s: %s", table, PQerrorMessage(conn));
+
+  PQclear(res);
+  pg_free(query);
+
+  return count;
+}
+
+/*
+ * Moves a connection forward as far as possible without blocking. Returns
+ * false on a connection failure.
+ */
+static bool
+loader_step(LoaderConnection *lc)
+{
+  PGresult *res;
+  int       rc;
+
+  // The server may already have complained, keep its messages
+  if (!PQconsumeInput(lc->conn))
+  {
+    pg_log_error("could not read from server: %s", PQerrorMessage(lc->conn));
+    return false;
+  }
+
+  if (lc->phase == LOADER_COPYING)
+  {
+    // libpq grows its buffer rather than refusing data: the previous chunk
+    // must be sent before the next one is put, or the whole part would be
+    // copied in memory. A full socket waits for POLLOUT, then resumes here.
+    while (lc->pos < lc->end)
+    {
+      size_t  n = Min(LOADER_CHUNK_SIZE, lc->end - lc->pos);
+
+      rc = PQflush(lc->conn);
+      if (rc < 0)
+      {
+        pg_log_error("could not send data: %s", PQerrorMessage(lc->conn));
+        return false;
+      }
+      if (rc == 1)
+        break;
+
+      rc = PQputCopyData(lc->conn, lc->pos, (int) n);
+      if (rc < 0)
+      {
+        pg_log_error("could not send data: %s", PQerrorMessage(lc->conn));
+        return false;
+      }
+      if (rc == 0)
+        break;            // libpq could not grow its buffer, try again later
+      lc->pos += n;
+    }
+
+    if (lc->pos == lc->end)
+      lc->phase = LOADER_ENDING;
+  }
+
+  if (lc->phase == LOADER_ENDING)
+  {
+    rc = PQputCopyEnd(lc->conn, NULL);
+    if (rc < 0)
+    {
+      pg_log_error("could not end COPY: %s", PQerrorMessage(lc->conn));
+      return false;
+    }
+    if (rc == 1)
+      lc->phase = LOADER_WAITING;
+  }
+
+  rc = PQflush(lc->conn);
+  if (rc < 0)
+  {
+    pg_log_error("could not send data: %s", PQerrorMessage(lc->conn));
+    return false;
+  }
+  lc->flushing = rc == 1;
+
+  if (lc->phase != LOADER_WAITING || lc->flushing)
+    return true;
+
+  while (!PQisBusy(lc->conn))
+  {
+    res = PQgetResult(lc->conn);
+    if (!res)
+    {
+      lc->phase = LOADER_DONE;
+      break;
+    }
+
+    if (PQresultStatus(res) == PGRES_COMMAND_OK)
+      lc->loaded += strtoll(PQcmdTuples(res), NULL, 10);
+    else
+    {
+      pg_log_error("COPY failed: %s", PQresultErrorMessage(res));
+      lc->failed = true;
+    }
+    PQclear(res);
+  }
+
+  return true;
+}
+
+/*
+ * Loads options->file in options->table with COPY FROM STDIN, on
+ * options->connections connections at once, each one loading its part of
+ * the file. The file is mapped in memory and sent as it is.
+ *
+ * With options->transaction, each COPY runs in a transaction, committed
+ * only if all parts were loaded, rolled back otherwise. This is not a
+ * two-phase commit: a failure during the commits themselves can still
+ * leave only some parts loaded.
+ *
+ * Returns 0 when everything was loaded.
+ */
+int
+run_loader(const char *conninfo, LoaderOptions *options)
+{
+  LoaderConnection *conns;
+  const char **bounds;
+  int64      *records;
+  struct pollfd *fds;
+  int        *polled;
+  struct stat st;
+  char       *data;
+  int         fd;
+  int         nconns = options->connections;
+  int         result = 1;
+  int         remaining;
+  int64       total_records = 0;
+  int64       total_loaded = 0;
+  int64       before = -1;
+  int64       after;
+  bool        failed = false;
+  instr_time  start;
+  instr_time  now;
+  double      elapsed;
+  char       *copy = NULL;
+
+  fd = open(options->file, O_RDONLY | PG_BINARY, 0);
+  if (fd < 0)
+    pg_fatal("could not open file \"%s\": %m", options->file);
+  if (fstat(fd, &st) < 0)
+    pg_fatal("could not stat file \"%s\": %m", options->file);
+  if (st.st_size == 0)
+    pg_fatal("file \"%s\" is empty", options->file);
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED)
+    pg_fatal("could not map file \"%s\": %m", options->file);
+  close(fd);
+  (void) madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+  conns = pg_malloc0(nconns * sizeof(LoaderConnection));
+  bounds = pg_malloc((nconns + 1) * sizeof(char *));
+  records = pg_malloc(nconns * sizeof(int64));
+  fds = pg_malloc(nconns * sizeof(struct pollfd));
+  polled = pg_malloc(nconns * sizeof(int));
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  scan_records(data, st.st_size, options->csv, options->header, nconns,
+               bounds, records);
+
+  copy = psprintf("COPY %s FROM STDIN WITH (FORMAT %s)", options->table,
+                  options->csv ? "csv" : "text");
+
+  // Opening connections, one COPY each
+  for (int i = 0; i < nconns; i++)
+  {
+    LoaderConnection *lc = &conns[i];
+    PGresult *res;
+
+    lc->start = lc->pos = bounds[i];
+    lc->end = bounds[i + 1];
+    lc->records = records[i];
+    total_records += records[i];
+
+    lc->conn = PQconnectdb(conninfo);
+    if (PQstatus(lc->conn) == CONNECTION_BAD)
+    {
+      pg_log_error("could not connect: %s", PQerrorMessage(lc->conn));
+      goto done;
+    }
+
+    if (i == 0 && options->check)
+    {
+      before = count_rows(lc->conn, options->table);
+      if (before < 0)
+        goto done;
+    }
+
+    if (options->transaction && !loader_command(lc->conn, "BEGIN"))
+      goto done;
+
+    res = PQexec(lc->conn, copy);
+    if (PQresultStatus(res) != PGRES_COPY_IN)
+    {
+      pg_log_error("could not start COPY: %s", PQerrorMessage(lc->conn));
+      PQclear(res);
+      goto done;
+    }
+    PQclear(res);
+
+    if (PQsetnonblocking(lc->conn, 1) != 0)
+    {
+      pg_log_error("could not set non-blocking mode: %s",
+                   PQerrorMessage(lc->conn));
+      goto done;
+    }
+
+    pg_log_debug("connection %d: " INT64_FORMAT " bytes, " INT64_FORMAT " records",
+                 i, (int64) (lc->end - lc->start), lc->records);
+  }
+
+  // Streaming all parts at once
+  remaining = nconns;
+  while (remaining > 0)
+  {
+    int     npolled = 0;
+
+    remaining = 0;
+    for (int i = 0; i < nconns; i++)
+    {
+      LoaderConnection *lc = &conns[i];
+
+      if (lc->phase == LOADER_DONE)
+        continue;
+
+      if (!loader_step(lc))
+        goto done;
+
+      if (lc->phase == LOADER_DONE)
+        continue;
+
+      remaining++;
+      fds[npolled].fd = PQsocket(lc->conn);
+      fds[npolled].events = POLLIN;
+      if (lc->flushing || lc->phase != LOADER_WAITING)
+        fds[npolled].events |= POLLOUT;
+      fds[npolled].revents = 0;
+      polled[npolled++] = i;
+    }
+
+    if (npolled > 0 && poll(fds, npolled, -1) < 0 && errno != EINTR)
+    {
+      pg_log_error("poll() failed: %m");
+      goto done;
+    }
+  }
+
+  for (int i = 0; i < nconns; i++)
+  {
+    PQsetnonblocking(conns[i].conn, 0);
+    total_loaded += conns[i].loaded;
+    if (conns[i].failed)
+      failed = true;
+  }
+
+  if (options->transaction)
+  {
+    for (int i = 0; i < nconns; i++)
+      if (!loader_command(conns[i].conn, failed ? "ROLLBACK" : "COMMIT"))
+        failed = true;
+    if (failed)
+      total_loaded = 0;
+  }
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  elapsed = INSTR_TIME_GET_DOUBLE(now);
+
+  printf("records: " INT64_FORMAT " found, " INT64_FORMAT " loaded, on %d connections%s\n",
+         total_records, total_loaded, nconns,
+         failed ? (options->transaction ? ", rolled back" : ", some failed") : "");
+  printf("total time: %.3f s, throughput: %.1f rows/s, %.1f MB/s\n",
+         elapsed, elapsed > 0 ? total_loaded / elapsed : 0,
+         elapsed > 0 ? st.st_size / elapsed / (1024 * 1024) : 0);
+
+  if (!failed && total_loaded != total_records)
+  {
+    pg_log_error("COPY loaded " INT64_FORMAT " rows, the file holds " INT64_FORMAT " records",
+                 total_loaded, total_records);
+    failed = true;
+  }
+
+  // Final check, meaningful only without concurrent writes on the table
+  if (options->check)
+  {
+    after = count_rows(conns[0].conn, options->table);
+    if (after < 0)
+      failed = true;
+    else if (after - before != total_loaded)
+    {
+      pg_log_error("table %s gained " INT64_FORMAT " rows, " INT64_FORMAT " expected",
+                   options->table, after - before, total_loaded);
+      failed = true;
+    }
+    else
+      printf("check: table %s gained " INT64_FORMAT " rows\n",
+             options->table, after - before);
+  }
+
+  result = failed ? 1 : 0;
+
+done:
+  for (int i = 0; i < nconns; i++)
+    if (conns[i].conn)
+      PQfinish(conns[i].conn);
+
+  munmap(data, st.st_size);
+  pg_free(copy);
+  pg_free(conns);
+  pg_free(bounds);
+  pg_free(records);
+  pg_free(fds);
+  pg_free(polled);
+
+  return result;
+}
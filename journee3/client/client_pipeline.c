@@ -0,0 +1,202 @@
+/*
+ * client_pipeline.c, pipeline mode for client
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "portability/instr_time.h"
+
+#include "client.h"
+
+/*
+ * Sends "total" queries through the pipeline, keeping up to "depth" of them
+ * in flight and asking for a synchronisation point every "sync_every"
+ * queries. Queries of the list are used in turn.
+ *
+ * Results come back in the order the queries were sent, so the send time of
+ * each in-flight query is kept in a ring of "depth" slots. When the pipeline
+ * is full before the next sync, a flush request makes the server send the
+ * results it already has, otherwise both sides would wait for each other.
+ *
+ * Returns the number of failed queries, -1 if the pipeline itself failed.
+ */
+int
+run_pipeline(PGconn *conn, QueryList *list, int depth, int sync_every,
+             int64 total)
+{
+  instr_time *sent_at;
+  instr_time  start;
+  instr_time  now;
+  int64       sent = 0;
+  int64       received = 0;
+  int64       errors = 0;
+  int64       aborted = 0;
+  int         since_sync = 0;
+  int         syncs_pending = 0;
+  int         syncs = 0;
+  bool        flush_requested = false;
+  double      latency;
+  double      latency_min = 0;
+  double      latency_max = 0;
+  double      latency_sum = 0;
+  double      elapsed;
+
+  if (!PQenterPipelineMode(conn))
+  {
+    pg_log_error("could not enter pipeline mode: %s", PQerrorMessage(conn));
+    return -1;
+  }
+
+  // Never block on send, results are read while sending
+  if (PQsetnonblocking(conn, 1) != 0)
+  {
+    pg_log_error("could not set non-blocking mode: %s", PQerrorMessage(conn));
+    return -1;
+  }
+
+  sent_at = pg_malloc(depth * sizeof(instr_time));
+
+  pg_log_debug("pipeline mode, %d queries in flight, sync every %d queries",
+               depth, sync_every);
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  while (received < total || syncs_pending > 0)
+  {
+    int   flush;
+
+    // Fill the pipeline
+    while (sent < total && sent - received < depth)
+    {
+      // send_query() never uses PQsendQuery in pipeline mode
+      if (!send_query(conn, list, sent))
+      {
+        pg_log_error("could not send query: %s", PQerrorMessage(conn));
+        pg_free(sent_at);
+        return -1;
+      }
+      INSTR_TIME_SET_CURRENT(sent_at[sent % depth]);
+      sent++;
+      flush_requested = false;
+
+      if (++since_sync == sync_every || sent == total)
+      {
+        if (!PQpipelineSync(conn))
+        {
+          pg_log_error("could not send sync: %s", PQerrorMessage(conn));
+          pg_free(sent_at);
+          return -1;
+        }
+        since_sync = 0;
+        syncs_pending++;
+      }
+    }
+
+    // Full pipeline without a sync (sync_every > depth)
+    if (since_sync > 0 && sent - received >= depth && !flush_requested)
+    {
+      if (!PQsendFlushRequest(conn))
+      {
+        pg_log_error("could not send flush request: %s", PQerrorMessage(conn));
+        pg_free(sent_at);
+        return -1;
+      }
+      flush_requested = true;
+    }
+
+    flush = PQflush(conn);
+    if (flush < 0)
+    {
+      pg_log_error("could not send data: %s", PQerrorMessage(conn));
+      pg_free(sent_at);
+      return -1;
+    }
+
+    // Wait for results, or for room to send the rest
+    if (!wait_for_socket(conn, flush == 1, -1))
+    {
+      pg_free(sent_at);
+      return -1;
+    }
+
+    if (!PQconsumeInput(conn))
+    {
+      pg_log_error("could not read results: %s", PQerrorMessage(conn));
+      pg_free(sent_at);
+      return -1;
+    }
+
+    // Read all results already received
+    while ((received < sent || syncs_pending > 0) && !PQisBusy(conn))
+    {
+      PGresult *res = PQgetResult(conn);
+
+      // NULL ends the results of one query
+      if (!res)
+        continue;
+
+      switch (PQresultStatus(res))
+      {
+        case PGRES_PIPELINE_SYNC:
+          syncs_pending--;
+          syncs++;
+          break;
+
+        case PGRES_PIPELINE_ABORTED:
+          // an earlier query of this sync block failed
+          aborted++;
+          received++;
+          break;
+
+        case PGRES_FATAL_ERROR:
+          pg_log_error("query failed: %s", PQresultErrorMessage(res));
+          errors++;
+          received++;
+          break;
+
+        default:
+          INSTR_TIME_SET_CURRENT(now);
+          INSTR_TIME_SUBTRACT(now, sent_at[received % depth]);
+          latency = INSTR_TIME_GET_MILLISEC(now);
+
+          if (received - errors - aborted == 0 || latency < latency_min)
+            latency_min = latency;
+          if (latency > latency_max)
+            latency_max = latency;
+          latency_sum += latency;
+          received++;
+          break;
+      }
+
+      PQclear(res);
+    }
+  }
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  elapsed = INSTR_TIME_GET_DOUBLE(now);
+
+  pg_free(sent_at);
+
+  if (!PQexitPipelineMode(conn))
+    pg_log_warning("could not exit pipeline mode: %s", PQerrorMessage(conn));
+  PQsetnonblocking(conn, 0);
+
+  printf("queries: " INT64_FORMAT " (" INT64_FORMAT " failed, " INT64_FORMAT " aborted), syncs: %d\n",
+         received, errors, aborted, syncs);
+  printf("total time: %.3f s, throughput: %.1f queries/s\n",
+         elapsed, elapsed > 0 ? received / elapsed : 0);
+  if (received - errors - aborted > 0)
+    printf("latency (ms): min %.3f, avg %.3f, max %.3f\n",
+           latency_min, latency_sum / (received - errors - aborted),
+           latency_max);
+
+  return (int) (errors + aborted);
+}
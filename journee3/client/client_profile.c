@@ -0,0 +1,420 @@
+/*
+ * client_profile.c, profiles queries at the protocol level
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <limits.h>
+#include <sys/time.h>
+#include <time.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+
+#include "client.h"
+
+// Where the time of one query went, in microseconds
+typedef enum ProfilePhase
+{
+  PHASE_SEND,         // building and writing the query
+  PHASE_NETWORK,      // round trip of an empty query
+  PHASE_SERVER,       // rest of the wait for the first byte
+  PHASE_RECEIVE,      // reading and parsing messages in libpq
+  PHASE_CLIENT,       // looking at the results
+  PHASE_COUNT
+} ProfilePhase;
+
+static const char *const phase_names[PHASE_COUNT] = {
+  "send", "network", "server", "receive", "client"
+};
+
+// Everything measured on one query of the list
+typedef struct ProfileStats
+{
+  int64       runs;
+  int64       failed;
+  double      phases[PHASE_COUNT];
+  Histogram   total;
+  Histogram   first_byte;
+  Histogram   first_row;
+  Histogram   between_batches;  // from one batch of rows to the next
+  int64       batches;
+  int64       rows;
+  int64       bytes_in;
+  int64       bytes_out;
+  int64       messages_in;
+} ProfileStats;
+
+// What the trace of one run tells
+typedef struct TraceSummary
+{
+  int64       first_row;      // first DataRow, 0 if none
+  int64       bytes_in;
+  int64       bytes_out;
+  int64       messages_in;
+} TraceSummary;
+
+/*
+ * Wall clock time in microseconds. libpq timestamps trace lines with
+ * gettimeofday(), so the profile uses the same clock.
+ */
+static int64
+now_usec(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return (int64) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+/*
+ * Reads back a trace written by PQtrace(). Each message is a line:
+ * "YYYY-MM-DD HH:MM:SS.uuuuuu<TAB>F|B<TAB>length<TAB>type ...", the length
+ * counting everything but the type byte.
+ */
+static void
+read_trace(FILE *trace, TraceSummary *summary)
+{
+  char        line[8192];
+  char        last_second[20] = "";
+  int64       seconds = 0;
+  bool        at_start = true;
+
+  memset(summary, 0, sizeof(TraceSummary));
+  rewind(trace);
+
+  while (fgets(line, sizeof(line), trace))
+  {
+    bool        line_start = at_start;
+    char       *field;
+    char        direction;
+    int         length;
+    int         usec;
+
+    // long DataRow lines come in several pieces
+    at_start = strchr(line, '\n') != NULL;
+    if (!line_start || strlen(line) < 28 || line[19] != '.')
+      continue;
+
+    field = strchr(line, '\t');
+    if (!field || sscanf(field, "\t%c\t%d", &direction, &length) != 2)
+      continue;
+    usec = atoi(line + 20);
+
+    if (direction == 'F')
+    {
+      summary->bytes_out += length + 1;
+      continue;
+    }
+
+    summary->bytes_in += length + 1;
+    summary->messages_in++;
+
+    if (summary->first_row > 0 || !strstr(field, "\tDataRow"))
+      continue;
+
+    // mktime() is slow, lines of the same second share it
+    if (strncmp(line, last_second, 19) != 0)
+    {
+      struct tm   tm = {0};
+
+      if (sscanf(line, "%d-%d-%d %d:%d:%d", &tm.tm_year, &tm.tm_mon,
+                 &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec) != 6)
+        continue;
+      tm.tm_year -= 1900;
+      tm.tm_mon -= 1;
+      tm.tm_isdst = -1;
+      seconds = (int64) mktime(&tm);
+      memcpy(last_second, line, 19);
+      last_second[19] = '\0';
+    }
+    summary->first_row = seconds * 1000000 + usec;
+  }
+}
+
+/*
+ * Waits for the first byte of the answer to the query just sent. Returns
+ * its time, or 0 on failure.
+ */
+static int64
+wait_first_byte(PGconn *conn)
+{
+  if (PQflush(conn) != 0 || !wait_for_socket(conn, false, -1))
+    return 0;
+  return now_usec();
+}
+
+/*
+ * Smallest round trip of an empty query: close to the network latency, as
+ * the server has nothing to do but answer.
+ */
+static int64
+measure_round_trip(PGconn *conn)
+{
+  int64       best = -1;
+
+  for (int i = 0; i < 5; i++)
+  {
+    PGresult   *res;
+    int64       sent;
+    int64       received;
+
+    if (!PQsendQuery(conn, ""))
+      return 0;
+    sent = now_usec();
+    received = wait_first_byte(conn);
+
+    while ((res = PQgetResult(conn)))
+      PQclear(res);
+
+    if (received > 0 && (best < 0 || received - sent < best))
+      best = received - sent;
+  }
+
+  return Max(best, 0);
+}
+
+/*
+ * Runs query "n" of the list once, traced, and adds its timings to "stats".
+ */
+static void
+profile_query(PGconn *conn, QueryList *list, int64 n, int chunk,
+              int64 round_trip, ProfileStats *stats)
+{
+  FILE       *trace;
+  TraceSummary summary;
+  PGresult   *res;
+  int64       start;
+  int64       sent;
+  int64       first_byte;
+  int64       done;
+  int64       client = 0;
+  int64       previous_batch = 0;
+  int64       wait;
+  bool        failed = false;
+
+  trace = tmpfile();
+  if (!trace)
+    pg_fatal("could not create trace file: %m");
+
+  PQtrace(conn, trace);
+  PQsetTraceFlags(conn, 0);
+
+  start = now_usec();
+  if (!send_query(conn, list, n))
+  {
+    pg_log_error("could not send query: %s", PQerrorMessage(conn));
+    PQuntrace(conn);
+    fclose(trace);
+    stats->failed++;
+    return;
+  }
+  sent = now_usec();
+
+  (void) set_row_mode(conn, chunk);
+
+  first_byte = wait_first_byte(conn);
+  if (first_byte == 0)
+    first_byte = sent;
+
+  while (true)
+  {
+    int64       returned;
+
+    // wait in libpq until a whole result is there
+    while (PQisBusy(conn))
+    {
+      if (!wait_for_socket(conn, false, -1) || !PQconsumeInput(conn))
+        break;
+    }
+
+    res = PQgetResult(conn);
+    if (!res)
+      break;
+    returned = now_usec();
+
+    if (PQresultStatus(res) == PGRES_FATAL_ERROR)
+    {
+      pg_log_error("query failed: %s", PQresultErrorMessage(res));
+      failed = true;
+    }
+
+    // Like a consumer, look at every value
+    for (int ligne = 0 ; ligne < PQntuples(res) ; ligne++)
+      for (int colonne = 0 ; colonne < PQnfields(res) ; colonne++)
+        (void) PQgetlength(res, ligne, colonne);
+
+    if (PQresultStatus(res) == PGRES_TUPLES_OK ||
+        PQresultStatus(res) == PGRES_SINGLE_TUPLE
+#ifdef LIBPQ_HAS_CHUNK_MODE
+        || PQresultStatus(res) == PGRES_TUPLES_CHUNK
+#endif
+      )
+    {
+      stats->batches++;
+      stats->rows += PQntuples(res);
+
+      // the client time of the previous batch counts, as it delays this one
+      if (previous_batch > 0)
+        hist_record(&stats->between_batches, returned - previous_batch);
+      previous_batch = returned;
+    }
+
+    PQclear(res);
+    client += now_usec() - returned;
+  }
+  done = now_usec();
+
+  PQuntrace(conn);
+  read_trace(trace, &summary);
+  fclose(trace);
+
+  if (failed)
+    stats->failed++;
+
+  wait = first_byte - sent;
+  stats->phases[PHASE_SEND] += sent - start;
+  stats->phases[PHASE_NETWORK] += Min(wait, round_trip);
+  stats->phases[PHASE_SERVER] += wait - Min(wait, round_trip);
+  stats->phases[PHASE_RECEIVE] += done - first_byte - client;
+  stats->phases[PHASE_CLIENT] += client;
+
+  hist_record(&stats->total, done - start);
+  hist_record(&stats->first_byte, first_byte - start);
+  if (summary.first_row > 0)
+    hist_record(&stats->first_row, Max(summary.first_row - start, 0));
+
+  stats->bytes_in += summary.bytes_in;
+  stats->bytes_out += summary.bytes_out;
+  stats->messages_in += summary.messages_in;
+  stats->runs++;
+}
+
+/*
+ * One line per query and phase, "frame;frame count" as read by
+ * flamegraph.pl and speedscope. Semicolons of the query would split the
+ * frame, they become commas.
+ */
+static void
+write_folded(FILE *file, QueryList *list, ProfileStats *stats)
+{
+  for (int i = 0; i < list->count; i++)
+  {
+    char       *frame = psprintf("query %d: %.60s", i + 1, list->queries[i]);
+
+    for (char *p = frame; *p; p++)
+      if (*p == ';' || *p == '\n' || *p == '\t')
+        *p = *p == ';' ? ',' : ' ';
+
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+      if (stats[i].phases[phase] > 0)
+        fprintf(file, "%s;%s %.0f\n", frame, phase_names[phase],
+                stats[i].phases[phase]);
+
+    pg_free(frame);
+  }
+}
+
+/*
+ * Runs each query of the list "runs" times, traced with PQtrace(), and
+ * reports where the time went: sending, network, server, libpq reading
+ * the answer, and the client looking at it.
+ *
+ * The wait between the end of the send and the first byte of the answer is
+ * split between network and server using the round trip of an empty query,
+ * measured first. Time to first row comes from the first DataRow of the
+ * trace, time between batches from the returns of PQgetResult(). Tracing
+ * itself costs time while reading large results, counted in the receive
+ * phase.
+ *
+ * With "output", the phases are also written there in the folded format of
+ * flame graphs, in microseconds.
+ *
+ * Returns the number of failed runs.
+ */
+int
+run_profile(PGconn *conn, QueryList *list, int runs, int chunk,
+            const char *output)
+{
+  ProfileStats *stats;
+  int64       round_trip;
+  int64       failed = 0;
+
+  stats = pg_malloc0(list->count * sizeof(ProfileStats));
+  for (int i = 0; i < list->count; i++)
+  {
+    hist_reset(&stats[i].total);
+    hist_reset(&stats[i].first_byte);
+    hist_reset(&stats[i].first_row);
+    hist_reset(&stats[i].between_batches);
+  }
+
+  round_trip = measure_round_trip(conn);
+  printf("network round trip: %.3f ms\n\n", round_trip / 1000.0);
+
+  for (int64 n = 0; n < (int64) runs * list->count; n++)
+    profile_query(conn, list, n, chunk, round_trip, &stats[n % list->count]);
+
+  for (int i = 0; i < list->count; i++)
+  {
+    ProfileStats *s = &stats[i];
+    double      runs_done = Max(s->runs, 1);
+
+    printf("query %d: %s\n", i + 1, list->queries[i]);
+    printf("  runs: " INT64_FORMAT ", failed: " INT64_FORMAT "\n",
+           s->runs, s->failed);
+    failed += s->failed;
+    if (s->runs == 0)
+      continue;
+
+    printf("  latency (ms):              mean %.3f, p50 %.3f, p99 %.3f\n",
+           hist_mean(&s->total) / 1000.0,
+           hist_percentile(&s->total, 50) / 1000.0,
+           hist_percentile(&s->total, 99) / 1000.0);
+    printf("  time to first byte (ms):   mean %.3f, p50 %.3f, p99 %.3f\n",
+           hist_mean(&s->first_byte) / 1000.0,
+           hist_percentile(&s->first_byte, 50) / 1000.0,
+           hist_percentile(&s->first_byte, 99) / 1000.0);
+    if (s->first_row.total > 0)
+      printf("  time to first row (ms):    mean %.3f, p50 %.3f, p99 %.3f\n",
+             hist_mean(&s->first_row) / 1000.0,
+             hist_percentile(&s->first_row, 50) / 1000.0,
+             hist_percentile(&s->first_row, 99) / 1000.0);
+    if (s->between_batches.total > 0)
+      printf("  time between batches (ms): mean %.3f, p50 %.3f, p99 %.3f\n",
+             hist_mean(&s->between_batches) / 1000.0,
+             hist_percentile(&s->between_batches, 50) / 1000.0,
+             hist_percentile(&s->between_batches, 99) / 1000.0);
+
+    printf("  phases (mean ms):         ");
+    for (int phase = 0; phase < PHASE_COUNT; phase++)
+      printf(" %s %.3f%s", phase_names[phase],
+             s->phases[phase] / runs_done / 1000.0,
+             phase < PHASE_COUNT - 1 ? "," : "\n");
+
+    printf("  per run:                   %.1f batches, %.1f rows, %.0f bytes "
+           "received in %.1f messages, %.0f bytes sent\n",
+           s->batches / runs_done, s->rows / runs_done,
+           s->bytes_in / runs_done, s->messages_in / runs_done,
+           s->bytes_out / runs_done);
+  }
+
+  if (output)
+  {
+    FILE       *file = fopen(output, "w");
+
+    if (!file)
+      pg_fatal("could not open file \"%s\": %m", output);
+    write_folded(file, list, stats);
+    if (fclose(file) != 0)
+      pg_fatal("could not write file \"%s\": %m", output);
+  }
+
+  pg_free(stats);
+
+  return (int) Min(failed, INT_MAX);
+}
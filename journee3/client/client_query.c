@@ -0,0 +1,504 @@
+/*
+ * client_query.c, sending queries and printing their results
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <arpa/inet.h>
+#include "postgres_fe.h"
+#include "catalog/pg_type_d.h"
+#include "common/logging.h"
+#include "common/string.h"
+
+#include "client.h"
+
+// Same epoch as the server, for dates and timestamps
+#define POSTGRES_EPOCH_JDATE  2451545
+#define USECS_PER_DAY         INT64CONST(86400000000)
+
+// Binary numeric signs
+#define NUMERIC_POS           0x0000
+#define NUMERIC_NEG           0x4000
+#define NUMERIC_NAN           0xC000
+#define NUMERIC_PINF          0xD000
+#define NUMERIC_NINF          0xF000
+
+static void print_binary_value(const char *value, int length, Oid type);
+
+/*
+ * Reads parameter values from a file: one set of parameters per line,
+ * values separated by tabulations, \N for NULL. Every line must have
+ * list->nparams values, or as many values as the first line if it is 0.
+ */
+void
+read_params(const char *filename, QueryList *list)
+{
+  FILE     *file;
+  char      line[8192];
+  int       allocated = 16;
+
+  file = fopen(filename, "r");
+  if (!file)
+    pg_fatal("could not open file \"%s\": %m", filename);
+
+  list->param_sets = pg_malloc(allocated * sizeof(char **));
+  list->nsets = 0;
+
+  while (fgets(line, sizeof(line), file))
+  {
+    char  **values;
+    char   *field;
+    char   *next;
+    int     nvalues = 0;
+
+    (void) pg_strip_crlf(line);
+    if (line[0] == '\0')
+      continue;
+
+    // Without types, the first line gives the number of parameters
+    if (list->nparams == 0)
+    {
+      list->nparams = 1;
+      for (char *p = line; *p; p++)
+        if (*p == '\t')
+          list->nparams++;
+    }
+
+    values = pg_malloc(list->nparams * sizeof(char *));
+
+    for (field = line; field; field = next)
+    {
+      next = strchr(field, '\t');
+      if (next)
+        *next++ = '\0';
+
+      if (nvalues == list->nparams)
+        pg_fatal("too many parameters on line %d of file \"%s\" (expected %d)",
+                 list->nsets + 1, filename, list->nparams);
+
+      values[nvalues++] = strcmp(field, "\\N") == 0 ? NULL : pg_strdup(field);
+    }
+
+    if (nvalues != list->nparams)
+      pg_fatal("%d parameters on line %d of file \"%s\" (expected %d)",
+               nvalues, list->nsets + 1, filename, list->nparams);
+
+    if (list->nsets == allocated)
+    {
+      allocated *= 2;
+      list->param_sets = pg_realloc(list->param_sets, allocated * sizeof(char **));
+    }
+    list->param_sets[list->nsets++] = values;
+  }
+
+  fclose(file);
+
+  if (list->nsets == 0)
+    pg_fatal("no parameters found in file \"%s\"", filename);
+
+  pg_log_debug("%d parameter sets read from \"%s\"", list->nsets, filename);
+}
+
+/*
+ * Resolves parameter type names ("int4", "timestamptz", ...) to OIDs, using
+ * the server so that any type can be used.
+ */
+bool
+resolve_param_types(PGconn *conn, QueryList *list, char **type_names)
+{
+  for (int i = 0; i < list->nparams; i++)
+  {
+    PGresult   *res;
+    const char *values[1] = {type_names[i]};
+
+    res = PQexecParams(conn, "SELECT $1::regtype::oid",
+                       1, NULL, values, NULL, NULL, 0);
+    if (PQresultStatus(res) != PGRES_TUPLES_OK)
+    {
+      pg_log_error("unknown type \"%s\": %s", type_names[i], PQerrorMessage(conn));
+      PQclear(res);
+      return false;
+    }
+
+    list->param_types[i] = (Oid) strtoul(PQgetvalue(res, 0, 0), NULL, 10);
+    PQclear(res);
+  }
+
+  return true;
+}
+
+/*
+ * Prepares every query of the list, once, as "client_<number>".
+ */
+bool
+prepare_queries(PGconn *conn, QueryList *list)
+{
+  for (int i = 0; i < list->count; i++)
+  {
+    PGresult *res;
+    char      name[32];
+
+    snprintf(name, sizeof(name), "client_%d", i);
+
+    res = PQprepare(conn, name, list->queries[i], list->nparams,
+                    list->param_types);
+    if (PQresultStatus(res) != PGRES_COMMAND_OK)
+    {
+      pg_log_error("could not prepare \"%s\": %s",
+                   list->queries[i], PQerrorMessage(conn));
+      PQclear(res);
+      return false;
+    }
+    PQclear(res);
+  }
+
+  list->prepared = true;
+  pg_log_debug("%d statements prepared", list->count);
+
+  return true;
+}
+
+/*
+ * Sends the n-th query: queries and parameter sets of the list are used in
+ * turn. Without parameters, prepared statements or binary results, the
+ * simple protocol is used, so that a query may hold several statements.
+ */
+int
+send_query(PGconn *conn, QueryList *list, int64 n)
+{
+  int           query = n % list->count;
+  const char  **values = NULL;
+
+  if (list->nsets > 0)
+    values = (const char **) list->param_sets[n % list->nsets];
+
+  if (list->prepared)
+  {
+    char    name[32];
+
+    snprintf(name, sizeof(name), "client_%d", query);
+    return PQsendQueryPrepared(conn, name, list->nparams, values,
+                               NULL, NULL, list->result_format);
+  }
+
+  if (list->nparams == 0 && list->result_format == 0 &&
+      PQpipelineStatus(conn) == PQ_PIPELINE_OFF)
+    return PQsendQuery(conn, list->queries[query]);
+
+  return PQsendQueryParams(conn, list->queries[query], list->nparams,
+                           list->param_types, values, NULL, NULL,
+                           list->result_format);
+}
+
+/*
+ * Chooses how the rows of the query just sent come back: all at once
+ * (chunk 0), one PGresult per row (chunk 1, single-row mode) or one
+ * PGresult per "chunk" rows. Chunked rows mode appeared in libpq 17, older
+ * versions fall back to single-row mode.
+ */
+int
+set_row_mode(PGconn *conn, int chunk)
+{
+  if (chunk == 0)
+    return 1;
+
+#ifdef LIBPQ_HAS_CHUNK_MODE
+  if (chunk > 1)
+    return PQsetChunkedRowsMode(conn, chunk);
+#else
+  if (chunk > 1)
+  {
+    static bool warned = false;
+
+    if (!warned)
+      pg_log_warning("chunked rows mode needs libpq 17, using single-row mode");
+    warned = true;
+  }
+#endif
+
+  return PQsetSingleRowMode(conn);
+}
+
+/*
+ * Rows per PGresult that set_row_mode() really asks for, given "chunk".
+ */
+int
+row_mode_chunk(int chunk)
+{
+#ifndef LIBPQ_HAS_CHUNK_MODE
+  if (chunk > 1)
+    return 1;
+#endif
+
+  return chunk;
+}
+
+/*
+ * Prints every row of a result, "value - value - ..." like before.
+ */
+void
+print_result(PGresult *res)
+{
+  for (int ligne = 0 ; ligne < PQntuples(res) ; ligne++)
+  {
+    for (int colonne = 0 ; colonne < PQnfields(res) ; colonne++)
+    {
+      if (PQgetisnull(res, ligne, colonne))
+        printf("NULL");
+      else if (PQfformat(res, colonne) == 1)
+        print_binary_value(PQgetvalue(res, ligne, colonne),
+                           PQgetlength(res, ligne, colonne),
+                           PQftype(res, colonne));
+      else
+        printf("%s", PQgetvalue(res, ligne, colonne));
+      printf(" - ");
+    }
+    printf("\n");
+  }
+}
+
+/*
+ * Network order readers
+ */
+static uint16
+read_uint16(const char *value)
+{
+  uint16    n;
+
+  memcpy(&n, value, sizeof(n));
+  return ntohs(n);
+}
+
+static uint32
+read_uint32(const char *value)
+{
+  uint32    n;
+
+  memcpy(&n, value, sizeof(n));
+  return ntohl(n);
+}
+
+static uint64
+read_uint64(const char *value)
+{
+  return ((uint64) read_uint32(value) << 32) | read_uint32(value + 4);
+}
+
+/*
+ * Julian day to date, as done by the server (src/backend/utils/adt/datetime.c)
+ */
+static void
+j2date(int jd, int *year, int *month, int *day)
+{
+  unsigned int julian;
+  unsigned int quad;
+  unsigned int extra;
+  int          y;
+
+  julian = jd;
+  julian += 32044;
+  quad = julian / 146097;
+  extra = (julian - quad * 146097) * 4 + 3;
+  julian += 60 + quad * 3 + extra / 146097;
+  quad = julian / 1461;
+  julian -= quad * 1461;
+  y = julian * 4 / 1461;
+  julian = ((y != 0) ? ((julian + 305) % 365) : ((julian + 306) % 366))
+    + 123;
+  y += quad * 4;
+  *year = y - 4800;
+  quad = julian * 2141 / 65536;
+  *day = julian - 7834 * quad / 256;
+  *month = (quad + 10) % 12 + 1;
+}
+
+/*
+ * Binary numeric: sign, weight and display scale, then base 10000 digits
+ */
+static void
+print_binary_numeric(const char *value)
+{
+  int16   ndigits = (int16) read_uint16(value);
+  int16   weight = (int16) read_uint16(value + 2);
+  uint16  sign = read_uint16(value + 4);
+  int16   dscale = (int16) read_uint16(value + 6);
+  const char *digits = value + 8;
+  char    fraction[16];
+
+  switch (sign)
+  {
+    case NUMERIC_NAN:
+      printf("NaN");
+      return;
+    case NUMERIC_PINF:
+      printf("Infinity");
+      return;
+    case NUMERIC_NINF:
+      printf("-Infinity");
+      return;
+    case NUMERIC_NEG:
+      printf("-");
+      break;
+  }
+
+  // integer part, digit group g is 10000^(weight - g)
+  if (weight < 0)
+    printf("0");
+  for (int g = 0; g <= weight; g++)
+  {
+    int   digit = g < ndigits ? (int16) read_uint16(digits + 2 * g) : 0;
+
+    printf(g == 0 ? "%d" : "%04d", digit);
+  }
+
+  // fractional part, dscale decimal digits
+  if (dscale > 0)
+    printf(".");
+  for (int shown = 0, g = weight + 1; shown < dscale; g++, shown += 4)
+  {
+    int   digit = (g >= 0 && g < ndigits) ? (int16) read_uint16(digits + 2 * g) : 0;
+
+    snprintf(fraction, sizeof(fraction), "%04d", digit);
+    printf("%.*s", Min(4, dscale - shown), fraction);
+  }
+}
+
+/*
+ * Decodes and prints a value received in binary format. Unknown types are
+ * printed in hexadecimal.
+ */
+static void
+print_binary_value(const char *value, int length, Oid type)
+{
+  switch (type)
+  {
+    case BOOLOID:
+      printf("%s", value[0] ? "t" : "f");
+      break;
+
+    case INT2OID:
+      printf("%d", (int16) read_uint16(value));
+      break;
+
+    case INT4OID:
+      printf("%d", (int32) read_uint32(value));
+      break;
+
+    case OIDOID:
+      printf("%u", read_uint32(value));
+      break;
+
+    case INT8OID:
+      printf(INT64_FORMAT, (int64) read_uint64(value));
+      break;
+
+    case FLOAT4OID:
+    {
+      uint32  bits = read_uint32(value);
+      float   f;
+
+      memcpy(&f, &bits, sizeof(f));
+      printf("%.9g", f);
+      break;
+    }
+
+    case FLOAT8OID:
+    {
+      uint64  bits = read_uint64(value);
+      double  d;
+
+      memcpy(&d, &bits, sizeof(d));
+      printf("%.17g", d);
+      break;
+    }
+
+    case NUMERICOID:
+      print_binary_numeric(value);
+      break;
+
+    case TEXTOID:
+    case VARCHAROID:
+    case BPCHAROID:
+    case NAMEOID:
+    case JSONOID:
+    case UNKNOWNOID:
+      fwrite(value, 1, length, stdout);
+      break;
+
+    case UUIDOID:
+      for (int i = 0; i < 16; i++)
+      {
+        if (i == 4 || i == 6 || i == 8 || i == 10)
+          printf("-");
+        printf("%02x", (unsigned char) value[i]);
+      }
+      break;
+
+    case DATEOID:
+    {
+      int32   days = (int32) read_uint32(value);
+      int     year, month, day;
+
+      if (days == PG_INT32_MIN)
+        printf("-infinity");
+      else if (days == PG_INT32_MAX)
+        printf("infinity");
+      else
+      {
+        j2date(days + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+        printf("%04d-%02d-%02d", year, month, day);
+      }
+      break;
+    }
+
+    case TIMESTAMPOID:
+    case TIMESTAMPTZOID:
+    {
+      int64   usecs = (int64) read_uint64(value);
+      int64   days;
+      int64   time;
+      int     year, month, day;
+
+      if (usecs == PG_INT64_MIN)
+      {
+        printf("-infinity");
+        break;
+      }
+      if (usecs == PG_INT64_MAX)
+      {
+        printf("infinity");
+        break;
+      }
+
+      days = usecs / USECS_PER_DAY;
+      time = usecs % USECS_PER_DAY;
+      if (time < 0)
+      {
+        time += USECS_PER_DAY;
+        days--;
+      }
+
+      j2date((int) days + POSTGRES_EPOCH_JDATE, &year, &month, &day);
+      printf("%04d-%02d-%02d %02d:%02d:%02d.%06d%s",
+             year, month, day,
+             (int) (time / INT64CONST(3600000000)),
+             (int) (time / INT64CONST(60000000) % 60),
+             (int) (time / INT64CONST(1000000) % 60),
+             (int) (time % INT64CONST(1000000)),
+             type == TIMESTAMPTZOID ? "+00" : "");
+      break;
+    }
+
+    default:
+      // bytea and unknown types
+      printf("\\x");
+      for (int i = 0; i < length; i++)
+        printf("%02x", (unsigned char) value[i]);
+      break;
+  }
+}
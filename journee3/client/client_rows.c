@@ -0,0 +1,189 @@
+/*
+ * client_rows.c, compares the ways of retrieving rows
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "postgres_fe.h"
+#include "common/logging.h"
+#include "portability/instr_time.h"
+
+#include "client.h"
+
+// What a child sends back to its parent
+typedef struct RowReport
+{
+  bool      ok;
+  int       chunk;        // rows per PGresult really used
+  int64     rows;
+  int64     bytes;
+  double    elapsed;
+} RowReport;
+
+/*
+ * Runs the first query of the list once, with "chunk" rows per PGresult,
+ * reading every value without printing it.
+ */
+static void
+measure_rows(const char *conninfo, QueryList *list, int chunk,
+             RowReport *report)
+{
+  PGconn     *conn;
+  PGresult   *res;
+  instr_time  start;
+  instr_time  now;
+
+  report->chunk = chunk;
+
+  conn = PQconnectdb(conninfo);
+  if (PQstatus(conn) == CONNECTION_BAD)
+  {
+    pg_log_error("could not connect: %s", PQerrorMessage(conn));
+    return;
+  }
+
+  if (list->prepared && !prepare_queries(conn, list))
+  {
+    PQfinish(conn);
+    return;
+  }
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  if (!send_query(conn, list, 0))
+  {
+    pg_log_error("could not send query: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    return;
+  }
+
+  // The run is labelled with the mode really used: without chunked rows
+  // mode, single-row mode, and all rows at once if that failed too
+  if (set_row_mode(conn, chunk))
+    report->chunk = row_mode_chunk(chunk);
+  else
+  {
+    pg_log_warning("could not set the row mode for chunks of %d rows", chunk);
+    report->chunk = 0;
+  }
+
+  report->ok = true;
+  while ((res = PQgetResult(conn)))
+  {
+    int   nfields = PQnfields(res);
+    int   ntuples = PQntuples(res);
+
+    if (PQresultStatus(res) == PGRES_FATAL_ERROR)
+    {
+      pg_log_error("query failed: %s", PQresultErrorMessage(res));
+      report->ok = false;
+    }
+
+    // Like a consumer, look at every value
+    for (int ligne = 0 ; ligne < ntuples ; ligne++)
+      for (int colonne = 0 ; colonne < nfields ; colonne++)
+        report->bytes += PQgetlength(res, ligne, colonne);
+    report->rows += ntuples;
+
+    PQclear(res);
+  }
+
+  INSTR_TIME_SET_CURRENT(now);
+  INSTR_TIME_SUBTRACT(now, start);
+  report->elapsed = INSTR_TIME_GET_DOUBLE(now);
+
+  PQfinish(conn);
+}
+
+/*
+ * Runs the first query of the list once per chunk size, and reports the
+ * throughput and the peak memory of each run.
+ *
+ * The peak RSS of a process never goes down, so each run happens in its
+ * own child process, with its own connection: wait4() then gives the peak
+ * RSS of that run only.
+ *
+ * Returns the number of failed runs.
+ */
+int
+run_row_report(const char *conninfo, QueryList *list, int *chunks, int nchunks)
+{
+  int     failed = 0;
+
+  printf("%12s %12s %10s %12s %10s %14s\n",
+         "chunk rows", "rows", "time (s)", "rows/s", "MB/s", "peak RSS (kB)");
+
+  for (int i = 0; i < nchunks; i++)
+  {
+    RowReport   report = {0};
+    struct rusage usage;
+    int         fds[2];
+    int         status;
+    pid_t       pid;
+    long        maxrss;
+    char        label[16];
+
+    if (pipe(fds) < 0)
+      pg_fatal("could not create pipe: %m");
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid = fork();
+    if (pid < 0)
+      pg_fatal("could not fork: %m");
+
+    if (pid == 0)
+    {
+      close(fds[0]);
+      measure_rows(conninfo, list, chunks[i], &report);
+      if (write(fds[1], &report, sizeof(report)) != sizeof(report))
+        _exit(1);
+      _exit(0);
+    }
+
+    close(fds[1]);
+    report.chunk = chunks[i];
+    if (read(fds[0], &report, sizeof(report)) != sizeof(report))
+      report.ok = false;
+    close(fds[0]);
+
+    if (wait4(pid, &status, 0, &usage) < 0)
+      pg_fatal("could not wait for child process: %m");
+
+    // kilobytes on Linux and BSD, bytes on macOS
+    maxrss = usage.ru_maxrss;
+#ifdef __APPLE__
+    maxrss /= 1024;
+#endif
+
+    if (report.chunk == 0)
+      snprintf(label, sizeof(label), "all");
+    else if (report.chunk == 1)
+      snprintf(label, sizeof(label), "single");
+    else
+      snprintf(label, sizeof(label), "%d", report.chunk);
+
+    if (!report.ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+      printf("%12s %12s\n", label, "failed");
+      failed++;
+      continue;
+    }
+
+    printf("%12s %12" INT64_MODIFIER "d %10.3f %12.0f %10.1f %14ld\n",
+           label, report.rows, report.elapsed,
+           report.elapsed > 0 ? report.rows / report.elapsed : 0,
+           report.elapsed > 0 ? report.bytes / report.elapsed / (1024 * 1024) : 0,
+           maxrss);
+  }
+
+  return failed;
+}
@@ -9,15 +9,471 @@
 
 // #include
 #include "libpq-fe.h"
+#include <limits.h>
+#include <poll.h>
 #include "postgres_fe.h"
 #include "common/logging.h"
 #include "fe_utils/connect_utils.h"
 #include "fe_utils/option_utils.h"
 #include "fe_utils/string_utils.h"
 #include "getopt_long.h"
+#include "portability/instr_time.h"
+
+// One statement of a target, and how long it took
+typedef struct DropStep
+{
+  const char *label;        // terminate, drop or create
+  char       *sql;
+  double      elapsed;      // in milliseconds
+} DropStep;
+
+// One database of the bulk mode, and how its drop went
+typedef struct DropTarget
+{
+  char       *datname;
+  DropStep    steps[3];     // run one after the other
+  int         nsteps;
+  double      elapsed;      // in milliseconds
+  bool        ok;
+} DropTarget;
+
+// One connection of the pool
+typedef struct PoolSlot
+{
+  PGconn     *conn;
+  int         target;       // -1 when idle
+  int         step;
+  bool        failed;
+  instr_time  start;
+  instr_time  step_start;
+} PoolSlot;
+
+// How databases are recreated, when they are
+typedef struct RecreateOptions
+{
+  char       *template_name;  // NULL to only drop
+  char       *strategy;       // wal_log, file_copy, or NULL for the default
+  int         copies;         // per database name, 0 for the name itself
+} RecreateOptions;
+
+// With --strategy=auto, templates above this size use FILE_COPY
+#define AUTO_FILE_COPY_SIZE   INT64CONST(1073741824)
 
 static void help(const char *progname);
 
+static void
+add_target(DropTarget **targets, int *ntargets, const char *datname)
+{
+  *targets = pg_realloc(*targets, (*ntargets + 1) * sizeof(DropTarget));
+  memset(&(*targets)[*ntargets], 0, sizeof(DropTarget));
+  (*targets)[(*ntargets)++].datname = pg_strdup(datname);
+}
+
+/*
+ * Databases to drop: the names given, and those matching one of the LIKE
+ * patterns, found with a single catalog query. Templates and the database
+ * we are connected to are never part of it.
+ *
+ * When recreating, names given do not have to exist, and each one becomes
+ * "copies" names, NAME_1 to NAME_<copies>, if asked. The template is never
+ * part of the targets.
+ */
+static DropTarget *
+resolve_targets(PGconn *conn, char **names, int nnames, char **patterns,
+                int npatterns, RecreateOptions *recreate, bool echo,
+                int *ntargets)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
+  DropTarget *targets = NULL;
+
+  *ntargets = 0;
+
+  if (recreate->template_name)
+  {
+    for (int i = 0; i < nnames; i++)
+    {
+      if (strcmp(names[i], recreate->template_name) == 0)
+        pg_fatal("cannot recreate template database \"%s\"", names[i]);
+
+      if (recreate->copies == 0)
+        add_target(&targets, ntargets, names[i]);
+      for (int copy = 1; copy <= recreate->copies; copy++)
+      {
+        char   *name = psprintf("%s_%d", names[i], copy);
+
+        add_target(&targets, ntargets, name);
+        pg_free(name);
+      }
+    }
+
+    // names are known, only patterns need the catalog
+    nnames = 0;
+    if (npatterns == 0)
+      return targets;
+  }
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql,
+    "SELECT datname FROM pg_catalog.pg_database\n"
+    "WHERE NOT datistemplate AND datname <> current_database()\n");
+  if (recreate->template_name)
+  {
+    appendPQExpBufferStr(&sql, "  AND datname <> ");
+    appendStringLiteralConn(&sql, recreate->template_name, conn);
+    appendPQExpBufferChar(&sql, '\n');
+  }
+  appendPQExpBufferStr(&sql, "  AND (false");
+  for (int i = 0; i < nnames; i++)
+  {
+    appendPQExpBufferStr(&sql, " OR datname = ");
+    appendStringLiteralConn(&sql, names[i], conn);
+  }
+  for (int i = 0; i < npatterns; i++)
+  {
+    appendPQExpBufferStr(&sql, " OR datname LIKE ");
+    appendStringLiteralConn(&sql, patterns[i], conn);
+  }
+  appendPQExpBufferStr(&sql, ")\nORDER BY datname;");
+
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK)
+  {
+    pg_log_error("could not list databases: %s", PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  termPQExpBuffer(&sql);
+
+  // Names given but not found only deserve a warning, like DROP ... IF EXISTS
+  for (int i = 0; i < nnames; i++)
+  {
+    bool    found = false;
+
+    for (int row = 0; row < PQntuples(result) && !found; row++)
+      found = strcmp(PQgetvalue(result, row, 0), names[i]) == 0;
+    if (!found)
+      pg_log_warning("database \"%s\" does not exist or cannot be dropped", names[i]);
+  }
+
+  for (int row = 0; row < PQntuples(result); row++)
+  {
+    bool    known = false;
+
+    for (int i = 0; i < *ntargets && !known; i++)
+      known = strcmp(targets[i].datname, PQgetvalue(result, row, 0)) == 0;
+    if (!known)
+      add_target(&targets, ntargets, PQgetvalue(result, row, 0));
+  }
+
+  PQclear(result);
+
+  return targets;
+}
+
+/*
+ * Chooses the strategy of CREATE DATABASE: WAL_LOG copies block by block
+ * through the WAL, FILE_COPY copies files after a checkpoint, cheaper for
+ * large templates. "auto" picks one from the size of the template.
+ * STRATEGY appeared in PostgreSQL 15, older servers always copy files.
+ */
+static void
+resolve_strategy(PGconn *conn, RecreateOptions *recreate, bool echo)
+{
+  PQExpBufferData sql;
+  PGresult   *result;
+  int64       size;
+
+  if (!recreate->strategy)
+    return;
+
+  if (PQserverVersion(conn) < 150000)
+  {
+    pg_log_warning("STRATEGY needs PostgreSQL 15, using the server's only strategy");
+    recreate->strategy = NULL;
+    return;
+  }
+
+  if (strcmp(recreate->strategy, "auto") != 0)
+    return;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBufferStr(&sql, "SELECT pg_catalog.pg_database_size(");
+  appendStringLiteralConn(&sql, recreate->template_name, conn);
+  appendPQExpBufferStr(&sql, ");");
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_TUPLES_OK)
+  {
+    pg_log_error("could not get the size of template \"%s\": %s",
+                 recreate->template_name, PQerrorMessage(conn));
+    PQfinish(conn);
+    exit(1);
+  }
+  termPQExpBuffer(&sql);
+
+  size = strtoi64(PQgetvalue(result, 0, 0), NULL, 10);
+  recreate->strategy = size > AUTO_FILE_COPY_SIZE ? "file_copy" : "wal_log";
+  pg_log_info("template \"%s\" is " INT64_FORMAT " MB, using strategy %s",
+              recreate->template_name, size / (1024 * 1024), recreate->strategy);
+
+  PQclear(result);
+}
+
+static void
+add_step(DropTarget *target, const char *label, const char *sql)
+{
+  target->steps[target->nsteps].label = label;
+  target->steps[target->nsteps].sql = pg_strdup(sql);
+  target->nsteps++;
+}
+
+/*
+ * Statements dropping one database, then creating it again if asked.
+ * WITH (FORCE) appeared in PostgreSQL 13, older servers get their users
+ * terminated first.
+ */
+static void
+add_drop_steps(PGconn *conn, DropTarget *target, bool force,
+               RecreateOptions *recreate)
+{
+  PQExpBufferData sql;
+
+  target->nsteps = 0;
+
+  initPQExpBuffer(&sql);
+
+  if (force && PQserverVersion(conn) < 130000)
+  {
+    appendPQExpBufferStr(&sql,
+      "SELECT pg_terminate_backend(pid) FROM pg_stat_activity WHERE datname = ");
+    appendStringLiteralConn(&sql, target->datname, conn);
+    appendPQExpBufferChar(&sql, ';');
+    add_step(target, "terminate", sql.data);
+    resetPQExpBuffer(&sql);
+  }
+
+  // recreated databases may not exist yet
+  appendPQExpBuffer(&sql, "DROP DATABASE %s%s%s;",
+                    recreate->template_name ? "IF EXISTS " : "",
+                    fmtId(target->datname),
+                    force && PQserverVersion(conn) >= 130000 ? " WITH (FORCE)" : "");
+  add_step(target, "drop", sql.data);
+
+  if (recreate->template_name)
+  {
+    resetPQExpBuffer(&sql);
+    appendPQExpBuffer(&sql, "CREATE DATABASE %s", fmtId(target->datname));
+    appendPQExpBuffer(&sql, " TEMPLATE %s", fmtId(recreate->template_name));
+    if (recreate->strategy)
+      appendPQExpBuffer(&sql, " STRATEGY %s", recreate->strategy);
+    appendPQExpBufferChar(&sql, ';');
+    add_step(target, "create", sql.data);
+  }
+
+  termPQExpBuffer(&sql);
+}
+
+/*
+ * Sends the current step of the slot's target. Returns false if it could
+ * not be sent.
+ */
+static bool
+send_step(PoolSlot *slot, DropTarget *targets, bool echo)
+{
+  const char *sql = targets[slot->target].steps[slot->step].sql;
+
+  INSTR_TIME_SET_CURRENT(slot->step_start);
+  if (echo)
+    printf("%s\n", sql);
+
+  if (!PQsendQuery(slot->conn, sql))
+  {
+    pg_log_error("could not send query: %s", PQerrorMessage(slot->conn));
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Runs the steps of every target over a pool of connections, each one
+ * taking the next target as soon as it is done with its current one.
+ * Reports each database as it is done ("verb" says what was done), with
+ * the time of each step.
+ *
+ * Returns the number of failed targets.
+ */
+static int
+run_pool(PGconn **conns, int nconns, DropTarget *targets, int ntargets,
+         const char *verb, bool echo)
+{
+  PQExpBufferData phases;
+  PoolSlot   *slots = pg_malloc0(nconns * sizeof(PoolSlot));
+  struct pollfd *fds = pg_malloc(nconns * sizeof(struct pollfd));
+  int        *polled = pg_malloc(nconns * sizeof(int));
+  int         next = 0;
+  int         done = 0;
+  int         failed = 0;
+
+  initPQExpBuffer(&phases);
+
+  for (int i = 0; i < nconns; i++)
+  {
+    slots[i].conn = conns[i];
+    slots[i].target = -1;
+  }
+
+  while (done < ntargets)
+  {
+    int     npolled = 0;
+
+    // Idle connections take the next targets
+    for (int i = 0; i < nconns && next < ntargets; i++)
+    {
+      PoolSlot   *slot = &slots[i];
+
+      if (slot->target >= 0 || !slot->conn)
+        continue;
+
+      slot->target = next++;
+      slot->step = 0;
+      slot->failed = false;
+      INSTR_TIME_SET_CURRENT(slot->start);
+
+      if (!send_step(slot, targets, echo))
+      {
+        // a connection that cannot send leaves the pool, even if libpq
+        // does not see it as broken yet: it would fail every next target
+        targets[slot->target].ok = false;
+        failed++;
+        done++;
+        slot->target = -1;
+        slot->conn = NULL;
+      }
+    }
+
+    for (int i = 0; i < nconns; i++)
+    {
+      if (slots[i].target < 0)
+        continue;
+      fds[npolled].fd = PQsocket(slots[i].conn);
+      fds[npolled].events = POLLIN;
+      fds[npolled].revents = 0;
+      polled[npolled++] = i;
+    }
+
+    if (npolled == 0)
+    {
+      if (done < ntargets)
+      {
+        pg_log_error("no connection left, %d databases not %s",
+                     ntargets - done, verb);
+        failed += ntargets - done;
+      }
+      break;
+    }
+
+    if (poll(fds, npolled, -1) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_fatal("poll() failed: %m");
+    }
+
+    for (int k = 0; k < npolled; k++)
+    {
+      PoolSlot   *slot = &slots[polled[k]];
+      DropTarget *target = &targets[slot->target];
+      PGresult   *result;
+      instr_time  now;
+
+      if (fds[k].revents == 0)
+        continue;
+
+      if (!PQconsumeInput(slot->conn))
+      {
+        pg_log_error("could not read result: %s", PQerrorMessage(slot->conn));
+        slot->failed = true;
+      }
+      else
+      {
+        bool    finished = false;
+
+        // Results as they come, without blocking
+        while (!PQisBusy(slot->conn))
+        {
+          result = PQgetResult(slot->conn);
+          if (!result)
+          {
+            finished = true;
+            break;
+          }
+          if (PQresultStatus(result) != PGRES_COMMAND_OK &&
+              PQresultStatus(result) != PGRES_TUPLES_OK)
+          {
+            pg_log_error("database \"%s\": %s", target->datname,
+                         PQresultErrorMessage(result));
+            slot->failed = true;
+          }
+          PQclear(result);
+        }
+        if (!finished)
+          continue;
+
+        INSTR_TIME_SET_CURRENT(now);
+        INSTR_TIME_SUBTRACT(now, slot->step_start);
+        target->steps[slot->step].elapsed = INSTR_TIME_GET_MILLISEC(now);
+
+        // Next step of the same target
+        if (!slot->failed && ++slot->step < target->nsteps)
+        {
+          if (send_step(slot, targets, echo))
+            continue;
+          slot->failed = true;
+        }
+      }
+
+      INSTR_TIME_SET_CURRENT(now);
+      INSTR_TIME_SUBTRACT(now, slot->start);
+      target->elapsed = INSTR_TIME_GET_MILLISEC(now);
+      target->ok = !slot->failed;
+      done++;
+
+      resetPQExpBuffer(&phases);
+      for (int step = 0; step < target->nsteps && step <= slot->step; step++)
+        appendPQExpBuffer(&phases, "%s%s %.3f ms", step > 0 ? ", " : "",
+                          target->steps[step].label,
+                          target->steps[step].elapsed);
+
+      if (target->ok)
+        pg_log_info("[%d/%d] database \"%s\" %s in %.3f ms (%s)", done,
+                    ntargets, target->datname, verb, target->elapsed,
+                    phases.data);
+      else
+      {
+        pg_log_error("[%d/%d] database \"%s\" not %s", done, ntargets,
+                     target->datname, verb);
+        failed++;
+      }
+
+      slot->target = -1;
+      if (PQstatus(slot->conn) == CONNECTION_BAD)
+        slot->conn = NULL;
+    }
+  }
+
+  termPQExpBuffer(&phases);
+  pg_free(slots);
+  pg_free(fds);
+  pg_free(polled);
+
+  return failed;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -32,6 +488,12 @@ main(int argc, char **argv)
     {"username", required_argument, NULL, 'U'},
     {"echo", no_argument, NULL, 'e'},
     {"force", no_argument, NULL, 'f'},
+    {"pattern", required_argument, NULL, 'P'},
+    {"jobs", required_argument, NULL, 'j'},
+    {"dry-run", no_argument, NULL, 'n'},
+    {"recreate-from", required_argument, NULL, 'T'},
+    {"strategy", required_argument, NULL, 's'},
+    {"copies", required_argument, NULL, 1},
     {NULL, 0, NULL, 0}
   };
   int           optindex;
@@ -42,13 +504,19 @@ main(int argc, char **argv)
   char         *username = NULL;
   bool          echo = false;
   bool          force = false;
+  char        **patterns = NULL;
+  int           npatterns = 0;
+  int           jobs = 4;
+  bool          dry_run = false;
+  RecreateOptions recreate = {0};
+  bool          bulk;
 
   pg_logging_init(argv[0]);
   progname = get_progname(argv[0]);
 
   handle_help_version_opts(argc, argv, "dropdb", help);
 
-  while ((c = getopt_long(argc, argv, "efh:ip:U:wW", long_options, &optindex)) != -1)
+  while ((c = getopt_long(argc, argv, "efh:ij:np:P:s:T:U:wW", long_options, &optindex)) != -1)
   {
     switch (c)
     {
@@ -58,6 +526,33 @@ main(int argc, char **argv)
       case 'f':
         force = true;
         break;
+      case 'P':
+        patterns = pg_realloc(patterns, (npatterns + 1) * sizeof(char *));
+        patterns[npatterns++] = pg_strdup(optarg);
+        break;
+      case 'j':
+        if (!option_parse_int(optarg, "-j/--jobs", 1, INT_MAX, &jobs))
+          exit(1);
+        break;
+      case 'n':
+        dry_run = true;
+        break;
+      case 'T':
+        recreate.template_name = pg_strdup(optarg);
+        break;
+      case 's':
+        if (pg_strcasecmp(optarg, "wal_log") != 0 &&
+            pg_strcasecmp(optarg, "file_copy") != 0 &&
+            pg_strcasecmp(optarg, "auto") != 0)
+          pg_fatal("invalid strategy \"%s\", must be \"wal_log\", \"file_copy\" or \"auto\"", optarg);
+        recreate.strategy = pg_strdup(optarg);
+        for (char *p = recreate.strategy; *p; p++)
+          *p = pg_tolower((unsigned char) *p);
+        break;
+      case 1:
+        if (!option_parse_int(optarg, "--copies", 1, INT_MAX, &recreate.copies))
+          exit(1);
+        break;
       case 'h':
         host = pg_strdup(optarg);
         break;
@@ -77,22 +572,25 @@ main(int argc, char **argv)
     }
   }
 
-  switch (argc - optind)
+  if ((recreate.strategy || recreate.copies > 0) && !recreate.template_name)
   {
-    case 0:
-      pg_log_error("missing required argument database name");
-      pg_log_error_hint("Try \"%s --help\" for more information.", progname);
-      exit(1);
-    case 1:
-      dbname = argv[optind];
-      break;
-    default:
-      pg_log_error("too many command-line arguments (first is \"%s\")",
-             argv[optind + 1]);
-      pg_log_error_hint("Try \"%s --help\" for more information.", progname);
-      exit(1);
+    pg_log_error("options -s/--strategy and --copies need -T/--recreate-from");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
   }
 
+  // Patterns, several names or recreation: bulk mode
+  bulk = npatterns > 0 || argc - optind > 1 || recreate.template_name;
+
+  if (argc - optind == 0 && npatterns == 0)
+  {
+    pg_log_error("missing required argument database name");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+  if (!bulk)
+    dbname = argv[optind];
+
   // Connect to the maintenance database
 
   cparams.dbname = "postgres";
@@ -104,6 +602,83 @@ main(int argc, char **argv)
 
   conn = connectMaintenanceDatabase(&cparams, progname, echo);
 
+  if (bulk)
+  {
+    DropTarget *targets;
+    int         ntargets;
+    PGconn    **conns;
+    int         nconns;
+    int         failed;
+    instr_time  start;
+    instr_time  now;
+
+    const char *verb = recreate.template_name ? "recreated" : "dropped";
+
+    targets = resolve_targets(conn, argv + optind, argc - optind, patterns,
+                              npatterns, &recreate, echo, &ntargets);
+    pg_log_info("%d database%s to %s", ntargets, ntargets == 1 ? "" : "s",
+                recreate.template_name ? "recreate" : "drop");
+
+    if (recreate.template_name)
+      resolve_strategy(conn, &recreate, echo);
+
+    for (int i = 0; i < ntargets; i++)
+    {
+      add_drop_steps(conn, &targets[i], force, &recreate);
+      for (int step = 0; dry_run && step < targets[i].nsteps; step++)
+        printf("%s\n", targets[i].steps[step].sql);
+    }
+
+    if (dry_run || ntargets == 0)
+    {
+      PQfinish(conn);
+      exit(0);
+    }
+
+    // The pool: this connection, and others to the same database
+    nconns = Min(jobs, ntargets);
+    conns = pg_malloc(nconns * sizeof(PGconn *));
+    conns[0] = conn;
+    cparams.dbname = pg_strdup(PQdb(conn));
+    for (int i = 1; i < nconns; i++)
+      conns[i] = connectDatabase(&cparams, progname, echo, false, true);
+
+    INSTR_TIME_SET_CURRENT(start);
+    failed = run_pool(conns, nconns, targets, ntargets, verb, echo);
+    INSTR_TIME_SET_CURRENT(now);
+    INSTR_TIME_SUBTRACT(now, start);
+
+    pg_log_info("%d database%s %s in %.3f s with %d connection%s, %d failed",
+                ntargets - failed, ntargets - failed == 1 ? "" : "s", verb,
+                INSTR_TIME_GET_DOUBLE(now), nconns, nconns == 1 ? "" : "s",
+                failed);
+
+    // Time per phase, summed over the databases that went through it
+    for (int step = 0; step < targets[0].nsteps; step++)
+    {
+      double  total = 0;
+      double  longest = 0;
+      int     count = 0;
+
+      for (int i = 0; i < ntargets; i++)
+      {
+        if (targets[i].steps[step].elapsed <= 0)
+          continue;
+        total += targets[i].steps[step].elapsed;
+        longest = Max(longest, targets[i].steps[step].elapsed);
+        count++;
+      }
+      if (count > 0)
+        pg_log_info("%s: %.3f ms in total, %.3f ms on average, %.3f ms at most",
+                    targets[0].steps[step].label, total, total / count, longest);
+    }
+
+    for (int i = 0; i < nconns; i++)
+      PQfinish(conns[i]);
+
+    exit(failed == 0 ? 0 : 1);
+  }
+
   // Disconnect users from the to-be-dropped database
 
   if (force)
@@ -166,9 +741,20 @@ help(const char *progname)
 	printf("%s removes a PostgreSQL database.\n\n", progname);
 	printf("Usage:\n");
 	printf("  %s [OPTION]... DBNAME\n", progname);
+	printf("  %s [OPTION]... [-P PATTERN]... [DBNAME]...\n", progname);
 	printf("\nOptions:\n");
 	printf("  -e, --echo                show the commands being sent to the server\n");
 	printf("  -f, --force               try to terminate other connections before dropping\n");
+	printf("\nBulk mode, with patterns or several databases:\n");
+	printf("  -P, --pattern=PATTERN     drop databases whose name is LIKE PATTERN\n");
+	printf("  -j, --jobs=N              drop on N connections at once (default: 4)\n");
+	printf("  -n, --dry-run             show the commands, drop nothing\n");
+	printf("\nRecreation, in the bulk mode:\n");
+	printf("  -T, --recreate-from=TEMPLATE\n"
+		   "                            create each database again from TEMPLATE\n");
+	printf("  -s, --strategy=STRATEGY   wal_log, file_copy, or auto to choose from the\n"
+		   "                            size of TEMPLATE (default: server's default)\n");
+	printf("      --copies=N            recreate DBNAME_1 to DBNAME_N for each DBNAME\n");
 	printf("  -V, --version             output version information, then exit\n");
 	printf("  -?, --help                show this help, then exit\n");
 	printf("\nConnection options:\n");
@@ -0,0 +1,210 @@
+/*
+ * logparse.c, parsing logs written with journee3.conf
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ * Lines may come from a read-only mapping of the file: nothing here writes
+ * in them, and nothing expects them to be terminated.
+ */
+
+// #include
+#include "postgres_fe.h"
+
+#include "logparse.h"
+
+/*
+ * Parses the prefix "t=%n;h=%h;u=%u;d=%d;a=%a;p=%p;l=%l " of journee3.conf.
+ * t= is optional. a= runs up to ";p=", the next key, as application_name
+ * may contain any character. Returns the start of the message, NULL if the
+ * line has no prefix.
+ */
+const char *
+parse_log_prefix(const char *line, const char *end, LogPrefix *prefix)
+{
+  const char *p = line;
+  bool        found = false;
+
+  memset(prefix, 0, sizeof(LogPrefix));
+  prefix->at = -1;
+
+  while (end - p >= 2 && p[1] == '=')
+  {
+    char        key = p[0];
+    const char *value = p + 2;
+    const char *stop = value;
+
+    // application_name may hold spaces and semicolons: it ends at ";p="
+    if (key == 'a')
+    {
+      while (stop < end && *stop != '\n' &&
+             !(end - stop >= 3 && strncmp(stop, ";p=", 3) == 0))
+        stop++;
+      if (stop >= end || *stop == '\n')
+        return NULL;
+    }
+    else
+      while (stop < end && *stop != ';' && *stop != ' ' && *stop != '\n')
+        stop++;
+
+    switch (key)
+    {
+      case 't':
+      {
+        int64   seconds = 0;
+        int64   fraction = 0;
+        int     digits = 0;
+        const char *q = value;
+
+        for (; q < stop && isdigit((unsigned char) *q); q++)
+          seconds = seconds * 10 + (*q - '0');
+        if (q < stop && *q == '.')
+          for (q++; q < stop && isdigit((unsigned char) *q) && digits < 6; q++, digits++)
+            fraction = fraction * 10 + (*q - '0');
+        for (; digits < 6; digits++)
+          fraction *= 10;
+        prefix->at = seconds * 1000000 + fraction;
+        break;
+      }
+      case 'u':
+        prefix->user = value;
+        prefix->user_len = stop - value;
+        break;
+      case 'd':
+        prefix->database = value;
+        prefix->database_len = stop - value;
+        break;
+      case 'a':
+        prefix->application = value;
+        prefix->application_len = stop - value;
+        break;
+      case 'p':
+        prefix->pid = 0;
+        for (const char *q = value; q < stop && isdigit((unsigned char) *q); q++)
+          prefix->pid = prefix->pid * 10 + (*q - '0');
+        found = true;
+        break;
+    }
+
+    if (stop >= end || *stop != ';')
+      return found && stop < end && *stop == ' ' ? stop + 1 : NULL;
+    p = stop + 1;
+  }
+
+  return NULL;
+}
+
+/*
+ * Recognizes a statement in the message following the prefix:
+ *   LOG:  duration: 1.234 ms  statement: SELECT ...
+ *   LOG:  duration: 1.234 ms  execute <name>: SELECT ...
+ *   LOG:  statement: SELECT ...   (log_statement, duration 0)
+ * Returns the start of the query, NULL for other messages (parse and bind
+ * of the extended protocol included).
+ */
+const char *
+parse_statement(const char *text, const char *end, double *duration,
+                bool *extended)
+{
+  const char *p = text;
+
+  *duration = 0;
+  *extended = false;
+
+#define SKIP(s) \
+  (end - p >= (ptrdiff_t) strlen(s) && strncmp(p, (s), strlen(s)) == 0 ? \
+   (p += strlen(s), true) : false)
+
+  if (!SKIP("LOG:  "))
+    return NULL;
+
+  if (SKIP("duration: "))
+  {
+    double    scale = 0;
+
+    for (; p < end && (isdigit((unsigned char) *p) || *p == '.'); p++)
+    {
+      if (*p == '.')
+        scale = 1;
+      else if (scale == 0)
+        *duration = *duration * 10 + (*p - '0');
+      else
+        *duration += (*p - '0') / (scale *= 10);
+    }
+
+    // duration alone: the statement was logged before
+    if (!SKIP(" ms  "))
+      return NULL;
+  }
+
+  if (SKIP("statement: "))
+    return p;
+
+  if (SKIP("execute "))
+  {
+    for (; p < end && *p != '\n'; p++)
+    {
+      if (*p == ':' && p + 1 < end && p[1] == ' ')
+      {
+        *extended = true;
+        return p + 2;
+      }
+    }
+  }
+
+#undef SKIP
+
+  return NULL;
+}
+
+/*
+ * Fingerprint of a statement: constants and parameters become "?" and
+ * runs of spaces (newlines and the tabulations of continuation lines
+ * included) a single space.
+ */
+void
+normalize_query(const char *query, const char *end, PQExpBuffer buf)
+{
+  const char *p = query;
+
+  resetPQExpBuffer(buf);
+
+  while (p < end)
+  {
+    if (*p == '\'')
+    {
+      // string constant, '' inside
+      for (p++; p < end; p++)
+      {
+        if (*p == '\'' && p + 1 < end && p[1] == '\'')
+          p++;
+        else if (*p == '\'')
+        {
+          p++;
+          break;
+        }
+      }
+      appendPQExpBufferChar(buf, '?');
+    }
+    else if ((isdigit((unsigned char) *p) || *p == '$') &&
+             (buf->len == 0 ||
+              !(isalnum((unsigned char) buf->data[buf->len - 1]) ||
+                buf->data[buf->len - 1] == '_')))
+    {
+      // number or parameter, not the end of an identifier
+      for (p++; p < end && (isalnum((unsigned char) *p) || *p == '.'); p++)
+        ;
+      appendPQExpBufferChar(buf, '?');
+    }
+    else if (isspace((unsigned char) *p))
+    {
+      while (p < end && isspace((unsigned char) *p))
+        p++;
+      if (buf->len > 0 && p < end)
+        appendPQExpBufferChar(buf, ' ');
+    }
+    else
+      appendPQExpBufferChar(buf, *p++);
+  }
+}
@@ -0,0 +1,35 @@
+/*
+ * logparse.h, parsing logs written with journee3.conf
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+#ifndef LOGPARSE_H
+#define LOGPARSE_H
+
+#include "pqexpbuffer.h"
+
+// Fields of log_line_prefix, pointing in the line (not terminated)
+typedef struct LogPrefix
+{
+  int64       at;             // microseconds since the epoch, -1 without t=
+  int         pid;
+  const char *user;
+  int         user_len;
+  const char *database;
+  int         database_len;
+  const char *application;
+  int         application_len;
+} LogPrefix;
+
+extern const char *parse_log_prefix(const char *line, const char *end,
+                                    LogPrefix *prefix);
+extern const char *parse_statement(const char *text, const char *end,
+                                   double *duration, bool *extended);
+extern void normalize_query(const char *query, const char *end,
+                            PQExpBuffer buf);
+
+#endif              /* LOGPARSE_H */
@@ -0,0 +1,832 @@
+/*
+ * logstats, statistics on statements from PostgreSQL logs
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "postgres_fe.h"
+#include "common/hashfn.h"
+#include "common/logging.h"
+#include "fe_utils/option_utils.h"
+#include "getopt_long.h"
+#include "pqexpbuffer.h"
+#include "port/pg_bitutils.h"
+
+#include "logparse.h"
+
+/*
+ * Durations go in a log-linear histogram, in microseconds: values below
+ * DURATION_SUB_COUNT have their own bucket, then each power of two is split
+ * in DURATION_HALF buckets (relative error below 1/16).
+ */
+#define DURATION_SUB_BITS   5
+#define DURATION_SUB_COUNT  (1 << DURATION_SUB_BITS)
+#define DURATION_HALF       (DURATION_SUB_COUNT / 2)
+#define DURATION_MAX        INT64CONST(4294967295)
+#define DURATION_BUCKETS    ((32 - DURATION_SUB_BITS + 2) * DURATION_HALF)
+
+// Statements of one user, database, application and fingerprint
+typedef struct Aggregate
+{
+  struct Aggregate *next;       // same bucket
+  uint32      hash;
+  char       *user;
+  char       *database;
+  char       *application;
+  char       *fingerprint;
+  int64       count;
+  double      total;            // in milliseconds
+  double      min;
+  double      max;
+  uint32      histogram[DURATION_BUCKETS];
+} Aggregate;
+
+typedef struct AggregateTable
+{
+  Aggregate **buckets;
+  int         nbuckets;         // a power of 2
+  int         count;
+  int64       statements;
+  PQExpBufferData key;          // scratch buffers
+  PQExpBufferData fingerprint;
+} AggregateTable;
+
+// One thread, and its part of the file
+typedef struct Worker
+{
+  pthread_t   thread;
+  const char *start;
+  const char *end;
+  AggregateTable table;
+} Worker;
+
+// Which fields make the key of an aggregate
+static bool group_user = true;
+static bool group_database = true;
+static bool group_application = true;
+static bool group_fingerprint = true;
+
+static void help(const char *progname);
+
+static int
+duration_index(int64 value)
+{
+  int     shift;
+
+  if (value < DURATION_SUB_COUNT)
+    return (int) value;
+
+  shift = pg_leftmost_one_pos64((uint64) value) - (DURATION_SUB_BITS - 1);
+  return (shift + 1) * DURATION_HALF + (int) ((value >> shift) - DURATION_HALF);
+}
+
+static int64
+duration_value(int index)
+{
+  int     shift;
+  int64   sub;
+
+  if (index < DURATION_SUB_COUNT)
+    return index;
+
+  shift = index / DURATION_HALF - 1;
+  sub = index % DURATION_HALF + DURATION_HALF;
+  return ((sub + 1) << shift) - 1;
+}
+
+/*
+ * Duration below which "percentile" percent of the statements ran, in
+ * milliseconds
+ */
+static double
+aggregate_percentile(Aggregate *agg, double percentile)
+{
+  int64   wanted = (int64) (agg->count * percentile / 100.0 + 0.5);
+  int64   seen = 0;
+
+  if (wanted < 1)
+    wanted = 1;
+
+  for (int i = 0; i < DURATION_BUCKETS; i++)
+  {
+    seen += agg->histogram[i];
+    if (seen >= wanted)
+      return Max(Min(duration_value(i) / 1000.0, agg->max), agg->min);
+  }
+
+  return agg->max;
+}
+
+static void
+table_init(AggregateTable *table)
+{
+  table->nbuckets = 1024;
+  table->buckets = pg_malloc0(table->nbuckets * sizeof(Aggregate *));
+  table->count = 0;
+  table->statements = 0;
+  initPQExpBuffer(&table->key);
+  initPQExpBuffer(&table->fingerprint);
+}
+
+static void
+table_grow(AggregateTable *table)
+{
+  int         nbuckets = table->nbuckets * 2;
+  Aggregate **buckets = pg_malloc0(nbuckets * sizeof(Aggregate *));
+
+  for (int b = 0; b < table->nbuckets; b++)
+  {
+    Aggregate  *agg = table->buckets[b];
+
+    while (agg)
+    {
+      Aggregate  *next = agg->next;
+
+      agg->next = buckets[agg->hash & (nbuckets - 1)];
+      buckets[agg->hash & (nbuckets - 1)] = agg;
+      agg = next;
+    }
+  }
+
+  pg_free(table->buckets);
+  table->buckets = buckets;
+  table->nbuckets = nbuckets;
+}
+
+/*
+ * Aggregate of these fields, created if needed. Fields left out of the
+ * grouping are given as empty strings.
+ */
+static Aggregate *
+table_lookup(AggregateTable *table, const char *user, int user_len,
+             const char *database, int database_len,
+             const char *application, int application_len,
+             const char *fingerprint, int fingerprint_len)
+{
+  PQExpBuffer key = &table->key;
+  Aggregate  *agg;
+  uint32      hash;
+
+  // the four fields, separated by zeros
+  resetPQExpBuffer(key);
+  appendBinaryPQExpBuffer(key, user, user_len);
+  appendPQExpBufferChar(key, '\0');
+  appendBinaryPQExpBuffer(key, database, database_len);
+  appendPQExpBufferChar(key, '\0');
+  appendBinaryPQExpBuffer(key, application, application_len);
+  appendPQExpBufferChar(key, '\0');
+  appendBinaryPQExpBuffer(key, fingerprint, fingerprint_len);
+
+  hash = hash_bytes((const unsigned char *) key->data, key->len);
+
+  for (agg = table->buckets[hash & (table->nbuckets - 1)]; agg; agg = agg->next)
+  {
+    if (agg->hash == hash &&
+        strlen(agg->user) == user_len &&
+        strncmp(agg->user, user, user_len) == 0 &&
+        strlen(agg->database) == database_len &&
+        strncmp(agg->database, database, database_len) == 0 &&
+        strlen(agg->application) == application_len &&
+        strncmp(agg->application, application, application_len) == 0 &&
+        strlen(agg->fingerprint) == fingerprint_len &&
+        strncmp(agg->fingerprint, fingerprint, fingerprint_len) == 0)
+      return agg;
+  }
+
+  if (table->count >= table->nbuckets)
+    table_grow(table);
+
+  agg = pg_malloc0(sizeof(Aggregate));
+  agg->hash = hash;
+  agg->user = pnstrdup(user, user_len);
+  agg->database = pnstrdup(database, database_len);
+  agg->application = pnstrdup(application, application_len);
+  agg->fingerprint = pnstrdup(fingerprint, fingerprint_len);
+  agg->next = table->buckets[hash & (table->nbuckets - 1)];
+  table->buckets[hash & (table->nbuckets - 1)] = agg;
+  table->count++;
+
+  return agg;
+}
+
+/*
+ * Handles one message: the first line has the prefix, continuation lines
+ * (starting with a tabulation) follow, up to "end".
+ */
+static void
+scan_message(AggregateTable *table, const char *line, const char *line_end,
+             const char *end)
+{
+  LogPrefix   prefix;
+  const char *text;
+  const char *query;
+  double      duration;
+  bool        extended;
+  Aggregate  *agg;
+  int64       usecs;
+
+  text = parse_log_prefix(line, line_end, &prefix);
+  if (!text)
+    return;
+
+  query = parse_statement(text, end, &duration, &extended);
+  if (!query)
+    return;
+
+  if (group_fingerprint)
+    normalize_query(query, end, &table->fingerprint);
+  else
+    resetPQExpBuffer(&table->fingerprint);
+
+  agg = table_lookup(table,
+                     group_user && prefix.user ? prefix.user : "",
+                     group_user ? prefix.user_len : 0,
+                     group_database && prefix.database ? prefix.database : "",
+                     group_database ? prefix.database_len : 0,
+                     group_application && prefix.application ? prefix.application : "",
+                     group_application ? prefix.application_len : 0,
+                     table->fingerprint.data, table->fingerprint.len);
+
+  if (agg->count == 0 || duration < agg->min)
+    agg->min = duration;
+  if (duration > agg->max)
+    agg->max = duration;
+  agg->total += duration;
+  agg->count++;
+
+  usecs = Min((int64) (duration * 1000), DURATION_MAX);
+  agg->histogram[duration_index(usecs)]++;
+
+  table->statements++;
+}
+
+/*
+ * Scans whole messages between start and end. Lines are found with
+ * memchr(), vectorized by the C library.
+ */
+static void
+scan_range(AggregateTable *table, const char *start, const char *end)
+{
+  const char *p = start;
+
+  while (p < end)
+  {
+    const char *line_end = memchr(p, '\n', end - p);
+    const char *message_end;
+
+    if (!line_end)
+      line_end = end;
+
+    // continuation lines belong to the message
+    message_end = line_end;
+    while (message_end + 1 < end && message_end[1] == '\t')
+    {
+      message_end = memchr(message_end + 1, '\n', end - message_end - 1);
+      if (!message_end)
+        message_end = end;
+    }
+
+    scan_message(table, p, line_end, message_end);
+    p = message_end + 1;
+  }
+}
+
+static void *
+worker_main(void *arg)
+{
+  Worker     *worker = (Worker *) arg;
+
+  scan_range(&worker->table, worker->start, worker->end);
+
+  return NULL;
+}
+
+/*
+ * First byte of the message starting at or after "p": just after a newline
+ * not followed by a continuation line
+ */
+static const char *
+next_message(const char *data, const char *p, const char *end)
+{
+  if (p <= data)
+    return data;
+
+  p--;
+  while (p < end)
+  {
+    p = memchr(p, '\n', end - p);
+    if (!p)
+      return end;
+    p++;
+    if (p == end || *p != '\t')
+      return p;
+  }
+
+  return end;
+}
+
+/*
+ * Adds the aggregates of one table to another
+ */
+static void
+table_merge(AggregateTable *to, AggregateTable *from)
+{
+  for (int b = 0; b < from->nbuckets; b++)
+  {
+    for (Aggregate *agg = from->buckets[b]; agg; agg = agg->next)
+    {
+      Aggregate  *into = table_lookup(to,
+                                      agg->user, strlen(agg->user),
+                                      agg->database, strlen(agg->database),
+                                      agg->application, strlen(agg->application),
+                                      agg->fingerprint, strlen(agg->fingerprint));
+
+      if (into->count == 0 || agg->min < into->min)
+        into->min = agg->min;
+      into->max = Max(into->max, agg->max);
+      into->total += agg->total;
+      into->count += agg->count;
+      for (int i = 0; i < DURATION_BUCKETS; i++)
+        into->histogram[i] += agg->histogram[i];
+    }
+  }
+
+  to->statements += from->statements;
+}
+
+/*
+ * Scans [start, end) of a file on "jobs" threads, then merges their
+ * results in "table"
+ */
+static void
+scan_parallel(AggregateTable *table, const char *start, const char *end,
+              int jobs)
+{
+  Worker     *workers = pg_malloc0(jobs * sizeof(Worker));
+  size_t      size = end - start;
+
+  for (int i = 0; i < jobs; i++)
+  {
+    workers[i].start = next_message(start, start + size * i / jobs, end);
+    workers[i].end = next_message(start, start + size * (i + 1) / jobs, end);
+    table_init(&workers[i].table);
+
+    if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0)
+      pg_fatal("could not create thread: %m");
+  }
+
+  for (int i = 0; i < jobs; i++)
+  {
+    if (pthread_join(workers[i].thread, NULL) != 0)
+      pg_fatal("could not join thread: %m");
+    table_merge(table, &workers[i].table);
+  }
+
+  pg_free(workers);
+}
+
+/*
+ * Largest total duration first
+ */
+static int
+compare_aggregates(const void *a, const void *b)
+{
+  const Aggregate *aa = *(const Aggregate *const *) a;
+  const Aggregate *ab = *(const Aggregate *const *) b;
+
+  return aa->total < ab->total ? 1 : aa->total > ab->total ? -1 : 0;
+}
+
+static void
+write_csv_string(FILE *file, const char *value)
+{
+  fputc('"', file);
+  for (const char *p = value; *p; p++)
+  {
+    if (*p == '"')
+      fputc('"', file);
+    fputc(*p, file);
+  }
+  fputc('"', file);
+}
+
+static void
+write_json_string(FILE *file, const char *value)
+{
+  fputc('"', file);
+  for (const char *p = value; *p; p++)
+  {
+    if (*p == '"' || *p == '\\')
+      fprintf(file, "\\%c", *p);
+    else if ((unsigned char) *p < 0x20)
+      fprintf(file, "\\u%04x", (unsigned char) *p);
+    else
+      fputc(*p, file);
+  }
+  fputc('"', file);
+}
+
+/*
+ * Writes the aggregates, largest total duration first. With a file, the
+ * output is written next to it then renamed, so that readers never see a
+ * partial file.
+ */
+static void
+write_output(AggregateTable *table, const char *output, bool json, int top)
+{
+  Aggregate **sorted = pg_malloc(Max(table->count, 1) * sizeof(Aggregate *));
+  FILE       *file = stdout;
+  char       *tmpname = NULL;
+  int         n = 0;
+
+  for (int b = 0; b < table->nbuckets; b++)
+    for (Aggregate *agg = table->buckets[b]; agg; agg = agg->next)
+      sorted[n++] = agg;
+
+  qsort(sorted, n, sizeof(Aggregate *), compare_aggregates);
+  if (top > 0)
+    n = Min(n, top);
+
+  if (output)
+  {
+    tmpname = psprintf("%s.tmp", output);
+    file = fopen(tmpname, "w");
+    if (!file)
+      pg_fatal("could not open file \"%s\": %m", tmpname);
+  }
+
+  if (json)
+    fprintf(file, "[\n");
+  else
+    fprintf(file, "user,database,application,fingerprint,count,total_ms,avg_ms,min_ms,max_ms,p50_ms,p95_ms,p99_ms\n");
+
+  for (int i = 0; i < n; i++)
+  {
+    Aggregate  *agg = sorted[i];
+
+    if (json)
+    {
+      fprintf(file, "  {\"user\": ");
+      write_json_string(file, agg->user);
+      fprintf(file, ", \"database\": ");
+      write_json_string(file, agg->database);
+      fprintf(file, ", \"application\": ");
+      write_json_string(file, agg->application);
+      fprintf(file, ", \"fingerprint\": ");
+      write_json_string(file, agg->fingerprint);
+      fprintf(file, ", \"count\": " INT64_FORMAT ", \"total_ms\": %.3f, \"avg_ms\": %.3f, \"min_ms\": %.3f, \"max_ms\": %.3f, \"p50_ms\": %.3f, \"p95_ms\": %.3f, \"p99_ms\": %.3f}%s\n",
+              agg->count, agg->total, agg->total / agg->count, agg->min, agg->max,
+              aggregate_percentile(agg, 50), aggregate_percentile(agg, 95),
+              aggregate_percentile(agg, 99), i < n - 1 ? "," : "");
+    }
+    else
+    {
+      write_csv_string(file, agg->user);
+      fputc(',', file);
+      write_csv_string(file, agg->database);
+      fputc(',', file);
+      write_csv_string(file, agg->application);
+      fputc(',', file);
+      write_csv_string(file, agg->fingerprint);
+      fprintf(file, "," INT64_FORMAT ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+              agg->count, agg->total, agg->total / agg->count, agg->min, agg->max,
+              aggregate_percentile(agg, 50), aggregate_percentile(agg, 95),
+              aggregate_percentile(agg, 99));
+    }
+  }
+
+  if (json)
+    fprintf(file, "]\n");
+
+  if (output)
+  {
+    if (fclose(file) != 0)
+      pg_fatal("could not write file \"%s\": %m", tmpname);
+    if (rename(tmpname, output) != 0)
+      pg_fatal("could not rename file \"%s\" to \"%s\": %m", tmpname, output);
+    pg_free(tmpname);
+  }
+  else
+    fflush(stdout);
+
+  pg_free(sorted);
+}
+
+/*
+ * Start of the last message between start and end, just after the last
+ * newline not followed by a continuation line: more continuation lines may
+ * still come. NULL if there is a single message.
+ */
+static const char *
+last_message(const char *start, const char *end)
+{
+  for (const char *p = end - 1; p > start; p--)
+  {
+    if (p[-1] == '\n' && *p != '\t')
+      return p;
+  }
+
+  return NULL;
+}
+
+/*
+ * Maps a whole open file and scans it. Returns the size of the file.
+ *
+ * With "tail", the last message is not scanned but copied there, as a
+ * followed file may still append continuation lines to it.
+ */
+static off_t
+scan_file(AggregateTable *table, int fd, const char *filename, int jobs,
+          PQExpBuffer tail)
+{
+  struct stat st;
+  char       *data;
+  const char *end;
+
+  if (fstat(fd, &st) < 0)
+    pg_fatal("could not stat file \"%s\": %m", filename);
+
+  if (st.st_size > 0)
+  {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+      pg_fatal("could not map file \"%s\": %m", filename);
+    (void) madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    end = data + st.st_size;
+    if (tail)
+    {
+      const char *cut = last_message(data, end);
+
+      appendBinaryPQExpBuffer(tail, cut ? cut : data, end - (cut ? cut : data));
+      end = cut ? cut - 1 : data;
+    }
+
+    scan_parallel(table, data, end, jobs);
+
+    munmap(data, st.st_size);
+  }
+
+  return st.st_size;
+}
+
+/*
+ * Appends to "pending" what was written to a file after "offset"
+ */
+static void
+read_more(int fd, off_t *offset, PQExpBuffer pending)
+{
+  char        chunk[65536];
+  ssize_t     n;
+
+  while ((n = pread(fd, chunk, sizeof(chunk), *offset)) > 0)
+  {
+    appendBinaryPQExpBuffer(pending, chunk, n);
+    *offset += n;
+  }
+}
+
+/*
+ * Follows a file growing, open as "fd" and read up to "offset", its last
+ * message in "pending": every "interval" seconds, scans the complete
+ * messages written since, then rewrites the output. The last message waits
+ * until a line that does not start with a tabulation follows it, as more
+ * continuation lines may come.
+ *
+ * A file replaced (log rotation) is first read until its end through the
+ * descriptor still open, then the new one is read from its start. A file
+ * truncated is read again from its start.
+ */
+static void
+follow_file(AggregateTable *table, const char *filename, int fd, off_t offset,
+            PQExpBuffer pending, int interval, const char *output, bool json,
+            int top)
+{
+  struct stat st;
+  struct stat current;
+
+  while (true)
+  {
+    const char *cut;
+    bool        scanned = false;
+    size_t      n;
+
+    sleep(interval);
+
+    if (fd < 0)
+    {
+      fd = open(filename, O_RDONLY | PG_BINARY, 0);
+      if (fd < 0)
+        continue;         // being rotated
+      offset = 0;
+    }
+
+    if (fstat(fd, &current) < 0)
+      pg_fatal("could not stat file \"%s\": %m", filename);
+
+    if (current.st_size < offset)
+    {
+      pg_log_info("file \"%s\" was truncated, reading it again", filename);
+      offset = 0;
+
+      // nothing more will be added to the last message before
+      scan_range(table, pending->data, pending->data + pending->len);
+      resetPQExpBuffer(pending);
+      scanned = true;
+    }
+
+    read_more(fd, &offset, pending);
+
+    // A new file under the name: the old one is complete, read to its end
+    if (stat(filename, &st) == 0 &&
+        (st.st_ino != current.st_ino || st.st_dev != current.st_dev))
+    {
+      pg_log_info("file \"%s\" was rotated, reading the new one", filename);
+
+      scan_range(table, pending->data, pending->data + pending->len);
+      resetPQExpBuffer(pending);
+      scanned = true;
+
+      close(fd);
+      offset = 0;
+      fd = open(filename, O_RDONLY | PG_BINARY, 0);
+      if (fd >= 0)
+        read_more(fd, &offset, pending);
+    }
+
+    // complete messages only, the rest waits for the next round
+    cut = pending->len > 0 ?
+      last_message(pending->data, pending->data + pending->len) : NULL;
+    if (cut)
+    {
+      scan_range(table, pending->data, cut - 1);
+
+      n = pending->data + pending->len - cut;
+      memmove(pending->data, cut, n);
+      pending->len = n;
+      pending->data[n] = '\0';
+      scanned = true;
+    }
+
+    if (scanned)
+      write_output(table, output, json, top);
+  }
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *progname;
+  static struct option long_options[] = {
+    {"jobs", required_argument, NULL, 'j'},
+    {"output", required_argument, NULL, 'o'},
+    {"format", required_argument, NULL, 'F'},
+    {"group-by", required_argument, NULL, 'g'},
+    {"top", required_argument, NULL, 't'},
+    {"follow", no_argument, NULL, 'f'},
+    {"interval", required_argument, NULL, 'i'},
+    {NULL, 0, NULL, 0}
+  };
+  int         optindex;
+  int         c;
+  int         jobs = 4;
+  char       *output = NULL;
+  bool        json = false;
+  int         top = 0;
+  bool        follow = false;
+  int         interval = 10;
+  AggregateTable table;
+  PQExpBufferData pending;
+  off_t       size = 0;
+  int         fd = -1;
+
+  pg_logging_init(argv[0]);
+  progname = get_progname(argv[0]);
+
+  handle_help_version_opts(argc, argv, "logstats", help);
+
+  while ((c = getopt_long(argc, argv, "j:o:F:g:t:fi:", long_options, &optindex)) != -1)
+  {
+    switch (c)
+    {
+      case 'j':
+        if (!option_parse_int(optarg, "-j/--jobs", 1, 256, &jobs))
+          exit(1);
+        break;
+      case 'o':
+        output = pg_strdup(optarg);
+        break;
+      case 'F':
+        if (strcmp(optarg, "json") == 0)
+          json = true;
+        else if (strcmp(optarg, "csv") != 0)
+          pg_fatal("invalid output format \"%s\", must be \"csv\" or \"json\"", optarg);
+        break;
+      case 'g':
+      {
+        char   *field;
+
+        group_user = group_database = group_application = group_fingerprint = false;
+        for (field = strtok(optarg, ","); field; field = strtok(NULL, ","))
+        {
+          if (strcmp(field, "user") == 0)
+            group_user = true;
+          else if (strcmp(field, "database") == 0)
+            group_database = true;
+          else if (strcmp(field, "application") == 0)
+            group_application = true;
+          else if (strcmp(field, "fingerprint") == 0)
+            group_fingerprint = true;
+          else
+            pg_fatal("invalid field \"%s\" in -g/--group-by", field);
+        }
+        break;
+      }
+      case 't':
+        if (!option_parse_int(optarg, "-t/--top", 1, INT_MAX, &top))
+          exit(1);
+        break;
+      case 'f':
+        follow = true;
+        break;
+      case 'i':
+        if (!option_parse_int(optarg, "-i/--interval", 1, INT_MAX, &interval))
+          exit(1);
+        break;
+      default:
+        /* getopt_long already emitted a complaint */
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    pg_log_error("no log file given");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  if (follow && argc - optind > 1)
+  {
+    pg_log_error("only one log file can be followed");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  table_init(&table);
+  initPQExpBuffer(&pending);
+
+  for (int i = optind; i < argc; i++)
+  {
+    fd = open(argv[i], O_RDONLY | PG_BINARY, 0);
+    if (fd < 0)
+      pg_fatal("could not open file \"%s\": %m", argv[i]);
+
+    // a followed file is kept open, to be read until its rotation
+    size = scan_file(&table, fd, argv[i], jobs, follow ? &pending : NULL);
+    if (!follow)
+      close(fd);
+  }
+
+  pg_log_info(INT64_FORMAT " statements, %d aggregates", table.statements,
+              table.count);
+
+  write_output(&table, output, json, top);
+
+  if (follow)
+    follow_file(&table, argv[optind], fd, size, &pending, interval, output,
+                json, top);
+
+  return 0;
+}
+
+static void
+help(const char *progname)
+{
+	printf("%s aggregates the statements of PostgreSQL logs.\n\n", progname);
+	printf("Logs must use the log_line_prefix of journee3.conf.\n\n");
+	printf("Usage:\n");
+	printf("  %s [OPTION]... LOGFILE...\n", progname);
+	printf("\nOptions:\n");
+	printf("  -j, --jobs=N              number of threads reading each file (default: 4)\n");
+	printf("  -g, --group-by=FIELDS     comma-separated fields among user, database,\n"
+		   "                            application and fingerprint (default: all)\n");
+	printf("  -t, --top=N               only the N aggregates with the largest total time\n");
+	printf("  -o, --output=FILE         write to FILE (default: stdout)\n");
+	printf("  -F, --format=FORMAT       csv (default) or json\n");
+	printf("  -f, --follow              keep reading the file as it grows\n");
+	printf("  -i, --interval=SECONDS    read and write every SECONDS in follow mode (default: 10)\n");
+	printf("  -V, --version             output version information, then exit\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("\nReport bugs to <guillaume@lelarge.info>.\n");
+}
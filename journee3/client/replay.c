@@ -0,0 +1,835 @@
+/*
+ * replay, replaying statements from PostgreSQL logs
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2023.
+ *
+ */
+
+// #include
+#include "libpq-fe.h"
+#include <limits.h>
+#include <math.h>
+#include <poll.h>
+#include "postgres_fe.h"
+#include "common/hashfn.h"
+#include "common/logging.h"
+#include "fe_utils/option_utils.h"
+#include "getopt_long.h"
+#include "pqexpbuffer.h"
+#include "portability/instr_time.h"
+
+#include "logparse.h"
+
+#define FINGERPRINT_BUCKETS 4096
+
+// Statements of the same shape, constants left out
+typedef struct Fingerprint
+{
+  struct Fingerprint *next;     // same bucket
+  char       *text;
+  uint32      hash;
+  int64       calls;
+  int64       errors;
+  double      original_sum;     // in milliseconds
+  double      original_max;
+  double      replay_sum;
+  double      replay_max;
+} Fingerprint;
+
+typedef struct Statement
+{
+  int64       at;               // microseconds since the start of the log, -1 if unknown
+  double      duration;         // original duration, in milliseconds
+  char       *query;
+  int         nparams;
+  char      **params;
+  bool        extended;         // from an execute message
+  Fingerprint *fingerprint;
+} Statement;
+
+typedef enum SessionPhase
+{
+  SESSION_WAITING,              // not connected yet
+  SESSION_CONNECTING,
+  SESSION_IDLE,
+  SESSION_BUSY,
+  SESSION_DONE
+} SessionPhase;
+
+// One session of the log, keyed by its PID while it lives
+typedef struct Session
+{
+  int         pid;
+  char       *user;
+  char       *database;
+  bool        ended;            // disconnection seen in the log
+  bool        executed;         // last message was an execute
+  Statement  *statements;
+  int         count;
+  int         allocated;
+
+  // replay
+  PGconn     *conn;
+  SessionPhase phase;
+  PostgresPollingStatusType polling;
+  int         next;
+  bool        failed;
+  int64       sent_at;
+} Session;
+
+// Message of the log, with the fields of the line prefix
+typedef struct LogMessage
+{
+  LogPrefix   prefix;
+  PQExpBufferData text;
+} LogMessage;
+
+static Session **sessions = NULL;
+static int nsessions = 0;
+static int allocated_sessions = 0;
+static Fingerprint *fingerprints[FINGERPRINT_BUCKETS];
+static int nfingerprints = 0;
+static int64 log_start = -1;
+
+static void help(const char *progname);
+
+/*
+ * Fingerprint of a statement, see normalize_query()
+ */
+static Fingerprint *
+fingerprint(const char *query)
+{
+  PQExpBufferData buf;
+  Fingerprint *fp;
+  uint32      hash;
+
+  initPQExpBuffer(&buf);
+  normalize_query(query, query + strlen(query), &buf);
+
+  hash = hash_bytes((const unsigned char *) buf.data, buf.len);
+
+  for (fp = fingerprints[hash % FINGERPRINT_BUCKETS]; fp; fp = fp->next)
+  {
+    if (fp->hash == hash && strcmp(fp->text, buf.data) == 0)
+    {
+      termPQExpBuffer(&buf);
+      return fp;
+    }
+  }
+
+  fp = pg_malloc0(sizeof(Fingerprint));
+  fp->text = buf.data;
+  fp->hash = hash;
+  fp->next = fingerprints[hash % FINGERPRINT_BUCKETS];
+  fingerprints[hash % FINGERPRINT_BUCKETS] = fp;
+  nfingerprints++;
+
+  return fp;
+}
+
+/*
+ * Session of the log currently using this PID, created if needed
+ */
+static Session *
+get_session(LogMessage *msg)
+{
+  Session    *session;
+
+  for (int i = nsessions - 1; i >= 0; i--)
+  {
+    if (sessions[i]->pid == msg->prefix.pid && !sessions[i]->ended)
+      return sessions[i];
+  }
+
+  if (nsessions == allocated_sessions)
+  {
+    allocated_sessions = Max(allocated_sessions * 2, 64);
+    sessions = pg_realloc(sessions, allocated_sessions * sizeof(Session *));
+  }
+
+  session = pg_malloc0(sizeof(Session));
+  session->pid = msg->prefix.pid;
+  session->user = pnstrdup(msg->prefix.user ? msg->prefix.user : "",
+                           msg->prefix.user_len);
+  session->database = pnstrdup(msg->prefix.database ? msg->prefix.database : "",
+                               msg->prefix.database_len);
+  sessions[nsessions++] = session;
+
+  return session;
+}
+
+/*
+ * Parses "$1 = '42', $2 = NULL" into values, NULL for NULL
+ */
+static void
+parse_parameters(const char *text, Statement *stmt)
+{
+  const char *p = text;
+
+  while ((p = strchr(p, '$')))
+  {
+    int         n = atoi(p + 1);
+    char       *value = NULL;
+
+    p = strstr(p, " = ");
+    if (!p || n < 1)
+      break;
+    p += 3;
+
+    if (strncmp(p, "NULL", 4) == 0)
+      p += 4;
+    else if (*p == '\'')
+    {
+      PQExpBufferData buf;
+
+      initPQExpBuffer(&buf);
+      for (p++; *p; p++)
+      {
+        if (*p == '\'' && p[1] == '\'')
+          p++;
+        else if (*p == '\'')
+        {
+          p++;
+          break;
+        }
+        appendPQExpBufferChar(&buf, *p);
+      }
+      value = buf.data;
+    }
+    else
+      break;
+
+    if (n > stmt->nparams)
+    {
+      stmt->params = pg_realloc(stmt->params, n * sizeof(char *));
+      for (int i = stmt->nparams; i < n; i++)
+        stmt->params[i] = NULL;
+      stmt->nparams = n;
+    }
+    stmt->params[n - 1] = value;
+  }
+}
+
+/*
+ * Handles one complete message of the log. Only statements (with or without
+ * their duration), their parameters and disconnections matter.
+ */
+static void
+handle_message(LogMessage *msg)
+{
+  Session    *session;
+  Statement  *stmt;
+  const char *text = msg->text.data;
+  const char *query;
+  double      duration;
+  bool        extended;
+
+  if (msg->prefix.pid == 0)
+    return;
+
+  if (msg->prefix.at >= 0 && (log_start < 0 || msg->prefix.at < log_start))
+    log_start = msg->prefix.at;
+
+  if (strncmp(text, "LOG:  disconnection:", 20) == 0)
+  {
+    session = get_session(msg);
+    session->ended = true;
+    return;
+  }
+
+  // parameters of the execute just before, not of a bind
+  if (strncmp(text, "DETAIL:  parameters: ", 21) == 0)
+  {
+    session = get_session(msg);
+    if (session->executed)
+      parse_parameters(text + 21, &session->statements[session->count - 1]);
+    session->executed = false;
+    return;
+  }
+
+  if (strncmp(text, "LOG:  ", 6) != 0)
+    return;
+
+  session = get_session(msg);
+  session->executed = false;
+
+  query = parse_statement(text, text + msg->text.len, &duration, &extended);
+
+  // parse and bind of the extended protocol are replayed with the execute
+  if (!query)
+    return;
+
+  if (session->count == session->allocated)
+  {
+    session->allocated = Max(session->allocated * 2, 16);
+    session->statements = pg_realloc(session->statements,
+                                     session->allocated * sizeof(Statement));
+  }
+
+  stmt = &session->statements[session->count++];
+  memset(stmt, 0, sizeof(Statement));
+  stmt->at = msg->prefix.at;
+  stmt->duration = duration;
+  stmt->query = pg_strdup(query);
+  stmt->extended = extended;
+  stmt->fingerprint = fingerprint(query);
+  session->executed = extended;
+
+  // with log_min_duration_statement, the line comes at the end
+  if (stmt->at >= 0)
+  {
+    stmt->at -= (int64) (duration * 1000);
+    log_start = Min(log_start, stmt->at);
+  }
+}
+
+/*
+ * Reads one line, whatever its length. Returns false at the end of file.
+ */
+static bool
+read_line(FILE *file, PQExpBuffer line)
+{
+  char        chunk[8192];
+
+  resetPQExpBuffer(line);
+  while (fgets(chunk, sizeof(chunk), file))
+  {
+    appendPQExpBufferStr(line, chunk);
+    if (line->len > 0 && line->data[line->len - 1] == '\n')
+      break;
+  }
+
+  while (line->len > 0 && (line->data[line->len - 1] == '\n' ||
+                           line->data[line->len - 1] == '\r'))
+    line->data[--line->len] = '\0';
+
+  return line->len > 0 || !feof(file);
+}
+
+/*
+ * Reads a log file. Lines starting with a tabulation continue the previous
+ * message.
+ */
+static void
+read_log(const char *filename)
+{
+  FILE       *file;
+  PQExpBufferData line;
+  PQExpBufferData prefix;
+  LogMessage  msg;
+  bool        pending = false;
+  int64       lines = 0;
+
+  file = fopen(filename, "r");
+  if (!file)
+    pg_fatal("could not open file \"%s\": %m", filename);
+
+  initPQExpBuffer(&line);
+  initPQExpBuffer(&prefix);
+  initPQExpBuffer(&msg.text);
+
+  while (read_line(file, &line))
+  {
+    char       *text;
+
+    lines++;
+
+    if (line.data[0] == '\t')
+    {
+      if (pending)
+      {
+        appendPQExpBufferChar(&msg.text, '\n');
+        appendPQExpBufferStr(&msg.text, line.data + 1);
+      }
+      continue;
+    }
+
+    if (pending)
+      handle_message(&msg);
+    pending = false;
+
+    // the prefix fields point in this buffer, kept until the next message
+    resetPQExpBuffer(&prefix);
+    appendPQExpBufferStr(&prefix, line.data);
+    text = (char *) parse_log_prefix(prefix.data, prefix.data + prefix.len,
+                                     &msg.prefix);
+    if (!text)
+      continue;
+
+    resetPQExpBuffer(&msg.text);
+    appendPQExpBufferStr(&msg.text, text);
+    pending = true;
+  }
+
+  if (pending)
+    handle_message(&msg);
+
+  fclose(file);
+  termPQExpBuffer(&line);
+  termPQExpBuffer(&prefix);
+  termPQExpBuffer(&msg.text);
+
+  pg_log_debug(INT64_FORMAT " lines read from \"%s\"", lines, filename);
+}
+
+/*
+ * When the session should do its next step, in microseconds since the
+ * start of the replay; 0 when it is already late.
+ */
+static int64
+session_due(Session *session, double speed)
+{
+  Statement  *stmt = &session->statements[session->next];
+
+  if (speed == 0 || stmt->at < 0 || log_start < 0)
+    return 0;
+
+  return (int64) ((stmt->at - log_start) / speed);
+}
+
+/*
+ * Starts the connection of a session
+ */
+static void
+session_connect(Session *session, const char *host, const char *port,
+                const char *username, const char *dbname)
+{
+  const char *keywords[6];
+  const char *values[6];
+  int         n = 0;
+
+#define ADD_OPTION(k, v) \
+  do { if ((v) && (v)[0]) { keywords[n] = (k); values[n] = (v); n++; } } while (0)
+
+  ADD_OPTION("host", host);
+  ADD_OPTION("port", port);
+  ADD_OPTION("user", username ? username : session->user);
+  ADD_OPTION("dbname", dbname ? dbname : session->database);
+  ADD_OPTION("application_name", "replay");
+  keywords[n] = NULL;
+  values[n] = NULL;
+
+#undef ADD_OPTION
+
+  session->conn = PQconnectStartParams(keywords, values, 1);
+  session->polling = PGRES_POLLING_WRITING;
+  session->phase = SESSION_CONNECTING;
+
+  if (!session->conn || PQstatus(session->conn) == CONNECTION_BAD)
+  {
+    pg_log_error("session %d: could not connect: %s", session->pid,
+                 session->conn ? PQerrorMessage(session->conn) : "out of memory");
+    session->phase = SESSION_DONE;
+    session->failed = true;
+  }
+}
+
+/*
+ * Reads the results of the statement in flight, and records its latency
+ * once complete.
+ */
+static void
+session_read(Session *session, int64 now)
+{
+  Statement  *stmt = &session->statements[session->next];
+  Fingerprint *fp = stmt->fingerprint;
+  PGresult   *res;
+  double      latency;
+  bool        error = false;
+
+  if (!PQconsumeInput(session->conn))
+  {
+    pg_log_error("session %d: connection lost: %s", session->pid,
+                 PQerrorMessage(session->conn));
+    session->phase = SESSION_DONE;
+    session->failed = true;
+    return;
+  }
+
+  while (!PQisBusy(session->conn))
+  {
+    res = PQgetResult(session->conn);
+    if (!res)
+    {
+      latency = (now - session->sent_at) / 1000.0;
+
+      fp->calls++;
+      fp->original_sum += stmt->duration;
+      fp->original_max = Max(fp->original_max, stmt->duration);
+      fp->replay_sum += latency;
+      fp->replay_max = Max(fp->replay_max, latency);
+      if (error)
+        fp->errors++;
+
+      session->next++;
+      session->phase = session->next < session->count ? SESSION_IDLE : SESSION_DONE;
+      return;
+    }
+
+    if (PQresultStatus(res) == PGRES_FATAL_ERROR)
+    {
+      if (fp->errors == 0)
+        pg_log_warning("session %d: %s", session->pid, PQresultErrorMessage(res));
+      error = true;
+    }
+    PQclear(res);
+  }
+}
+
+/*
+ * Sends the next statement of a session
+ */
+static void
+session_send(Session *session, int64 now)
+{
+  Statement  *stmt = &session->statements[session->next];
+  int         rc;
+
+  if (stmt->nparams > 0)
+    rc = PQsendQueryParams(session->conn, stmt->query, stmt->nparams, NULL,
+                           (const char *const *) stmt->params, NULL, NULL, 0);
+  else
+    rc = PQsendQuery(session->conn, stmt->query);
+
+  if (!rc)
+  {
+    pg_log_error("session %d: could not send statement: %s", session->pid,
+                 PQerrorMessage(session->conn));
+    session->phase = SESSION_DONE;
+    session->failed = true;
+    return;
+  }
+
+  session->sent_at = now;
+  session->phase = SESSION_BUSY;
+}
+
+/*
+ * Replays every session on its own connection, all multiplexed with
+ * poll(). A session connects when its first statement is due, and sends
+ * each statement when it is due and the previous one is done, so that the
+ * original concurrency and timing are kept. "speed" divides the delays;
+ * 0 replays as fast as possible.
+ */
+static void
+replay(const char *host, const char *port, const char *username,
+       const char *dbname, double speed, double *elapsed)
+{
+  struct pollfd *fds = pg_malloc(nsessions * sizeof(struct pollfd));
+  int        *polled = pg_malloc(nsessions * sizeof(int));
+  instr_time  start;
+  instr_time  now_time;
+  int64       now;
+
+  INSTR_TIME_SET_CURRENT(start);
+
+  while (true)
+  {
+    int         npolled = 0;
+    int         active = 0;
+    int64       wake = -1;
+    int         timeout;
+
+    INSTR_TIME_SET_CURRENT(now_time);
+    INSTR_TIME_SUBTRACT(now_time, start);
+    now = (int64) INSTR_TIME_GET_MICROSEC(now_time);
+
+    for (int i = 0; i < nsessions; i++)
+    {
+      Session    *session = sessions[i];
+      int64       due;
+
+      if (session->phase == SESSION_DONE)
+        continue;
+      active++;
+
+      if (session->phase == SESSION_WAITING || session->phase == SESSION_IDLE)
+      {
+        due = session_due(session, speed);
+        if (due > now)
+        {
+          wake = wake < 0 ? due : Min(wake, due);
+          continue;
+        }
+
+        if (session->phase == SESSION_WAITING)
+          session_connect(session, host, port, username, dbname);
+        else
+          session_send(session, now);
+      }
+
+      if (session->phase == SESSION_DONE)
+        continue;
+
+      fds[npolled].fd = PQsocket(session->conn);
+      fds[npolled].events =
+        (session->phase == SESSION_CONNECTING &&
+         session->polling == PGRES_POLLING_WRITING) ? POLLOUT : POLLIN;
+      fds[npolled].revents = 0;
+
+      // libpq may still have data to send
+      if (session->phase == SESSION_BUSY && PQflush(session->conn) == 1)
+        fds[npolled].events |= POLLOUT;
+
+      polled[npolled++] = i;
+    }
+
+    if (active == 0)
+      break;
+
+    timeout = wake < 0 ? -1 : (int) Max((wake - now + 999) / 1000, 0);
+    if (npolled == 0 && timeout < 0)
+      break;
+
+    if (poll(fds, npolled, timeout) < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      pg_fatal("poll() failed: %m");
+    }
+
+    INSTR_TIME_SET_CURRENT(now_time);
+    INSTR_TIME_SUBTRACT(now_time, start);
+    now = (int64) INSTR_TIME_GET_MICROSEC(now_time);
+
+    for (int k = 0; k < npolled; k++)
+    {
+      Session    *session = sessions[polled[k]];
+
+      if (fds[k].revents == 0)
+        continue;
+
+      if (session->phase == SESSION_CONNECTING)
+      {
+        session->polling = PQconnectPoll(session->conn);
+        if (session->polling == PGRES_POLLING_OK)
+        {
+          PQsetnonblocking(session->conn, 1);
+          session->phase = SESSION_IDLE;
+        }
+        else if (session->polling == PGRES_POLLING_FAILED)
+        {
+          pg_log_error("session %d: could not connect: %s", session->pid,
+                       PQerrorMessage(session->conn));
+          session->phase = SESSION_DONE;
+          session->failed = true;
+        }
+      }
+      else if (session->phase == SESSION_BUSY)
+        session_read(session, now);
+    }
+  }
+
+  INSTR_TIME_SET_CURRENT(now_time);
+  INSTR_TIME_SUBTRACT(now_time, start);
+  *elapsed = INSTR_TIME_GET_DOUBLE(now_time);
+
+  for (int i = 0; i < nsessions; i++)
+    if (sessions[i]->conn)
+      PQfinish(sessions[i]->conn);
+
+  pg_free(fds);
+  pg_free(polled);
+}
+
+/*
+ * Largest difference of total time first
+ */
+static int
+compare_fingerprints(const void *a, const void *b)
+{
+  const Fingerprint *fa = *(const Fingerprint *const *) a;
+  const Fingerprint *fb = *(const Fingerprint *const *) b;
+  double      da = fabs(fa->replay_sum - fa->original_sum);
+  double      db = fabs(fb->replay_sum - fb->original_sum);
+
+  return da < db ? 1 : da > db ? -1 : 0;
+}
+
+/*
+ * Prints the summary and the fingerprints, returns the number of failed
+ * sessions
+ */
+static int
+report(int top, double elapsed, int64 log_span)
+{
+  Fingerprint **sorted = pg_malloc(Max(nfingerprints, 1) * sizeof(Fingerprint *));
+  int         n = 0;
+  int64       statements = 0;
+  int64       errors = 0;
+  int         failed = 0;
+
+  for (int b = 0; b < FINGERPRINT_BUCKETS; b++)
+    for (Fingerprint *fp = fingerprints[b]; fp; fp = fp->next)
+    {
+      sorted[n++] = fp;
+      statements += fp->calls;
+      errors += fp->errors;
+    }
+
+  for (int i = 0; i < nsessions; i++)
+    if (sessions[i]->failed)
+      failed++;
+
+  qsort(sorted, n, sizeof(Fingerprint *), compare_fingerprints);
+
+  printf("sessions: %d (%d failed), statements: " INT64_FORMAT " (" INT64_FORMAT " errors), fingerprints: %d\n",
+         nsessions, failed, statements, errors, n);
+  if (log_span > 0)
+    printf("replay time: %.3f s, log time: %.3f s\n", elapsed, log_span / 1000000.0);
+  else
+    printf("replay time: %.3f s\n", elapsed);
+
+  printf("\n%8s %12s %12s %12s %12s %8s  %s\n",
+         "calls", "orig avg ms", "replay avg", "orig max", "replay max",
+         "diff %", "fingerprint");
+
+  for (int i = 0; i < n && i < top; i++)
+  {
+    Fingerprint *fp = sorted[i];
+    double      original = fp->calls > 0 ? fp->original_sum / fp->calls : 0;
+    double      replayed = fp->calls > 0 ? fp->replay_sum / fp->calls : 0;
+    char        diff[32] = "-";
+
+    if (fp->calls == 0)
+      continue;
+
+    if (original > 0)
+      snprintf(diff, sizeof(diff), "%+.1f", 100 * (replayed - original) / original);
+
+    printf("%8" INT64_MODIFIER "d %12.3f %12.3f %12.3f %12.3f %8s  %.80s\n",
+           fp->calls, original, replayed, fp->original_max, fp->replay_max,
+           diff, fp->text);
+  }
+
+  pg_free(sorted);
+
+  return failed;
+}
+
+int
+main(int argc, char **argv)
+{
+  const char *progname;
+  static struct option long_options[] = {
+    {"host", required_argument, NULL, 'h'},
+    {"port", required_argument, NULL, 'p'},
+    {"username", required_argument, NULL, 'U'},
+    {"dbname", required_argument, NULL, 'd'},
+    {"speed", required_argument, NULL, 's'},
+    {"top", required_argument, NULL, 't'},
+    {NULL, 0, NULL, 0}
+  };
+  int         optindex;
+  int         c;
+  char       *host = NULL;
+  char       *port = NULL;
+  char       *username = NULL;
+  char       *dbname = NULL;
+  double      speed = 1;
+  int         top = 20;
+  int64       statements = 0;
+  int64       log_end = -1;
+  double      elapsed;
+  char       *endptr;
+
+  pg_logging_init(argv[0]);
+  progname = get_progname(argv[0]);
+
+  handle_help_version_opts(argc, argv, "replay", help);
+
+  while ((c = getopt_long(argc, argv, "h:p:U:d:s:t:", long_options, &optindex)) != -1)
+  {
+    switch (c)
+    {
+      case 'h':
+        host = pg_strdup(optarg);
+        break;
+      case 'p':
+        port = pg_strdup(optarg);
+        break;
+      case 'U':
+        username = pg_strdup(optarg);
+        break;
+      case 'd':
+        dbname = pg_strdup(optarg);
+        break;
+      case 's':
+        speed = strtod(optarg, &endptr);
+        if (*endptr != '\0' || speed < 0)
+          pg_fatal("invalid speed factor \"%s\"", optarg);
+        break;
+      case 't':
+        if (!option_parse_int(optarg, "-t/--top", 1, INT_MAX, &top))
+          exit(1);
+        break;
+      default:
+        /* getopt_long already emitted a complaint */
+        pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+        exit(1);
+    }
+  }
+
+  if (optind >= argc)
+  {
+    pg_log_error("no log file given");
+    pg_log_error_hint("Try \"%s --help\" for more information.", progname);
+    exit(1);
+  }
+
+  for (; optind < argc; optind++)
+    read_log(argv[optind]);
+
+  for (int i = 0; i < nsessions; i++)
+  {
+    Session    *session = sessions[i];
+
+    statements += session->count;
+    if (session->count > 0)
+      log_end = Max(log_end, session->statements[session->count - 1].at);
+  }
+
+  if (statements == 0)
+    pg_fatal("no statement found");
+
+  if (log_start < 0 && speed != 0)
+    pg_log_warning("no t=%%n in log_line_prefix, all sessions are replayed at once, as fast as possible");
+
+  pg_log_info("replaying " INT64_FORMAT " statements from %d sessions", statements, nsessions);
+
+  // sessions without statements have nothing to replay
+  for (int i = 0; i < nsessions; i++)
+    if (sessions[i]->count == 0)
+      sessions[i]->phase = SESSION_DONE;
+
+  replay(host, port, username, dbname, speed, &elapsed);
+
+  if (report(top, elapsed, log_start >= 0 ? log_end - log_start : 0) > 0)
+    return 1;
+
+  return 0;
+}
+
+static void
+help(const char *progname)
+{
+	printf("%s replays the statements of PostgreSQL logs.\n\n", progname);
+	printf("Logs must use the log_line_prefix of journee3.conf, t=%%n included for the timing.\n\n");
+	printf("Usage:\n");
+	printf("  %s [OPTION]... LOGFILE...\n", progname);
+	printf("\nOptions:\n");
+	printf("  -d, --dbname=DBNAME       replay in this database (default: the logged one)\n");
+	printf("  -s, --speed=FACTOR        replay FACTOR times faster, 0 for no delay (default: 1)\n");
+	printf("  -t, --top=N               report the N fingerprints with the largest\n"
+		   "                            differences (default: 20)\n");
+	printf("  -V, --version             output version information, then exit\n");
+	printf("  -?, --help                show this help, then exit\n");
+	printf("\nConnection options:\n");
+	printf("  -h, --host=HOSTNAME       database server host or socket directory\n");
+	printf("  -p, --port=PORT           database server port\n");
+	printf("  -U, --username=USERNAME   user name (default: the logged one)\n");
+	printf("\nPasswords come from PGPASSWORD or the password file.\n");
+	printf("\nReport bugs to <guillaume@lelarge.info>.\n");
+}
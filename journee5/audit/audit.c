@@ -9,13 +9,69 @@
 
 // #include
 #include "libpq-fe.h"
+#include <limits.h>
 #include <signal.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <time.h>
 #include "postgres_fe.h"
+#include "access/xlogdefs.h"
 #include "common/logging.h"
+#include "datatype/timestamp.h"
 #include "fe_utils/connect_utils.h"
 #include "fe_utils/option_utils.h"
 #include "fe_utils/string_utils.h"
 #include "getopt_long.h"
+#include "port/pg_bswap.h"
+
+#include "plugin_audit.h"
+
+// A relation known from the relation records of the binary format
+typedef struct AuditRelation
+{
+  Oid         relid;
+  char       *name;
+  int         natts;
+  char      **attnames;
+} AuditRelation;
+
+// relid => AuditRelation, open addressing, size a power of two
+typedef struct RelationMap
+{
+  AuditRelation **slots;
+  int         size;
+  int         count;
+} RelationMap;
+
+/*
+ * Changes of a streamed transaction, kept until its commit as it or its
+ * subtransactions can still abort: records of xid, length and line in a
+ * temporary file, and the subtransactions that aborted.
+ */
+typedef struct StreamedTxn
+{
+  TransactionId xid;
+  FILE       *changes;
+  TransactionId *aborted;
+  int         naborted;
+  int         maxaborted;
+  struct StreamedTxn *next;
+} StreamedTxn;
+
+// Streamed transactions in progress, and the one of the current block
+typedef struct StreamMap
+{
+  StreamedTxn *txns;
+  StreamedTxn *current;
+} StreamMap;
+
+// Bounded reads in a message of the binary format
+typedef struct Reader
+{
+  const char *p;
+  const char *end;
+  bool        failed;
+} Reader;
 
 static volatile int keepRunning = 1;
 
@@ -28,6 +84,938 @@ void intHandler(int dummy)
   keepRunning = 0;
 }
 
+/*
+ * Current time as a TimestampTz: microseconds since 2000-01-01, the clock
+ * of the replication protocol
+ */
+static TimestampTz
+current_timestamp(void)
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, NULL);
+  return ((TimestampTz) tv.tv_sec -
+          ((POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY)) *
+    USECS_PER_SEC + tv.tv_usec;
+}
+
+/*
+ * A TimestampTz as local time, like the server shows it, in a static
+ * buffer
+ */
+static const char *
+timestamp_to_str(TimestampTz ts)
+{
+  static char buf[64];
+  time_t      seconds;
+  int         usecs;
+  struct tm   tm;
+  char        date[32];
+  char        zone[8];
+
+  seconds = ts / USECS_PER_SEC;
+  usecs = ts % USECS_PER_SEC;
+  if (usecs < 0)
+  {
+    seconds--;
+    usecs += USECS_PER_SEC;
+  }
+  seconds += (POSTGRES_EPOCH_JDATE - UNIX_EPOCH_JDATE) * SECS_PER_DAY;
+
+  localtime_r(&seconds, &tm);
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", &tm);
+  strftime(zone, sizeof(zone), "%z", &tm);
+  snprintf(buf, sizeof(buf), "%s.%06d%s", date, usecs, zone);
+
+  return buf;
+}
+
+static int64
+read_int64(const char *buf)
+{
+  uint64      n;
+
+  memcpy(&n, buf, sizeof(n));
+  return (int64) pg_ntoh64(n);
+}
+
+static void
+write_int64(char *buf, int64 value)
+{
+  uint64      n = pg_hton64((uint64) value);
+
+  memcpy(buf, &n, sizeof(n));
+}
+
+static AuditRelation **
+relation_slot(RelationMap *map, Oid relid)
+{
+  int         i = (relid * 2654435761U) & (map->size - 1);
+
+  while (map->slots[i] && map->slots[i]->relid != relid)
+    i = (i + 1) & (map->size - 1);
+
+  return &map->slots[i];
+}
+
+static AuditRelation *
+relation_lookup(RelationMap *map, Oid relid)
+{
+  return map->size > 0 ? *relation_slot(map, relid) : NULL;
+}
+
+static void
+relation_free(AuditRelation *relation)
+{
+  for (int i = 0; i < relation->natts; i++)
+    pg_free(relation->attnames[i]);
+  pg_free(relation->attnames);
+  pg_free(relation->name);
+  pg_free(relation);
+}
+
+// Adds or replaces a relation, the map then owns it
+static void
+relation_store(RelationMap *map, AuditRelation *relation)
+{
+  AuditRelation **slot;
+
+  if (map->count * 4 >= map->size * 3)
+  {
+    RelationMap bigger;
+
+    bigger.size = map->size > 0 ? map->size * 2 : 64;
+    bigger.slots = pg_malloc0(bigger.size * sizeof(AuditRelation *));
+    bigger.count = map->count;
+    for (int i = 0; i < map->size; i++)
+      if (map->slots[i])
+        *relation_slot(&bigger, map->slots[i]->relid) = map->slots[i];
+    pg_free(map->slots);
+    *map = bigger;
+  }
+
+  slot = relation_slot(map, relation->relid);
+  if (*slot)
+    relation_free(*slot);
+  else
+    map->count++;
+  *slot = relation;
+}
+
+static void
+relation_map_free(RelationMap *map)
+{
+  for (int i = 0; i < map->size; i++)
+    if (map->slots[i])
+      relation_free(map->slots[i]);
+  pg_free(map->slots);
+}
+
+static StreamedTxn **
+stream_slot(StreamMap *streams, TransactionId xid)
+{
+  StreamedTxn **slot = &streams->txns;
+
+  while (*slot && (*slot)->xid != xid)
+    slot = &(*slot)->next;
+
+  return slot;
+}
+
+static void
+stream_free(StreamedTxn *txn)
+{
+  if (txn->changes)
+    fclose(txn->changes);
+  pg_free(txn->aborted);
+  pg_free(txn);
+}
+
+static void
+stream_map_free(StreamMap *streams)
+{
+  while (streams->txns)
+  {
+    StreamedTxn *next = streams->txns->next;
+
+    stream_free(streams->txns);
+    streams->txns = next;
+  }
+  streams->current = NULL;
+}
+
+// A block of changes of transaction "xid" starts, its first one or not
+static bool
+stream_start(StreamMap *streams, TransactionId xid)
+{
+  StreamedTxn **slot = stream_slot(streams, xid);
+
+  if (*slot == NULL)
+  {
+    StreamedTxn *txn = pg_malloc0(sizeof(StreamedTxn));
+
+    txn->xid = xid;
+    txn->changes = tmpfile();
+    if (txn->changes == NULL)
+    {
+      pg_log_error("could not create a temporary file: %m");
+      pg_free(txn);
+      return false;
+    }
+    *slot = txn;
+  }
+  streams->current = *slot;
+
+  return true;
+}
+
+/*
+ * Keeps a change line of the current block, "xid" being the one of its
+ * subtransaction
+ */
+static bool
+stream_keep(StreamMap *streams, TransactionId xid, const char *line,
+            uint32 len)
+{
+  FILE       *changes = streams->current->changes;
+
+  if (fwrite(&xid, sizeof(xid), 1, changes) != 1 ||
+      fwrite(&len, sizeof(len), 1, changes) != 1 ||
+      fwrite(line, 1, len, changes) != len)
+  {
+    pg_log_error("could not write to a temporary file: %m");
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Transaction "xid" or its subtransaction "subxid" aborted: their changes
+ * are forgotten.
+ */
+static void
+stream_abort(StreamMap *streams, TransactionId xid, TransactionId subxid)
+{
+  StreamedTxn **slot = stream_slot(streams, xid);
+  StreamedTxn *txn = *slot;
+
+  if (txn == NULL)
+    return;
+
+  if (subxid == xid)
+  {
+    *slot = txn->next;
+    if (streams->current == txn)
+      streams->current = NULL;
+    stream_free(txn);
+    return;
+  }
+
+  if (txn->naborted == txn->maxaborted)
+  {
+    txn->maxaborted = txn->maxaborted > 0 ? txn->maxaborted * 2 : 16;
+    txn->aborted = pg_realloc(txn->aborted,
+                              txn->maxaborted * sizeof(TransactionId));
+  }
+  txn->aborted[txn->naborted++] = subxid;
+}
+
+/*
+ * Transaction "xid" committed: prints its changes, but those of the
+ * subtransactions that aborted.
+ */
+static bool
+stream_commit(StreamMap *streams, TransactionId xid)
+{
+  StreamedTxn **slot = stream_slot(streams, xid);
+  StreamedTxn *txn = *slot;
+  PQExpBufferData line;
+  TransactionId subxid;
+  uint32      len;
+  bool        ok = true;
+
+  if (txn == NULL)
+    return true;
+  *slot = txn->next;
+  if (streams->current == txn)
+    streams->current = NULL;
+
+  initPQExpBuffer(&line);
+  rewind(txn->changes);
+  while (fread(&subxid, sizeof(subxid), 1, txn->changes) == 1)
+  {
+    bool        aborted = false;
+
+    if (fread(&len, sizeof(len), 1, txn->changes) != 1)
+    {
+      ok = false;
+      break;
+    }
+    resetPQExpBuffer(&line);
+    if (!enlargePQExpBuffer(&line, len) ||
+        fread(line.data, 1, len, txn->changes) != len)
+    {
+      ok = false;
+      break;
+    }
+
+    for (int i = 0; i < txn->naborted && !aborted; i++)
+      aborted = txn->aborted[i] == subxid;
+    if (!aborted)
+      printf("%.*s\n", (int) len, line.data);
+  }
+  if (!ok || ferror(txn->changes))
+  {
+    pg_log_error("could not read a temporary file");
+    ok = false;
+  }
+
+  termPQExpBuffer(&line);
+  stream_free(txn);
+
+  return ok;
+}
+
+/*
+ * Prints a change line, or keeps it until the commit of its transaction if
+ * it is streamed
+ */
+static bool
+print_change(StreamMap *streams, TransactionId xid, const char *line,
+             uint32 len)
+{
+  if (streams->current)
+    return stream_keep(streams, xid, line, len);
+
+  printf("%.*s\n", (int) len, line);
+  return true;
+}
+
+static const char *
+read_bytes(Reader *reader, size_t len)
+{
+  const char *p = reader->p;
+
+  if (reader->failed || (size_t) (reader->end - reader->p) < len)
+  {
+    reader->failed = true;
+    return NULL;
+  }
+  reader->p += len;
+
+  return p;
+}
+
+static uint8
+read_uint8(Reader *reader)
+{
+  const char *p = read_bytes(reader, 1);
+
+  return p ? (uint8) *p : 0;
+}
+
+static uint16
+read_uint16(Reader *reader)
+{
+  const char *p = read_bytes(reader, 2);
+  uint16      n = 0;
+
+  if (p)
+    memcpy(&n, p, 2);
+  return pg_ntoh16(n);
+}
+
+static uint32
+read_uint32(Reader *reader)
+{
+  const char *p = read_bytes(reader, 4);
+  uint32      n = 0;
+
+  if (p)
+    memcpy(&n, p, 4);
+  return pg_ntoh32(n);
+}
+
+static uint64
+read_uint64(Reader *reader)
+{
+  const char *p = read_bytes(reader, 8);
+
+  return p ? (uint64) read_int64(p) : 0;
+}
+
+// A string after its 16-bit length, as a new null-terminated copy
+static char *
+read_name(Reader *reader)
+{
+  uint16      len = read_uint16(reader);
+  const char *p = read_bytes(reader, len);
+
+  return p ? pnstrdup(p, len) : NULL;
+}
+
+/*
+ * Reads a relation record and stores the relation, replacing what was known
+ * of it.
+ */
+static bool
+decode_relation(Reader *reader, RelationMap *map)
+{
+  AuditRelation *relation = pg_malloc0(sizeof(AuditRelation));
+
+  relation->relid = read_uint32(reader);
+  relation->name = read_name(reader);
+  relation->natts = read_uint16(reader);
+  relation->attnames = pg_malloc0(Max(relation->natts, 1) * sizeof(char *));
+  for (int i = 0; i < relation->natts && !reader->failed; i++)
+    relation->attnames[i] = read_name(reader);
+
+  if (reader->failed)
+  {
+    relation_free(relation);
+    return false;
+  }
+
+  relation_store(map, relation);
+  return true;
+}
+
+/*
+ * Appends a value quoted as a SQL literal, like quote_literal() on the
+ * server: quotes and backslashes are doubled, with E'' for the latter.
+ */
+static void
+append_literal(PQExpBuffer line, const char *value, uint32 len)
+{
+  if (memchr(value, '\\', len) != NULL)
+    appendPQExpBufferChar(line, 'E');
+  appendPQExpBufferChar(line, '\'');
+  for (uint32 i = 0; i < len; i++)
+  {
+    if (value[i] == '\'' || value[i] == '\\')
+      appendPQExpBufferChar(line, value[i]);
+    appendPQExpBufferChar(line, value[i]);
+  }
+  appendPQExpBufferChar(line, '\'');
+}
+
+/*
+ * Appends " label: (column=value, ...)" for a tuple of a change record, with
+ * names and values quoted as the text format of the plugin does. Unchanged
+ * values are left out of changed tuples.
+ */
+static void
+decode_tuple(Reader *reader, AuditRelation *relation, const char *label,
+             bool changed, PQExpBuffer line)
+{
+  int         natts = read_uint16(reader);
+  bool        first = true;
+
+  appendPQExpBuffer(line, " %s: (", label);
+  for (int i = 0; i < natts && !reader->failed; i++)
+  {
+    uint8       kind = read_uint8(reader);
+
+    if (changed && kind == AUDIT_VALUE_UNCHANGED)
+      continue;
+
+    if (!first)
+      appendPQExpBufferStr(line, ", ");
+    first = false;
+    if (relation && i < relation->natts)
+      appendPQExpBuffer(line, "%s=", fmtId(relation->attnames[i]));
+
+    if (kind == AUDIT_VALUE_NULL)
+      appendPQExpBufferStr(line, "NULL");
+    else if (kind == AUDIT_VALUE_UNCHANGED)
+      appendPQExpBufferStr(line, "unchanged");
+    else if (kind == AUDIT_VALUE_TEXT)
+    {
+      uint32      len = read_uint32(reader);
+      const char *value = read_bytes(reader, len);
+
+      if (value)
+        append_literal(line, value, len);
+    }
+    else
+      reader->failed = true;
+  }
+  appendPQExpBufferChar(line, ')');
+}
+
+/*
+ * Decodes a message of plugin_audit in the binary format (see
+ * plugin_audit.h), and prints its changes as the text format does, followed
+ * by their tuples when the plugin sends them. Relation records go to "map".
+ * Streamed changes start with the xid of their subtransaction, and are
+ * kept in "streams" until their transaction ends.
+ *
+ * Returns false if the message cannot be read.
+ */
+static bool
+decode_binary(const char *data, int datalen, RelationMap *map,
+              StreamMap *streams, PQExpBuffer line)
+{
+  Reader      message = {data, data + datalen, false};
+  uint8       version = read_uint8(&message);
+
+  if (message.failed || version != AUDIT_BINARY_VERSION)
+  {
+    pg_log_error("unsupported binary format version %d", version);
+    return false;
+  }
+
+  while (message.p < message.end && !message.failed)
+  {
+    uint8       type = read_uint8(&message);
+    uint32      len = read_uint32(&message);
+    const char *body = read_bytes(&message, len);
+    Reader      record = {body, body + len, body == NULL};
+
+    switch (type)
+    {
+      case AUDIT_RECORD_RELATION:
+        if (!record.failed && !decode_relation(&record, map))
+          record.failed = true;
+        break;
+      case AUDIT_RECORD_INSERT:
+      case AUDIT_RECORD_UPDATE:
+      case AUDIT_RECORD_DELETE:
+        {
+          AuditRelation *relation;
+          TransactionId xid;
+          Oid         relid;
+          uint8       flags;
+
+          xid = read_uint32(&record);
+          (void) read_bytes(&record, 8);        // LSN
+          relid = read_uint32(&record);
+          flags = read_uint8(&record);
+          relation = relation_lookup(map, relid);
+
+          resetPQExpBuffer(line);
+          if (streams->current)
+            appendPQExpBuffer(line, "XID %u ", xid);
+          if (relation)
+            appendPQExpBufferStr(line, relation->name);
+          else
+            appendPQExpBuffer(line, "relation %u", relid);
+          appendPQExpBufferStr(line,
+                               type == AUDIT_RECORD_INSERT ? " INSERT" :
+                               type == AUDIT_RECORD_UPDATE ? " UPDATE" :
+                               " DELETE");
+          if (flags & AUDIT_TUPLE_OLD)
+            decode_tuple(&record, relation, "old", false, line);
+          if (flags & AUDIT_TUPLE_NEW)
+            decode_tuple(&record, relation, "new", false, line);
+          if (flags & AUDIT_TUPLE_CHANGED)
+            decode_tuple(&record, relation, "changed", true, line);
+
+          if (!record.failed &&
+              !print_change(streams, xid, line->data, line->len))
+            return false;
+        }
+        break;
+      case AUDIT_RECORD_STREAM_START:
+        {
+          TransactionId xid = read_uint32(&record);
+
+          if (!record.failed && !stream_start(streams, xid))
+            return false;
+        }
+        break;
+      case AUDIT_RECORD_STREAM_STOP:
+        streams->current = NULL;
+        break;
+      case AUDIT_RECORD_STREAM_COMMIT:
+        {
+          TransactionId xid = read_uint32(&record);
+          XLogRecPtr  lsn = read_uint64(&record);
+
+          if (record.failed)
+            break;
+          if (!stream_commit(streams, xid))
+            return false;
+          printf("STREAM COMMIT %u %X/%X\n", xid, LSN_FORMAT_ARGS(lsn));
+        }
+        break;
+      case AUDIT_RECORD_STREAM_ABORT:
+        {
+          TransactionId xid = read_uint32(&record);
+          TransactionId subxid = read_uint32(&record);
+
+          if (!record.failed)
+            stream_abort(streams, xid, subxid);
+        }
+        break;
+      case AUDIT_RECORD_SUMMARY:
+        {
+          TransactionId xid = read_uint32(&record);
+          XLogRecPtr  lsn = read_uint64(&record);
+          TimestampTz committed = (TimestampTz) read_uint64(&record);
+          int         nrelations = read_uint16(&record);
+
+          resetPQExpBuffer(line);
+          appendPQExpBuffer(line, "TRANSACTION %u COMMIT %X/%X AT %s:",
+                            xid, LSN_FORMAT_ARGS(lsn),
+                            timestamp_to_str(committed));
+          for (int i = 0; i < nrelations && !record.failed; i++)
+          {
+            char       *name = read_name(&record);
+            uint64      inserts = read_uint64(&record);
+            uint64      updates = read_uint64(&record);
+            uint64      deletes = read_uint64(&record);
+
+            appendPQExpBuffer(line, "%s %s INSERT " UINT64_FORMAT " UPDATE "
+                              UINT64_FORMAT " DELETE " UINT64_FORMAT,
+                              i > 0 ? "," : "", name ? name : "",
+                              inserts, updates, deletes);
+            pg_free(name);
+          }
+
+          if (!record.failed)
+            printf("%s\n", line->data);
+        }
+        break;
+      default:
+        // from a newer plugin, skipped
+        break;
+    }
+
+    if (record.failed)
+      message.failed = true;
+  }
+
+  if (message.failed)
+  {
+    pg_log_error("invalid binary message");
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Handles a message of plugin_audit in the text format: a stream marker, or
+ * change lines, several with batching. Streamed changes start with the xid
+ * of their subtransaction, and are kept in "streams" until their
+ * transaction ends. Their lines are split at the newlines out of quotes, as
+ * quoted names and values can hold some. Copy data ends with a zero byte.
+ *
+ * Returns false if streamed changes cannot be kept.
+ */
+static bool
+decode_text(const char *data, int datalen, StreamMap *streams)
+{
+  const char *end = data + datalen;
+  TransactionId xid;
+  TransactionId subxid;
+  uint32      hi;
+  uint32      lo;
+
+  if (sscanf(data, "STREAM START %u", &xid) == 1)
+    return stream_start(streams, xid);
+  if (strncmp(data, "STREAM STOP ", 12) == 0)
+  {
+    streams->current = NULL;
+    return true;
+  }
+  if (sscanf(data, "STREAM COMMIT %u %X/%X", &xid, &hi, &lo) == 3)
+  {
+    if (!stream_commit(streams, xid))
+      return false;
+    printf("%.*s\n", datalen, data);
+    return true;
+  }
+  if (sscanf(data, "STREAM ABORT %u OF %u", &subxid, &xid) == 2)
+  {
+    stream_abort(streams, xid, subxid);
+    return true;
+  }
+  if (sscanf(data, "STREAM ABORT %u", &xid) == 1)
+  {
+    stream_abort(streams, xid, xid);
+    return true;
+  }
+
+  if (streams->current == NULL)
+  {
+    printf("%.*s\n", datalen, data);
+    return true;
+  }
+
+  while (data < end)
+  {
+    const char *p = data;
+    char        quote = '\0';
+
+    for (; p < end && (*p != '\n' || quote); p++)
+    {
+      if (*p == quote)
+        quote = '\0';
+      else if (!quote && (*p == '\'' || *p == '"'))
+        quote = *p;
+    }
+
+    xid = strncmp(data, "XID ", 4) == 0 ? strtoul(data + 4, NULL, 10) :
+      streams->current->xid;
+    if (!stream_keep(streams, xid, data, p - data))
+      return false;
+    data = p + 1;
+  }
+
+  return true;
+}
+
+/*
+ * Sends a standby status update: everything up to "flushed" was written
+ * out, so the slot can move forward and the server can free its WAL.
+ */
+static bool
+send_feedback(PGconn *conn, XLogRecPtr flushed, bool reply_requested)
+{
+  char        reply[1 + 8 + 8 + 8 + 8 + 1];
+
+  reply[0] = 'r';
+  write_int64(&reply[1], flushed);       // written
+  write_int64(&reply[9], flushed);       // flushed
+  write_int64(&reply[17], InvalidXLogRecPtr); // applied
+  write_int64(&reply[25], current_timestamp());
+  reply[33] = reply_requested ? 1 : 0;
+
+  if (PQputCopyData(conn, reply, sizeof(reply)) <= 0 || PQflush(conn) != 0)
+  {
+    pg_log_error("could not send feedback: %s", PQerrorMessage(conn));
+    return false;
+  }
+
+  return true;
+}
+
+/*
+ * Streams the changes of the slot with START_REPLICATION, until
+ * interrupted. plugin_audit only decodes the changes of "table", given as
+ * its include-tables option. With "binary", the plugin uses its binary
+ * format, decoded here, and with "tuples" it also sends column values.
+ *
+ * With "changed", UPDATEs come with the values of their primary key and of
+ * their changed columns. Tables need REPLICA IDENTITY FULL, otherwise the
+ * plugin warns and sends every column.
+ *
+ * With "batch_size", the plugin writes the changes of a transaction
+ * together, in messages of about that size: fewer messages to send and to
+ * read here.
+ *
+ * With "summary", the plugin only sends one TRANSACTION line per committed
+ * transaction, with its changes counted per relation and action.
+ *
+ * With "stream", large transactions come in blocks before their commit,
+ * between STREAM START and STREAM STOP markers. Their changes are kept in
+ * a temporary file until the STREAM COMMIT marker, then printed after the
+ * xid of their subtransaction, but for the subtransactions a STREAM ABORT
+ * marker voided. An aborted transaction prints nothing. Without it, the
+ * server holds them, spilled to disk, until the commit.
+ *
+ * XLogData messages come one by one from PQgetCopyData() in async mode, so
+ * only one change at a time is in memory, whatever the size of the
+ * transactions. Changes are printed as soon as they arrive, and their LSN
+ * goes back as flushed in the next standby status update, sent every
+ * "status_interval" seconds or when the server asks for it.
+ *
+ * Returns false on error.
+ */
+static bool
+stream_changes(PGconn *conn, const char *slot, const char *table,
+               int status_interval, bool binary, bool tuples, bool stream,
+               bool summary, bool changed, const char *batch_size,
+               bool echo)
+{
+  PQExpBufferData sql;
+  PQExpBufferData line;
+  RelationMap relations = {NULL, 0, 0};
+  StreamMap   streams = {NULL, NULL};
+  PGresult   *result;
+  XLogRecPtr  flushed = InvalidXLogRecPtr;
+  TimestampTz last_feedback = current_timestamp();
+  bool        ok = true;
+
+  initPQExpBuffer(&sql);
+  appendPQExpBuffer(&sql, "START_REPLICATION SLOT %s LOGICAL 0/0", fmtId(slot));
+  appendPQExpBufferStr(&sql, " (\"include-tables\" ");
+  appendStringLiteralConn(&sql, table, conn);
+  if (binary)
+    appendPQExpBufferStr(&sql, ", \"format\" 'binary'");
+  if (tuples)
+    appendPQExpBufferStr(&sql, ", \"include-tuples\" 'on'");
+  if (stream)
+    appendPQExpBufferStr(&sql, ", \"stream-changes\" 'on'");
+  if (summary)
+    appendPQExpBufferStr(&sql, ", \"summary\" 'on'");
+  if (changed)
+    appendPQExpBufferStr(&sql, ", \"changed-columns\" 'on'");
+  if (batch_size)
+  {
+    appendPQExpBufferStr(&sql, ", \"batch-size\" ");
+    appendStringLiteralConn(&sql, batch_size, conn);
+  }
+  appendPQExpBufferChar(&sql, ')');
+  if (echo)
+    printf("%s\n", sql.data);
+  result = PQexec(conn, sql.data);
+  if (PQresultStatus(result) != PGRES_COPY_BOTH)
+  {
+    pg_log_error("start replication failed: %s", PQerrorMessage(conn));
+    PQclear(result);
+    termPQExpBuffer(&sql);
+    return false;
+  }
+  PQclear(result);
+  termPQExpBuffer(&sql);
+
+  initPQExpBuffer(&line);
+
+  while (keepRunning)
+  {
+    char       *copybuf = NULL;
+    int         len;
+    TimestampTz now = current_timestamp();
+
+    if (now - last_feedback >= (TimestampTz) status_interval * USECS_PER_SEC)
+    {
+      if (!send_feedback(conn, flushed, false))
+      {
+        ok = false;
+        break;
+      }
+      last_feedback = now;
+    }
+
+    len = PQgetCopyData(conn, &copybuf, 1);
+    if (len == 0)
+    {
+      int           sock = PQsocket(conn);
+      fd_set        input_mask;
+      struct timeval timeout;
+      int64         wait;
+
+      // Nothing yet: sleep until data comes, or the next status update
+      wait = (TimestampTz) status_interval * USECS_PER_SEC - (now - last_feedback);
+      timeout.tv_sec = wait / USECS_PER_SEC;
+      timeout.tv_usec = wait % USECS_PER_SEC;
+
+      FD_ZERO(&input_mask);
+      FD_SET(sock, &input_mask);
+      if (select(sock + 1, &input_mask, NULL, NULL, &timeout) < 0 &&
+          errno != EINTR)
+      {
+        pg_log_error("select() failed: %m");
+        ok = false;
+        break;
+      }
+
+      if (!PQconsumeInput(conn))
+      {
+        pg_log_error("could not receive data: %s", PQerrorMessage(conn));
+        ok = false;
+        break;
+      }
+      continue;
+    }
+
+    if (len == -1)
+      break;                // the server ended the stream
+
+    if (len == -2)
+    {
+      pg_log_error("could not read copy data: %s", PQerrorMessage(conn));
+      ok = false;
+      break;
+    }
+
+    if (copybuf[0] == 'k' && len >= 1 + 8 + 8 + 1)
+    {
+      // Keepalive: everything received was printed, the slot can move up
+      // to the end of the WAL the server has seen
+      XLogRecPtr  end = read_int64(&copybuf[1]);
+      bool        reply_requested = copybuf[17] != 0;
+
+      flushed = Max(flushed, end);
+      if (reply_requested)
+      {
+        if (!send_feedback(conn, flushed, false))
+        {
+          PQfreemem(copybuf);
+          ok = false;
+          break;
+        }
+        last_feedback = current_timestamp();
+      }
+    }
+    else if (copybuf[0] == 'w' && len >= 1 + 8 + 8 + 8)
+    {
+      // XLogData: start, end and send time, then what the plugin wrote
+      XLogRecPtr  start = read_int64(&copybuf[1]);
+      const char *data = copybuf + 1 + 8 + 8 + 8;
+      int         datalen = len - (1 + 8 + 8 + 8);
+
+      if (!(binary ?
+            decode_binary(data, datalen, &relations, &streams, &line) :
+            decode_text(data, datalen, &streams)))
+      {
+        PQfreemem(copybuf);
+        ok = false;
+        break;
+      }
+      fflush(stdout);
+      flushed = Max(flushed, start);
+    }
+    else
+      pg_log_warning("unexpected message type \"%c\"", copybuf[0]);
+
+    PQfreemem(copybuf);
+  }
+
+  // Last status update, then end the stream, even after an error of ours
+  if (PQstatus(conn) == CONNECTION_OK)
+  {
+    (void) send_feedback(conn, flushed, false);
+    if (PQputCopyEnd(conn, NULL) <= 0 || PQflush(conn) != 0)
+      pg_log_error("could not end the stream: %s", PQerrorMessage(conn));
+  }
+
+  // Leftover copy data, then the end of the command
+  while (PQstatus(conn) == CONNECTION_OK)
+  {
+    char   *copybuf = NULL;
+    int     len = PQgetCopyData(conn, &copybuf, 0);
+
+    if (copybuf)
+      PQfreemem(copybuf);
+    if (len < 0)
+      break;
+  }
+  while ((result = PQgetResult(conn)))
+  {
+    if (PQresultStatus(result) != PGRES_COMMAND_OK &&
+        PQresultStatus(result) != PGRES_COPY_BOTH)
+    {
+      pg_log_error("replication ended with an error: %s",
+                   PQresultErrorMessage(result));
+      ok = false;
+    }
+    PQclear(result);
+  }
+
+  pg_log_info("stream stopped at %X/%X", LSN_FORMAT_ARGS(flushed));
+
+  termPQExpBuffer(&line);
+  relation_map_free(&relations);
+  stream_map_free(&streams);
+
+  return ok;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -42,6 +1030,13 @@ main(int argc, char **argv)
     {"port", required_argument, NULL, 'p'},
     {"username", required_argument, NULL, 'U'},
     {"echo", no_argument, NULL, 'e'},
+    {"status-interval", required_argument, NULL, 's'},
+    {"binary", no_argument, NULL, 'b'},
+    {"tuples", no_argument, NULL, 1},
+    {"stream", no_argument, NULL, 2},
+    {"summary", no_argument, NULL, 3},
+    {"batch-size", required_argument, NULL, 4},
+    {"changed-columns", no_argument, NULL, 5},
     {NULL, 0, NULL, 0}
   };
   int           optindex;
@@ -52,6 +1047,16 @@ main(int argc, char **argv)
   char         *username = NULL;
   char         *table = NULL;
   bool          echo = false;
+  int           status_interval = 10;
+  bool          binary = false;
+  bool          tuples = false;
+  bool          stream = false;
+  bool          summary = false;
+  char         *batch_size = NULL;
+  bool          changed = false;
+  PQExpBufferData connstr;
+  char         *slot;
+  bool          ok;
 
   pg_logging_init(argv[0]);
   progname = get_progname(argv[0]);
@@ -60,10 +1065,13 @@ main(int argc, char **argv)
 
   // Get options
 
-  while ((c = getopt_long(argc, argv, "d:eh:p:U:", long_options, &optindex)) != -1)
+  while ((c = getopt_long(argc, argv, "bd:eh:p:s:U:", long_options, &optindex)) != -1)
   {
     switch (c)
     {
+      case 'b':
+        binary = true;
+        break;
       case 'd':
         dbname = pg_strdup(optarg);
         break;
@@ -79,6 +1087,27 @@ main(int argc, char **argv)
       case 'U':
         username = pg_strdup(optarg);
         break;
+      case 's':
+        if (!option_parse_int(optarg, "-s/--status-interval", 1, INT_MAX,
+                              &status_interval))
+          exit(1);
+        break;
+      case 1:
+        binary = true;
+        tuples = true;
+        break;
+      case 2:
+        stream = true;
+        break;
+      case 3:
+        summary = true;
+        break;
+      case 4:
+        batch_size = pg_strdup(optarg);
+        break;
+      case 5:
+        changed = true;
+        break;
       case 0:
         /* this covers the long options */
         break;
@@ -92,6 +1121,17 @@ main(int argc, char **argv)
   if (!dbname)
     dbname = "postgres";
 
+  if (tuples && summary)
+  {
+    pg_log_error("options --tuples and --summary cannot be used together");
+    exit(1);
+  }
+  if (changed && summary)
+  {
+    pg_log_error("options --changed-columns and --summary cannot be used together");
+    exit(1);
+  }
+
   switch (argc - optind)
   {
     case 0:
@@ -108,9 +1148,14 @@ main(int argc, char **argv)
       exit(1);
   }
 
-  // Connect to the database
+  // Connect to the database, as a logical replication client
+
+  initPQExpBuffer(&connstr);
+  appendPQExpBufferStr(&connstr, "dbname=");
+  appendConnStrVal(&connstr, dbname);
+  appendPQExpBufferStr(&connstr, " replication=database");
 
-  cparams.dbname = dbname;
+  cparams.dbname = connstr.data;
   cparams.pghost = host;
   cparams.pgport = port;
   cparams.pguser = username;
@@ -126,11 +1171,13 @@ main(int argc, char **argv)
   pg_log_info("Auditing table \"%s\"...", table);
 
   // Create logical slot
+  slot = psprintf("audit_%d", PQbackendPID(conn));
   initPQExpBuffer(&sql);
-  appendPQExpBuffer(&sql,
+  appendPQExpBufferStr(&sql,
     "SELECT * FROM "
-    "pg_create_logical_replication_slot('audit_%d', 'plugin_audit', false, true);",
-    PQbackendPID(conn));
+    "pg_create_logical_replication_slot(");
+  appendStringLiteralConn(&sql, slot, conn);
+  appendPQExpBufferStr(&sql, ", 'plugin_audit', false, true);");
   if (echo)
     printf("%s\n", sql.data);
   result = PQexec(conn, sql.data);
@@ -143,41 +1190,17 @@ main(int argc, char **argv)
   PQclear(result);
   termPQExpBuffer(&sql);
 
-  // Loop for new changes
-  initPQExpBuffer(&sql);
-  appendPQExpBuffer(&sql,
-    "SELECT * FROM "
-    "pg_logical_slot_get_changes('audit_%d', NULL, NULL);",
-    PQbackendPID(conn));
-  while (keepRunning)
-  {
-    if (echo)
-      printf("%s\n", sql.data);
-    result = PQexec(conn, sql.data);
-    if (PQresultStatus(result) != PGRES_TUPLES_OK)
-    {
-      pg_log_error("get changes failed: %s", PQerrorMessage(conn));
-      PQfinish(conn);
-      exit(1);
-    }
-    for (int ligne = 0 ; ligne < PQntuples(result) ; ligne++)
-    {
-      if (strstr(PQgetvalue(result, ligne, 2), table))
-      {
-        printf("%s\n", PQgetvalue(result, ligne, 2));
-      }
-    }
-    PQclear(result);
-    sleep(1);
-  }
-  termPQExpBuffer(&sql);
+  // Stream changes until interrupted
+  ok = stream_changes(conn, slot, table, status_interval, binary, tuples,
+                      stream, summary, changed, batch_size, echo);
 
   // Drop logical slot
   initPQExpBuffer(&sql);
-  appendPQExpBuffer(&sql,
+  appendPQExpBufferStr(&sql,
     "SELECT * FROM "
-    "pg_drop_replication_slot('audit_%d');",
-    PQbackendPID(conn));
+    "pg_drop_replication_slot(");
+  appendStringLiteralConn(&sql, slot, conn);
+  appendPQExpBufferStr(&sql, ");");
   if (echo)
     printf("%s\n", sql.data);
   result = PQexec(conn, sql.data);
@@ -194,7 +1217,7 @@ main(int argc, char **argv)
 
   PQfinish(conn);
 
-  exit(0);
+  exit(ok ? 0 : 1);
 }
 
 static void
@@ -203,8 +1226,20 @@ help(const char *progname)
 	printf("%s records PostgreSQL statistics.\n\n", progname);
 	printf("Usage:\n");
 	printf("  %s TABLE [OPTION]...\n", progname);
+	printf("\nTABLE may be schema-qualified, and follows the SQL quoting rules.\n");
 	printf("\nOptions:\n");
+	printf("  -b, --binary              use the binary format of the plugin\n");
+	printf("      --batch-size=SIZE     send changes in messages of SIZE (like 64kB)\n");
+	printf("      --changed-columns     show the key and changed columns of updates (needs\n"
+		   "                            REPLICA IDENTITY FULL, or shows every column)\n");
 	printf("  -e, --echo                show the commands being sent to the server\n");
+	printf("  -s, --status-interval=SECS\n"
+		   "                            time between status updates sent to the server\n"
+		   "                            (default: 10)\n");
+	printf("      --stream              receive large transactions before their commit,\n"
+		   "                            kept in a temporary file until then\n");
+	printf("      --summary             show one line of counts per transaction\n");
+	printf("      --tuples              show the values of the changed rows (implies -b)\n");
 	printf("  -V, --version             output version information, then exit\n");
 	printf("  -?, --help                show this help, then exit\n");
 	printf("\nConnection options:\n");
@@ -0,0 +1,93 @@
+#!/bin/bash
+#
+# Débit de décodage de plugin_audit : un slot relit plusieurs fois les mêmes
+# modifications avec pg_logical_slot_peek_changes(), qui ne consomme rien.
+# Les lignes sont insérées une par transaction, puis modifiées toutes dans
+# une seule transaction, ce qui donne du travail au regroupement.
+# Le plugin doit être installé et wal_level à logical. Pour comparer deux
+# versions du plugin, lancer le script après l'installation de chacune en
+# changeant ETIQUETTE : les mesures s'ajoutent au même fichier.
+#
+# La connexion se règle avec les variables PGHOST, PGPORT, PGDATABASE...
+# Variables propres au script :
+#   ETIQUETTE  nom de la version mesurée (défaut : "actuel")
+#   LIGNES     nombre de lignes modifiées (défaut : 200000)
+#   TABLES     nombre de tables entre lesquelles elles sont réparties (défaut : 10)
+#   PASSES     nombre de décodages par mesure (défaut : 5)
+#   LOTS       valeur de l'option batch-size pour la dernière mesure
+#              (défaut : 64kB)
+#   RESULTATS  répertoire des résultats (défaut : ./resultats)
+#
+
+set -e
+
+ETIQUETTE=${ETIQUETTE:-actuel}
+LIGNES=${LIGNES:-200000}
+TABLES=${TABLES:-10}
+PASSES=${PASSES:-5}
+LOTS=${LOTS:-64kB}
+RESULTATS=${RESULTATS:-./resultats}
+SLOT=bench_audit
+
+mkdir -p "$RESULTATS"
+
+psql -X -q -v ON_ERROR_STOP=1 <<SQL
+SELECT pg_drop_replication_slot(slot_name)
+  FROM pg_replication_slots WHERE slot_name = '$SLOT';
+DROP SCHEMA IF EXISTS bench_audit CASCADE;
+CREATE SCHEMA bench_audit;
+SELECT format('CREATE TABLE bench_audit.t%s (id int PRIMARY KEY, valeur int)', t)
+  FROM generate_series(1, $TABLES) t \gexec
+SELECT 'init' FROM pg_create_logical_replication_slot('$SLOT', 'plugin_audit');
+-- les modifications alternent entre les tables, comme dans une vraie charge
+SELECT format('INSERT INTO bench_audit.t%s VALUES (%s, 0)', i % $TABLES + 1, i)
+  FROM generate_series(1, $LIGNES) i \gexec
+BEGIN;
+SELECT format('UPDATE bench_audit.t%s SET valeur = valeur + 1', t)
+  FROM generate_series(1, $TABLES) t \gexec
+COMMIT;
+SQL
+
+if [ ! -f "$RESULTATS/decodage.csv" ]; then
+  # une ligne par mesure : etiquette;options;passe;lignes;millisecondes
+  echo "etiquette;options;passe;lignes;millisecondes" > "$RESULTATS/decodage.csv"
+fi
+
+mesure()
+{
+  nom=$1
+  options=$2
+
+  for passe in $(seq "$PASSES"); do
+    debut=$(date +%s%N)
+    # avec regroupement, un message contient plusieurs lignes
+    lignes=$(psql -X -A -t -v ON_ERROR_STOP=1 -c \
+      "SELECT sum(length(data) - length(replace(data, E'\\n', '')) + 1)
+         FROM pg_logical_slot_peek_changes('$SLOT', NULL, NULL $options)")
+    fin=$(date +%s%N)
+    echo "$ETIQUETTE;$nom;$passe;$lignes;$(( (fin - debut) / 1000000 ))" \
+      >> "$RESULTATS/decodage.csv"
+  done
+}
+
+# sans filtre, puis avec un filtre qui garde la moitié des tables
+mesure tout ""
+mesure filtre ", 'exclude-tables', '$(seq -s, -f 'bench_audit.t%g' 1 2 "$TABLES")'"
+mesure lots ", 'batch-size', '$LOTS'"
+
+psql -X -q -c "SELECT pg_drop_replication_slot('$SLOT')"
+
+# synthèse : meilleure passe de chaque mesure
+echo
+echo "Synthèse (modifications décodées par seconde, meilleure passe) :"
+awk -F';' 'NR > 1 {
+  cle = $1 ";" $2
+  if (!(cle in meilleur) || $5 < meilleur[cle]) { meilleur[cle] = $5; lignes[cle] = $4 }
+}
+END {
+  for (cle in meilleur) {
+    split(cle, c, ";")
+    printf "%-20s %-8s %10d lignes %12.0f par seconde\n", c[1], c[2], lignes[cle],
+      1000 * lignes[cle] / (meilleur[cle] > 0 ? meilleur[cle] : 1)
+  }
+}' "$RESULTATS/decodage.csv" | sort | tee "$RESULTATS/synthese_decodage.txt"
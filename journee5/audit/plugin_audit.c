@@ -1,22 +1,123 @@
 #include "postgres.h"
 
+#include "access/htup_details.h"
+#include "access/sysattr.h"
+
+#include "catalog/pg_index.h"
 #include "catalog/pg_type.h"
 
+#include "libpq/pqformat.h"
+
+#include "parser/scansup.h"
+
 #include "replication/logical.h"
 #include "replication/origin.h"
 
 #include "utils/builtins.h"
+#include "utils/datum.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
+#include "utils/timestamp.h"
+
+#if PG_VERSION_NUM >= 160000
+#include "varatt.h"
+#endif
+
+#include "plugin_audit.h"
 
 PG_MODULE_MAGIC;
 
+/* tuples of changes are HeapTuples since PostgreSQL 17 */
+#if PG_VERSION_NUM >= 170000
+#define ChangeTuple(buf)	(buf)
+#else
+#define ChangeTuple(buf)	(&(buf)->tuple)
+#endif
+
+#if PG_VERSION_NUM >= 160000
+#define TopTxn(txn)			rbtxn_get_toptxn(txn)
+#else
+#define TopTxn(txn)			((txn)->toptxn ? (txn)->toptxn : (txn))
+#endif
+
+#if PG_VERSION_NUM >= 150000
+#define CommitTime(txn)		((txn)->xact_time.commit_time)
+#else
+#define CommitTime(txn)		((txn)->commit_time)
+#endif
+
 typedef struct
 {
 	MemoryContext context;
+	MemoryContext cache_context;	/* AuditRelations and its names */
+	MemoryContextCallback cache_reset;	/* forgets AuditRelations */
+
+	/*
+	 * Relations to decode, from the include-* and exclude-* options: lists
+	 * of AuditName. Without include list, every relation not excluded is
+	 * decoded.
+	 */
+	List	   *include;
+	List	   *exclude;
+
+	bool		binary;			/* format binary, see plugin_audit.h */
+	bool		include_tuples; /* column values, in binary format */
+	bool		changed_columns;	/* key and changed columns of UPDATEs */
+	bool		summary;		/* one record per transaction */
+
+	/*
+	 * Changes of a transaction not written yet, up to batch_size bytes, then
+	 * written as one message. Batching is off when batch_size is 0.
+	 */
+	int			batch_size;
+	StringInfoData batch;
 } AuditDecodingData;
 
+/*
+ * A name from the options: a schema (relname is NULL), or a relation,
+ * optionally schema-qualified (nspname is NULL when it is not).
+ */
+typedef struct
+{
+	char	   *nspname;
+	char	   *relname;
+} AuditName;
+
+/*
+ * What the output needs about a relation, built on its first change and
+ * kept until an invalidation, so that most changes cost a single hash
+ * lookup: no syscache lookup, no quoting.
+ */
+typedef struct
+{
+	Oid			relid;			/* hash key */
+	bool		valid;			/* false once invalidated */
+	bool		audited;		/* changes are decoded */
+	char	   *qualified_name; /* quoted, in cache_context */
+
+	/* binary format */
+	bool		sent;			/* relation record sent */
+	int			natts;			/* columns, dropped ones excepted */
+
+	/* per attribute, with include-tuples or changed-columns */
+	FmgrInfo   *output_functions;
+	bool	   *varlena;
+
+	/* with changed-columns */
+	bool		identity_full;	/* old tuples are complete */
+	bool	   *key;			/* per attribute, in the primary key */
+	bool		warned;			/* warning without FULL identity given */
+} AuditRelationEntry;
+
+/* relid => AuditRelationEntry, for the current decoding session */
+static HTAB *AuditRelations = NULL;
+static bool relation_callbacks_registered = false;
+
 /*
  * Maintain the per-transaction level variables to track whether the
  * transaction and or streams have written any changes. In streaming mode the
@@ -30,8 +131,35 @@ typedef struct
 {
 	bool		xact_wrote_changes;
 	bool		stream_wrote_changes;
+
+	/*
+	 * Summary mode: list of AuditTxnCounter, and the last one used, as
+	 * changes often come in runs on the same relation.
+	 */
+	List	   *counters;
+	struct AuditTxnCounter *last_counter;
 } AuditDecodingTxnData;
 
+/*
+ * Changes of a (sub)transaction on a relation, in summary mode. Streamed
+ * subtransactions can abort after their changes were counted, so they are
+ * counted apart.
+ */
+typedef struct AuditTxnCounter
+{
+	Oid			relid;
+	TransactionId xid;
+	char	   *qualified_name;
+	uint64		counts[3];		/* by AuditAction */
+} AuditTxnCounter;
+
+typedef enum
+{
+	AUDIT_ACTION_INSERT,
+	AUDIT_ACTION_UPDATE,
+	AUDIT_ACTION_DELETE
+} AuditAction;
+
 static void pg_decode_startup(LogicalDecodingContext *ctx,
                OutputPluginOptions *opt,
 							 bool is_init);
@@ -43,6 +171,26 @@ static void pg_decode_commit_txn(LogicalDecodingContext *ctx,
 static void pg_decode_change(LogicalDecodingContext *ctx,
 							 ReorderBufferTXN *txn, Relation relation,
 							 ReorderBufferChange *change);
+static void pg_decode_stream_start(LogicalDecodingContext *ctx,
+								   ReorderBufferTXN *txn);
+static void pg_decode_stream_stop(LogicalDecodingContext *ctx,
+								  ReorderBufferTXN *txn);
+static void pg_decode_stream_abort(LogicalDecodingContext *ctx,
+								   ReorderBufferTXN *txn,
+								   XLogRecPtr abort_lsn);
+static void pg_decode_stream_commit(LogicalDecodingContext *ctx,
+									ReorderBufferTXN *txn,
+									XLogRecPtr commit_lsn);
+static void pg_decode_stream_change(LogicalDecodingContext *ctx,
+									ReorderBufferTXN *txn,
+									Relation relation,
+									ReorderBufferChange *change);
+static List *parse_name_list(DefElem *elem, bool schemas);
+static AuditRelationEntry *get_relation_entry(AuditDecodingData *data,
+											  Relation relation);
+static void audit_relcache_callback(Datum arg, Oid relid);
+static void audit_cache_reset_callback(void *arg);
+static void audit_syscache_callback(Datum arg, int cacheid, uint32 hashvalue);
 
 void
 _PG_init(void)
@@ -59,6 +207,11 @@ _PG_output_plugin_init(OutputPluginCallbacks *cb)
 	cb->change_cb = pg_decode_change;
 	cb->commit_cb = pg_decode_commit_txn;
 	cb->shutdown_cb = pg_decode_shutdown;
+	cb->stream_start_cb = pg_decode_stream_start;
+	cb->stream_stop_cb = pg_decode_stream_stop;
+	cb->stream_abort_cb = pg_decode_stream_abort;
+	cb->stream_commit_cb = pg_decode_stream_commit;
+	cb->stream_change_cb = pg_decode_stream_change;
 }
 
 
@@ -68,6 +221,9 @@ pg_decode_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 				  bool is_init)
 {
 	AuditDecodingData *data;
+	ListCell   *option;
+	HASHCTL		ctl;
+	bool		enable_streaming = false;
 
 	data = palloc0(sizeof(AuditDecodingData));
 	data->context = AllocSetContextCreate(ctx->context,
@@ -75,10 +231,771 @@ pg_decode_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
 										  ALLOCSET_DEFAULT_SIZES);
 	ctx->output_plugin_private = data;
 
-	opt->output_type = OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
 	opt->receive_rewrites = false;
 
-  /* we don't have any options yet, but that would be the place to do it */
+	foreach(option, ctx->output_plugin_options)
+	{
+		DefElem    *elem = lfirst(option);
+
+		Assert(elem->arg == NULL || IsA(elem->arg, String));
+
+		if (strcmp(elem->defname, "include-tables") == 0)
+			data->include = list_concat(data->include,
+										parse_name_list(elem, false));
+		else if (strcmp(elem->defname, "include-schemas") == 0)
+			data->include = list_concat(data->include,
+										parse_name_list(elem, true));
+		else if (strcmp(elem->defname, "exclude-tables") == 0)
+			data->exclude = list_concat(data->exclude,
+										parse_name_list(elem, false));
+		else if (strcmp(elem->defname, "exclude-schemas") == 0)
+			data->exclude = list_concat(data->exclude,
+										parse_name_list(elem, true));
+		else if (strcmp(elem->defname, "format") == 0)
+		{
+			if (elem->arg != NULL && strcmp(strVal(elem->arg), "text") == 0)
+				data->binary = false;
+			else if (elem->arg != NULL && strcmp(strVal(elem->arg), "binary") == 0)
+				data->binary = true;
+			else
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								elem->arg ? strVal(elem->arg) : "(null)",
+								elem->defname),
+						 errhint("Valid values are \"text\" and \"binary\".")));
+		}
+		else if (strcmp(elem->defname, "stream-changes") == 0)
+		{
+			/* if option does not provide a value, it means its value is true */
+			if (elem->arg == NULL)
+				enable_streaming = true;
+			else if (!parse_bool(strVal(elem->arg), &enable_streaming))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								strVal(elem->arg), elem->defname)));
+		}
+		else if (strcmp(elem->defname, "summary") == 0)
+		{
+			/* if option does not provide a value, it means its value is true */
+			if (elem->arg == NULL)
+				data->summary = true;
+			else if (!parse_bool(strVal(elem->arg), &data->summary))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								strVal(elem->arg), elem->defname)));
+		}
+		else if (strcmp(elem->defname, "batch-size") == 0)
+		{
+			if (elem->arg == NULL ||
+				!parse_int(strVal(elem->arg), &data->batch_size,
+						   GUC_UNIT_BYTE, NULL) ||
+				data->batch_size < 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								elem->arg ? strVal(elem->arg) : "(null)",
+								elem->defname)));
+		}
+		else if (strcmp(elem->defname, "changed-columns") == 0)
+		{
+			/* if option does not provide a value, it means its value is true */
+			if (elem->arg == NULL)
+				data->changed_columns = true;
+			else if (!parse_bool(strVal(elem->arg), &data->changed_columns))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								strVal(elem->arg), elem->defname)));
+		}
+		else if (strcmp(elem->defname, "include-tuples") == 0)
+		{
+			/* if option does not provide a value, it means its value is true */
+			if (elem->arg == NULL)
+				data->include_tuples = true;
+			else if (!parse_bool(strVal(elem->arg), &data->include_tuples))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("could not parse value \"%s\" for parameter \"%s\"",
+								strVal(elem->arg), elem->defname)));
+		}
+		else
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("option \"%s\" = \"%s\" is unknown",
+							elem->defname,
+							elem->arg ? strVal(elem->arg) : "(null)")));
+	}
+
+	if (data->include_tuples && !data->binary)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("option \"include-tuples\" requires the binary format")));
+	if (data->include_tuples && data->summary)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("options \"include-tuples\" and \"summary\" cannot be used together")));
+	if (data->changed_columns && data->summary)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("options \"changed-columns\" and \"summary\" cannot be used together")));
+
+	opt->output_type = data->binary ?
+		OUTPUT_PLUGIN_BINARY_OUTPUT : OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
+
+	if (data->batch_size > 0)
+		initStringInfo(&data->batch);
+
+	/*
+	 * Large transactions are streamed before their commit only when asked:
+	 * the client must then handle the aborts.
+	 */
+	ctx->streaming &= enable_streaming;
+
+	/*
+	 * Names and decisions are cached per relation, and rebuilt when the
+	 * relation or a schema changes: a rename changes the name, and can make
+	 * the relation match a filter, or not. Callbacks cannot be removed, they
+	 * are registered once per backend and follow AuditRelations, which is
+	 * forgotten with its context: after an error, shutdown is not called.
+	 */
+	data->cache_context = AllocSetContextCreate(ctx->context,
+												"plugin_audit relation cache",
+												ALLOCSET_SMALL_SIZES);
+	data->cache_reset.func = audit_cache_reset_callback;
+	data->cache_reset.arg = NULL;
+	MemoryContextRegisterResetCallback(data->cache_context, &data->cache_reset);
+	ctl.keysize = sizeof(Oid);
+	ctl.entrysize = sizeof(AuditRelationEntry);
+	ctl.hcxt = data->cache_context;
+	AuditRelations = hash_create("plugin_audit relations", 128, &ctl,
+								 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	if (!relation_callbacks_registered)
+	{
+		CacheRegisterRelcacheCallback(audit_relcache_callback, (Datum) 0);
+		CacheRegisterSyscacheCallback(NAMESPACEOID, audit_syscache_callback,
+									  (Datum) 0);
+		relation_callbacks_registered = true;
+	}
+}
+
+/*
+ * Parses the value of an include-* or exclude-* option: a comma-separated
+ * list of schemas, or of relations, each optionally schema-qualified.
+ * Identifiers follow the SQL rules, downcased unless double-quoted.
+ */
+static List *
+parse_name_list(DefElem *elem, bool schemas)
+{
+	List	   *names = NIL;
+	const char *p;
+
+	if (elem->arg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("option \"%s\" needs a value", elem->defname)));
+	p = strVal(elem->arg);
+
+	for (;;)
+	{
+		char	   *parts[2];
+		int			nparts = 0;
+		AuditName  *name;
+
+		/* one name, with its dot-separated parts */
+		for (;;)
+		{
+			char	   *ident;
+
+			while (scanner_isspace(*p))
+				p++;
+
+			if (*p == '"')
+			{
+				StringInfoData buf;
+
+				initStringInfo(&buf);
+				for (p++;; p++)
+				{
+					if (*p == '\0')
+						ereport(ERROR,
+								(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+								 errmsg("unterminated quoted identifier in option \"%s\"",
+										elem->defname)));
+					if (*p == '"')
+					{
+						if (p[1] != '"')
+							break;
+						p++;
+					}
+					appendStringInfoChar(&buf, *p);
+				}
+				p++;
+				ident = buf.data;
+			}
+			else
+			{
+				const char *start = p;
+
+				while (*p && *p != '.' && *p != ',' && !scanner_isspace(*p))
+					p++;
+				if (p == start)
+					ereport(ERROR,
+							(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+							 errmsg("invalid name list in option \"%s\": \"%s\"",
+									elem->defname, strVal(elem->arg))));
+				ident = downcase_identifier(start, p - start, false, true);
+			}
+
+			if (nparts == (schemas ? 1 : 2))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("improper qualified name in option \"%s\": \"%s\"",
+								elem->defname, strVal(elem->arg))));
+			parts[nparts++] = ident;
+
+			while (scanner_isspace(*p))
+				p++;
+			if (*p != '.')
+				break;
+			p++;
+		}
+
+		name = palloc0(sizeof(AuditName));
+		if (schemas)
+			name->nspname = parts[0];
+		else if (nparts == 1)
+			name->relname = parts[0];
+		else
+		{
+			name->nspname = parts[0];
+			name->relname = parts[1];
+		}
+		names = lappend(names, name);
+
+		if (*p == '\0')
+			break;
+		if (*p != ',')
+			ereport(ERROR,
+					(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+					 errmsg("invalid name list in option \"%s\": \"%s\"",
+							elem->defname, strVal(elem->arg))));
+		p++;
+	}
+
+	return names;
+}
+
+static bool
+name_list_matches(List *names, const char *nspname, const char *relname)
+{
+	ListCell   *lc;
+
+	foreach(lc, names)
+	{
+		AuditName  *name = lfirst(lc);
+
+		if (name->nspname && strcmp(name->nspname, nspname) != 0)
+			continue;
+		if (name->relname && strcmp(name->relname, relname) != 0)
+			continue;
+		return true;
+	}
+
+	return false;
+}
+
+/*
+ * Columns identifying the rows of a relation, as attribute numbers offset by
+ * FirstLowInvalidHeapAttributeNumber: its primary key, or without one the
+ * index of REPLICA IDENTITY USING INDEX. FULL has no identity key.
+ *
+ * RelationGetIndexAttrBitmap() would open every index of the relation, and
+ * locking them while decoding can deadlock with TRUNCATE or REINDEX, as
+ * pgoutput notes. The primary key is read from its pg_index entry instead.
+ */
+static Bitmapset *
+get_key_columns(Relation relation)
+{
+	Bitmapset  *columns = NULL;
+	HeapTuple	tuple;
+	Form_pg_index index_form;
+
+	/* fills rd_pkindex */
+	list_free(RelationGetIndexList(relation));
+	if (!OidIsValid(relation->rd_pkindex))
+		return RelationGetIdentityKeyBitmap(relation);
+
+	tuple = SearchSysCache1(INDEXRELID, ObjectIdGetDatum(relation->rd_pkindex));
+	if (!HeapTupleIsValid(tuple))
+		elog(ERROR, "cache lookup failed for index %u", relation->rd_pkindex);
+	index_form = (Form_pg_index) GETSTRUCT(tuple);
+	for (int i = 0; i < index_form->indnkeyatts; i++)
+		columns = bms_add_member(columns,
+								 index_form->indkey.values[i] - FirstLowInvalidHeapAttributeNumber);
+	ReleaseSysCache(tuple);
+
+	return columns;
+}
+
+/*
+ * Cache entry of a relation, built or rebuilt if needed. The relation is
+ * audited if it is not excluded and, when there is an include list, if it
+ * is included. Names are compared whole, so "t" does not match "t2".
+ */
+static AuditRelationEntry *
+get_relation_entry(AuditDecodingData *data, Relation relation)
+{
+	Oid			relid = RelationGetRelid(relation);
+	AuditRelationEntry *entry;
+	Form_pg_class class_form;
+	MemoryContext old;
+	char	   *nspname;
+	char	   *relname;
+	bool		audited;
+	const char *qualified_name;
+	int			natts = 0;
+	FmgrInfo   *output_functions = NULL;
+	bool	   *varlena = NULL;
+	bool	   *key = NULL;
+	bool		found;
+
+	entry = hash_search(AuditRelations, &relid, HASH_FIND, NULL);
+	if (entry != NULL && entry->valid)
+		return entry;
+
+	/*
+	 * The lookups may process invalidations, so the entry is only filled
+	 * once they are done.
+	 */
+	old = MemoryContextSwitchTo(data->context);
+
+	class_form = RelationGetForm(relation);
+	nspname = get_namespace_name(RelationGetNamespace(relation));
+	relname = class_form->relrewrite ?
+		get_rel_name(class_form->relrewrite) :
+		NameStr(class_form->relname);
+
+	audited = nspname != NULL && relname != NULL &&
+		!name_list_matches(data->exclude, nspname, relname) &&
+		(data->include == NIL ||
+		 name_list_matches(data->include, nspname, relname));
+	qualified_name = audited ? quote_qualified_identifier(nspname, relname) : NULL;
+
+	if (audited && (data->binary || data->changed_columns))
+	{
+		TupleDesc	desc = RelationGetDescr(relation);
+		Bitmapset  *identity = NULL;
+
+		if (data->include_tuples || data->changed_columns)
+		{
+			output_functions = MemoryContextAllocZero(data->cache_context,
+													  desc->natts * sizeof(FmgrInfo));
+			varlena = MemoryContextAllocZero(data->cache_context,
+											 desc->natts * sizeof(bool));
+		}
+		if (data->changed_columns)
+		{
+			key = MemoryContextAllocZero(data->cache_context,
+										 desc->natts * sizeof(bool));
+
+			identity = get_key_columns(relation);
+		}
+
+		for (int i = 0; i < desc->natts; i++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(desc, i);
+			Oid			typoutput;
+
+			if (attr->attisdropped || attr->attnum < 0)
+				continue;
+			natts++;
+
+			if (output_functions)
+			{
+				getTypeOutputInfo(attr->atttypid, &typoutput, &varlena[i]);
+				fmgr_info_cxt(typoutput, &output_functions[i],
+							  data->cache_context);
+			}
+			if (key)
+				key[i] = bms_is_member(attr->attnum - FirstLowInvalidHeapAttributeNumber,
+									   identity);
+		}
+	}
+
+	entry = hash_search(AuditRelations, &relid, HASH_ENTER, &found);
+	if (!found)
+		entry->warned = false;
+	else
+	{
+		if (entry->qualified_name)
+			pfree(entry->qualified_name);
+		if (entry->output_functions)
+			pfree(entry->output_functions);
+		if (entry->varlena)
+			pfree(entry->varlena);
+		if (entry->key)
+			pfree(entry->key);
+	}
+	entry->qualified_name = qualified_name ?
+		MemoryContextStrdup(data->cache_context, qualified_name) : NULL;
+	entry->audited = audited;
+	entry->sent = false;
+	entry->natts = natts;
+	entry->output_functions = output_functions;
+	entry->varlena = varlena;
+	entry->identity_full =
+		RelationGetForm(relation)->relreplident == REPLICA_IDENTITY_FULL;
+	entry->key = key;
+
+	/*
+	 * The old values are not in the WAL, every column looks changed. The
+	 * entry is rebuilt on each invalidation, the warning is only given once.
+	 */
+	if (audited && data->changed_columns && !entry->identity_full &&
+		!entry->warned)
+	{
+		entry->warned = true;
+		ereport(WARNING,
+				(errmsg("relation %s does not have REPLICA IDENTITY FULL",
+						entry->qualified_name),
+				 errdetail("Option \"changed-columns\" sends all the columns of its updates."),
+				 errhint("Use ALTER TABLE %s REPLICA IDENTITY FULL.",
+						 entry->qualified_name)));
+	}
+	entry->valid = true;
+
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+
+	return entry;
+}
+
+static void
+invalidate_all_relations(void)
+{
+	HASH_SEQ_STATUS status;
+	AuditRelationEntry *entry;
+
+	hash_seq_init(&status, AuditRelations);
+	while ((entry = hash_seq_search(&status)) != NULL)
+		entry->valid = false;
+}
+
+/*
+ * Relcache invalidation: the relation, or all of them, must be looked up
+ * again. Entries are only marked, they are rebuilt on their next change.
+ */
+static void
+audit_relcache_callback(Datum arg, Oid relid)
+{
+	AuditRelationEntry *entry;
+
+	if (AuditRelations == NULL)
+		return;
+
+	if (!OidIsValid(relid))
+	{
+		invalidate_all_relations();
+		return;
+	}
+
+	entry = hash_search(AuditRelations, &relid, HASH_FIND, NULL);
+	if (entry != NULL)
+		entry->valid = false;
+}
+
+/*
+ * The context of AuditRelations is reset or deleted, with the decoding
+ * context on error: the invalidation callbacks must not look at it anymore.
+ */
+static void
+audit_cache_reset_callback(void *arg)
+{
+	AuditRelations = NULL;
+}
+
+/*
+ * pg_namespace invalidation: a schema was renamed or dropped, its
+ * relations are not known, so all of them must be looked up again.
+ */
+static void
+audit_syscache_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	if (AuditRelations != NULL)
+		invalidate_all_relations();
+}
+
+/*
+ * Starts a record of the binary format, returns where its length goes.
+ */
+static int
+begin_record(StringInfo out, char type)
+{
+	int			start;
+
+	pq_sendbyte(out, type);
+	start = out->len;
+	pq_sendint32(out, 0);		/* set by end_record() */
+
+	return start;
+}
+
+static void
+end_record(StringInfo out, int start)
+{
+	uint32		len = pg_hton32(out->len - start - 4);
+
+	memcpy(out->data + start, &len, 4);
+}
+
+static void
+send_name(StringInfo out, const char *name)
+{
+	int			len = strlen(name);
+
+	pq_sendint16(out, len);
+	pq_sendbytes(out, name, len);
+}
+
+/*
+ * Relation record: the name and columns the following changes refer to
+ * with the relid.
+ */
+static void
+write_relation(StringInfo out, Relation relation, AuditRelationEntry *entry)
+{
+	TupleDesc	desc = RelationGetDescr(relation);
+	int			start;
+
+	start = begin_record(out, AUDIT_RECORD_RELATION);
+	pq_sendint32(out, RelationGetRelid(relation));
+	send_name(out, entry->qualified_name);
+	pq_sendint16(out, entry->natts);
+	for (int i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+		send_name(out, NameStr(attr->attname));
+	}
+	end_record(out, start);
+}
+
+/*
+ * Text of a non-null value of attribute "i", with the output functions of
+ * the cache entry. NULL for a TOASTed value not in the WAL: it did not
+ * change, and is not detoasted.
+ */
+static char *
+value_to_cstring(AuditRelationEntry *entry, int i, Datum value)
+{
+	if (entry->varlena[i])
+	{
+		if (VARATT_IS_EXTERNAL_ONDISK(value))
+			return NULL;
+		value = PointerGetDatum(PG_DETOAST_DATUM(value));
+	}
+
+	return OutputFunctionCall(&entry->output_functions[i], value);
+}
+
+/*
+ * Whether attribute "i" is in the changed columns of an UPDATE: it belongs
+ * to the primary key, or its value changed. Values are compared as
+ * datums, without detoasting: TOASTed values not in the WAL did not change.
+ * Old tuples are only complete with REPLICA IDENTITY FULL. Otherwise every
+ * value in the WAL is taken as changed.
+ */
+static bool
+column_changed(AuditRelationEntry *entry, TupleDesc desc, int i,
+			   HeapTuple oldtuple, HeapTuple newtuple)
+{
+	Form_pg_attribute attr = TupleDescAttr(desc, i);
+	Datum		oldvalue;
+	Datum		newvalue;
+	bool		oldnull;
+	bool		newnull;
+
+	if (entry->key[i])
+		return true;
+
+	newvalue = heap_getattr(newtuple, i + 1, desc, &newnull);
+	if (!newnull && entry->varlena[i] && VARATT_IS_EXTERNAL_ONDISK(newvalue))
+		return false;
+
+	if (oldtuple == NULL || !entry->identity_full)
+		return true;
+
+	oldvalue = heap_getattr(oldtuple, i + 1, desc, &oldnull);
+	if (oldnull || newnull)
+		return oldnull != newnull;
+
+	return !datumIsEqual(oldvalue, newvalue, attr->attbyval, attr->attlen);
+}
+
+/*
+ * Values of a tuple, in text format. TOASTed values not in the WAL are sent
+ * as unchanged. With "oldtuple", the tuple is the new one of an UPDATE and
+ * only its changed columns are sent, the others as unchanged.
+ */
+static void
+write_tuple(StringInfo out, Relation relation, AuditRelationEntry *entry,
+			HeapTuple tuple, HeapTuple oldtuple)
+{
+	TupleDesc	desc = RelationGetDescr(relation);
+
+	pq_sendint16(out, entry->natts);
+	for (int i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		Datum		value;
+		bool		isnull;
+		char	   *str;
+		int			len;
+
+		if (attr->attisdropped || attr->attnum < 0)
+			continue;
+
+		if (oldtuple && !column_changed(entry, desc, i, oldtuple, tuple))
+		{
+			pq_sendbyte(out, AUDIT_VALUE_UNCHANGED);
+			continue;
+		}
+
+		value = heap_getattr(tuple, i + 1, desc, &isnull);
+		if (isnull)
+		{
+			pq_sendbyte(out, AUDIT_VALUE_NULL);
+			continue;
+		}
+
+		str = value_to_cstring(entry, i, value);
+		if (str == NULL)
+		{
+			pq_sendbyte(out, AUDIT_VALUE_UNCHANGED);
+			continue;
+		}
+
+		len = strlen(str);
+		pq_sendbyte(out, AUDIT_VALUE_TEXT);
+		pq_sendint32(out, len);
+		pq_sendbytes(out, str, len);
+	}
+}
+
+/*
+ * " changed: (column=value, ...)" for an UPDATE in the text format, as the
+ * client shows the changed tuple of the binary format. Names and values are
+ * quoted as in SQL, so that ", " or "=" in them cannot be misread.
+ */
+static void
+append_changed_columns(StringInfo out, Relation relation,
+					   AuditRelationEntry *entry, ReorderBufferChange *change)
+{
+	TupleDesc	desc = RelationGetDescr(relation);
+	HeapTuple	oldtuple = change->data.tp.oldtuple ?
+		ChangeTuple(change->data.tp.oldtuple) : NULL;
+	HeapTuple	newtuple = ChangeTuple(change->data.tp.newtuple);
+	bool		first = true;
+
+	appendStringInfoString(out, " changed: (");
+	for (int i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(desc, i);
+		Datum		value;
+		bool		isnull;
+		char	   *str;
+
+		if (attr->attisdropped || attr->attnum < 0 ||
+			!column_changed(entry, desc, i, oldtuple, newtuple))
+			continue;
+
+		if (!first)
+			appendStringInfoString(out, ", ");
+		first = false;
+
+		appendStringInfo(out, "%s=", quote_identifier(NameStr(attr->attname)));
+		value = heap_getattr(newtuple, i + 1, desc, &isnull);
+		if (isnull)
+			appendStringInfoString(out, "NULL");
+		else if ((str = value_to_cstring(entry, i, value)) == NULL)
+			appendStringInfoString(out, "unchanged");
+		else
+			appendStringInfoString(out, quote_literal_cstr(str));
+	}
+	appendStringInfoChar(out, ')');
+}
+
+/*
+ * Change record, preceded by the relation record if the client does not
+ * know the relation yet.
+ */
+static void
+write_change(AuditDecodingData *data, StringInfo out, Relation relation,
+			 AuditRelationEntry *entry, ReorderBufferChange *change)
+{
+	char		type;
+	int			start;
+	uint8		flags = 0;
+
+	switch (change->action)
+	{
+		case REORDER_BUFFER_CHANGE_INSERT:
+			type = AUDIT_RECORD_INSERT;
+			break;
+		case REORDER_BUFFER_CHANGE_UPDATE:
+			type = AUDIT_RECORD_UPDATE;
+			break;
+		case REORDER_BUFFER_CHANGE_DELETE:
+			type = AUDIT_RECORD_DELETE;
+			break;
+		default:
+			Assert(false);
+			return;
+	}
+
+	if (!entry->sent)
+	{
+		write_relation(out, relation, entry);
+		entry->sent = true;
+	}
+
+	if (data->changed_columns && type == AUDIT_RECORD_UPDATE)
+		flags = AUDIT_TUPLE_CHANGED;
+	else if (data->include_tuples)
+	{
+		if (change->data.tp.oldtuple != NULL)
+			flags |= AUDIT_TUPLE_OLD;
+		if (change->data.tp.newtuple != NULL)
+			flags |= AUDIT_TUPLE_NEW;
+	}
+
+	/* the subtransaction of the change, so that its abort can be applied */
+	start = begin_record(out, type);
+	pq_sendint32(out, change->txn->xid);
+	pq_sendint64(out, change->lsn);
+	pq_sendint32(out, RelationGetRelid(relation));
+	pq_sendbyte(out, flags);
+	if (flags & AUDIT_TUPLE_OLD)
+		write_tuple(out, relation, entry,
+					ChangeTuple(change->data.tp.oldtuple), NULL);
+	if (flags & AUDIT_TUPLE_NEW)
+		write_tuple(out, relation, entry,
+					ChangeTuple(change->data.tp.newtuple), NULL);
+	if (flags & AUDIT_TUPLE_CHANGED)
+	{
+		HeapTuple	oldtuple = change->data.tp.oldtuple ?
+			ChangeTuple(change->data.tp.oldtuple) : NULL;
+
+		write_tuple(out, relation, entry,
+					ChangeTuple(change->data.tp.newtuple), oldtuple);
+	}
+	end_record(out, start);
 }
 
 /* cleanup this plugin's resources */
@@ -89,12 +1006,264 @@ pg_decode_shutdown(LogicalDecodingContext *ctx)
 
 	/* cleanup our own resources via memory context reset */
 	MemoryContextDelete(data->context);
+
+	/* allocated in the decoding context, about to go away */
+	AuditRelations = NULL;
+}
+
+/*
+ * Counts a change of the transaction, in summary mode. Counters live in the
+ * decoding context until the end of the transaction, one per relation and
+ * subtransaction: the callbacks get the top-level transaction, the
+ * subtransaction of the change is change->txn.
+ */
+static void
+count_change(LogicalDecodingContext *ctx, AuditDecodingTxnData *txndata,
+			 Relation relation, AuditRelationEntry *entry,
+			 ReorderBufferChange *change)
+{
+	Oid			relid = RelationGetRelid(relation);
+	TransactionId xid = change->txn->xid;
+	AuditTxnCounter *counter = txndata->last_counter;
+
+	if (counter == NULL || counter->relid != relid || counter->xid != xid)
+	{
+		ListCell   *lc;
+
+		counter = NULL;
+		foreach(lc, txndata->counters)
+		{
+			AuditTxnCounter *c = lfirst(lc);
+
+			if (c->relid == relid && c->xid == xid)
+			{
+				counter = c;
+				break;
+			}
+		}
+
+		if (counter == NULL)
+		{
+			MemoryContext old = MemoryContextSwitchTo(ctx->context);
+
+			counter = palloc0(sizeof(AuditTxnCounter));
+			counter->relid = relid;
+			counter->xid = xid;
+			counter->qualified_name = pstrdup(entry->qualified_name);
+			txndata->counters = lappend(txndata->counters, counter);
+
+			MemoryContextSwitchTo(old);
+		}
+		txndata->last_counter = counter;
+	}
+
+	switch (change->action)
+	{
+		case REORDER_BUFFER_CHANGE_INSERT:
+			counter->counts[AUDIT_ACTION_INSERT]++;
+			break;
+		case REORDER_BUFFER_CHANGE_UPDATE:
+			counter->counts[AUDIT_ACTION_UPDATE]++;
+			break;
+		case REORDER_BUFFER_CHANGE_DELETE:
+			counter->counts[AUDIT_ACTION_DELETE]++;
+			break;
+		default:
+			Assert(false);
+	}
+}
+
+/*
+ * Forgets the counters of a (sub)transaction, or all of them with
+ * InvalidTransactionId.
+ */
+static void
+forget_counters(AuditDecodingTxnData *txndata, TransactionId xid)
+{
+	ListCell   *lc;
+
+	foreach(lc, txndata->counters)
+	{
+		AuditTxnCounter *counter = lfirst(lc);
+
+		if (TransactionIdIsValid(xid) && counter->xid != xid)
+			continue;
+		pfree(counter->qualified_name);
+		pfree(counter);
+		txndata->counters = foreach_delete_current(txndata->counters, lc);
+	}
+	txndata->last_counter = NULL;
+}
+
+/*
+ * Writes the summary of a committed transaction: its commit, then the
+ * changes per relation and action, those of its subtransactions included.
+ */
+static void
+write_summary(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+			  AuditDecodingTxnData *txndata, XLogRecPtr commit_lsn)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+	MemoryContext old;
+	List	   *relations = NIL;
+	ListCell   *lc;
+	int			start = 0;
+
+	old = MemoryContextSwitchTo(data->context);
+
+	/* one counter per relation, with the counts of all subtransactions */
+	foreach(lc, txndata->counters)
+	{
+		AuditTxnCounter *counter = lfirst(lc);
+		AuditTxnCounter *merged = NULL;
+		ListCell   *lc2;
+
+		foreach(lc2, relations)
+		{
+			merged = lfirst(lc2);
+			if (merged->relid == counter->relid)
+				break;
+			merged = NULL;
+		}
+		if (merged == NULL)
+		{
+			merged = palloc0(sizeof(AuditTxnCounter));
+			merged->relid = counter->relid;
+			merged->qualified_name = counter->qualified_name;
+			relations = lappend(relations, merged);
+		}
+		for (int i = 0; i < lengthof(merged->counts); i++)
+			merged->counts[i] += counter->counts[i];
+	}
+
+	OutputPluginPrepareWrite(ctx, true);
+
+	if (data->binary)
+	{
+		pq_sendbyte(ctx->out, AUDIT_BINARY_VERSION);
+		start = begin_record(ctx->out, AUDIT_RECORD_SUMMARY);
+		pq_sendint32(ctx->out, txn->xid);
+		pq_sendint64(ctx->out, commit_lsn);
+		pq_sendint64(ctx->out, CommitTime(txn));
+		pq_sendint16(ctx->out, list_length(relations));
+	}
+	else
+		appendStringInfo(ctx->out, "TRANSACTION %u COMMIT %X/%X AT %s:",
+						 txn->xid, LSN_FORMAT_ARGS(commit_lsn),
+						 timestamptz_to_str(CommitTime(txn)));
+
+	foreach(lc, relations)
+	{
+		AuditTxnCounter *merged = lfirst(lc);
+
+		if (data->binary)
+		{
+			send_name(ctx->out, merged->qualified_name);
+			for (int i = 0; i < lengthof(merged->counts); i++)
+				pq_sendint64(ctx->out, merged->counts[i]);
+		}
+		else
+			appendStringInfo(ctx->out,
+							 "%s %s INSERT " UINT64_FORMAT " UPDATE " UINT64_FORMAT " DELETE " UINT64_FORMAT,
+							 foreach_current_index(lc) > 0 ? "," : "",
+							 merged->qualified_name,
+							 merged->counts[AUDIT_ACTION_INSERT],
+							 merged->counts[AUDIT_ACTION_UPDATE],
+							 merged->counts[AUDIT_ACTION_DELETE]);
+	}
+
+	if (data->binary)
+		end_record(ctx->out, start);
+
+	MemoryContextSwitchTo(old);
+	MemoryContextReset(data->context);
+
+	OutputPluginWrite(ctx, true);
+}
+
+/*
+ * Writes the batched changes as one message: lines of the text format, or
+ * records of the binary format after a single version byte.
+ */
+static void
+flush_batch(LogicalDecodingContext *ctx, bool last_write)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+
+	if (data->batch_size == 0 || data->batch.len == 0)
+		return;
+
+	OutputPluginPrepareWrite(ctx, last_write);
+	appendBinaryStringInfo(ctx->out, data->batch.data, data->batch.len);
+	OutputPluginWrite(ctx, last_write);
+
+	resetStringInfo(&data->batch);
+}
+
+/*
+ * Writes a marker of a streamed transaction: a line in the text format, a
+ * record in the binary format. "subxid" is only used by aborts, "lsn" only
+ * by commits.
+ */
+static void
+write_stream_marker(LogicalDecodingContext *ctx, bool last_write, char type,
+					TransactionId xid, TransactionId subxid, XLogRecPtr lsn)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+
+	/* batched changes come first */
+	flush_batch(ctx, false);
+
+	OutputPluginPrepareWrite(ctx, last_write);
+
+	if (data->binary)
+	{
+		int			start;
+
+		pq_sendbyte(ctx->out, AUDIT_BINARY_VERSION);
+		start = begin_record(ctx->out, type);
+		pq_sendint32(ctx->out, xid);
+		if (type == AUDIT_RECORD_STREAM_ABORT)
+			pq_sendint32(ctx->out, subxid);
+		else if (type == AUDIT_RECORD_STREAM_COMMIT)
+			pq_sendint64(ctx->out, lsn);
+		end_record(ctx->out, start);
+	}
+	else
+	{
+		switch (type)
+		{
+			case AUDIT_RECORD_STREAM_START:
+				appendStringInfo(ctx->out, "STREAM START %u", xid);
+				break;
+			case AUDIT_RECORD_STREAM_STOP:
+				appendStringInfo(ctx->out, "STREAM STOP %u", xid);
+				break;
+			case AUDIT_RECORD_STREAM_COMMIT:
+				appendStringInfo(ctx->out, "STREAM COMMIT %u %X/%X", xid,
+								 LSN_FORMAT_ARGS(lsn));
+				break;
+			case AUDIT_RECORD_STREAM_ABORT:
+				if (subxid == xid)
+					appendStringInfo(ctx->out, "STREAM ABORT %u", xid);
+				else
+					appendStringInfo(ctx->out, "STREAM ABORT %u OF %u",
+									 subxid, xid);
+				break;
+		}
+	}
+
+	OutputPluginWrite(ctx, last_write);
 }
 
 /* BEGIN callback */
 static void
 pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 {
+	AuditDecodingTxnData *txndata =
+		MemoryContextAllocZero(ctx->context, sizeof(AuditDecodingTxnData));
+
+	txn->output_plugin_private = txndata;
 }
 
 /* COMMIT callback */
@@ -102,50 +1271,211 @@ static void
 pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 					 XLogRecPtr commit_lsn)
 {
+	AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+	flush_batch(ctx, true);
+
+	if (txndata->counters != NIL)
+	{
+		write_summary(ctx, txn, txndata, commit_lsn);
+		forget_counters(txndata, InvalidTransactionId);
+	}
+
+	pfree(txndata);
+	txn->output_plugin_private = NULL;
 }
 
 /*
- * callback for individual changed tuples
+ * Writes a change, streamed or not. The start of a stream is only written
+ * with its first audited change, so that streams and transactions without
+ * any stay silent. With batching, the change is only added to the batch,
+ * written once big enough, or at the end of the transaction or stream.
  */
 static void
-pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
-				 Relation relation, ReorderBufferChange *change)
+decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+			  Relation relation, ReorderBufferChange *change, bool streaming)
 {
 	AuditDecodingData *data;
+	AuditDecodingTxnData *txndata;
+	AuditRelationEntry *relentry;
 	MemoryContext old;
-	Form_pg_class class_form;
+	StringInfo	out;
 
 	data = ctx->output_plugin_private;
+	txndata = TopTxn(txn)->output_plugin_private;
 
-	old = MemoryContextSwitchTo(data->context);
+	relentry = get_relation_entry(data, relation);
+	if (!relentry->audited)
+		return;
 
-	OutputPluginPrepareWrite(ctx, true);
+	/* summary mode: only counted, written at commit */
+	if (data->summary)
+	{
+		count_change(ctx, txndata, relation, relentry, change);
+		return;
+	}
 
-	class_form = RelationGetForm(relation);
-	appendStringInfoString(ctx->out,
-		quote_qualified_identifier(get_namespace_name(get_rel_namespace(RelationGetRelid(relation))),
-		class_form->relrewrite ?
-			get_rel_name(class_form->relrewrite) :
-			NameStr(class_form->relname)));
+	if (streaming && !txndata->stream_wrote_changes)
+		write_stream_marker(ctx, false, AUDIT_RECORD_STREAM_START,
+							TopTxn(txn)->xid, InvalidTransactionId,
+							InvalidXLogRecPtr);
+	txndata->xact_wrote_changes = true;
+	txndata->stream_wrote_changes = true;
 
-	switch (change->action)
+	old = MemoryContextSwitchTo(data->context);
+
+	if (data->batch_size > 0)
 	{
-		case REORDER_BUFFER_CHANGE_INSERT:
-			appendStringInfoString(ctx->out, " INSERT");
-			break;
-		case REORDER_BUFFER_CHANGE_UPDATE:
-			appendStringInfoString(ctx->out, " UPDATE");
-			break;
-		case REORDER_BUFFER_CHANGE_DELETE:
-			appendStringInfoString(ctx->out, " DELETE");
-			break;
-		default:
-			Assert(false);
+		out = &data->batch;
+		if (out->len == 0 && data->binary)
+			pq_sendbyte(out, AUDIT_BINARY_VERSION);
+		else if (out->len > 0 && !data->binary)
+			appendStringInfoChar(out, '\n');
+	}
+	else
+	{
+		OutputPluginPrepareWrite(ctx, true);
+		out = ctx->out;
+		if (data->binary)
+			pq_sendbyte(out, AUDIT_BINARY_VERSION);
+	}
+
+	if (data->binary)
+		write_change(data, out, relation, relentry, change);
+	else
+	{
+		/* streamed changes can be voided by the abort of a subtransaction */
+		if (streaming)
+			appendStringInfo(out, "XID %u ", change->txn->xid);
+		appendStringInfoString(out, relentry->qualified_name);
+
+		switch (change->action)
+		{
+			case REORDER_BUFFER_CHANGE_INSERT:
+				appendStringInfoString(out, " INSERT");
+				break;
+			case REORDER_BUFFER_CHANGE_UPDATE:
+				appendStringInfoString(out, " UPDATE");
+				if (data->changed_columns)
+					append_changed_columns(out, relation, relentry, change);
+				break;
+			case REORDER_BUFFER_CHANGE_DELETE:
+				appendStringInfoString(out, " DELETE");
+				break;
+			default:
+				Assert(false);
+		}
 	}
 
 	MemoryContextSwitchTo(old);
 	MemoryContextReset(data->context);
 
-	OutputPluginWrite(ctx, true);
+	if (data->batch_size == 0)
+		OutputPluginWrite(ctx, true);
+	else if (data->batch.len >= data->batch_size)
+		flush_batch(ctx, true);
 }
 
+/*
+ * callback for individual changed tuples
+ */
+static void
+pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+				 Relation relation, ReorderBufferChange *change)
+{
+	decode_change(ctx, txn, relation, change, false);
+}
+
+/*
+ * A block of changes of an in-progress transaction starts. Nothing is
+ * written until one of them is audited.
+ */
+static void
+pg_decode_stream_start(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+	/*
+	 * Allocate the txn plugin data for the first stream in the transaction.
+	 */
+	if (txndata == NULL)
+	{
+		txndata =
+			MemoryContextAllocZero(ctx->context, sizeof(AuditDecodingTxnData));
+		txn->output_plugin_private = txndata;
+	}
+
+	txndata->stream_wrote_changes = false;
+}
+
+static void
+pg_decode_stream_stop(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
+{
+	AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+	if (!txndata->stream_wrote_changes)
+		return;
+
+	write_stream_marker(ctx, true, AUDIT_RECORD_STREAM_STOP, txn->xid,
+						InvalidTransactionId, InvalidXLogRecPtr);
+}
+
+/*
+ * The streamed transaction, or one of its subtransactions, aborted: its
+ * changes already written must be ignored. Only written if some were. In
+ * summary mode, its counts are forgotten and nothing is written.
+ */
+static void
+pg_decode_stream_abort(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+					   XLogRecPtr abort_lsn)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+	ReorderBufferTXN *toptxn = TopTxn(txn);
+	AuditDecodingTxnData *txndata = toptxn->output_plugin_private;
+	bool		xact_wrote_changes = txndata->xact_wrote_changes;
+
+	forget_counters(txndata, toptxn == txn ? InvalidTransactionId : txn->xid);
+
+	if (toptxn == txn)
+	{
+		pfree(txndata);
+		txn->output_plugin_private = NULL;
+	}
+
+	if (!xact_wrote_changes || data->summary)
+		return;
+
+	write_stream_marker(ctx, true, AUDIT_RECORD_STREAM_ABORT, toptxn->xid,
+						txn->xid, InvalidXLogRecPtr);
+}
+
+static void
+pg_decode_stream_commit(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						XLogRecPtr commit_lsn)
+{
+	AuditDecodingData *data = ctx->output_plugin_private;
+	AuditDecodingTxnData *txndata = txn->output_plugin_private;
+
+	if (data->summary)
+	{
+		if (txndata->counters != NIL)
+			write_summary(ctx, txn, txndata, commit_lsn);
+		forget_counters(txndata, InvalidTransactionId);
+	}
+	else if (txndata->xact_wrote_changes)
+		write_stream_marker(ctx, true, AUDIT_RECORD_STREAM_COMMIT, txn->xid,
+							InvalidTransactionId, commit_lsn);
+
+	pfree(txndata);
+	txn->output_plugin_private = NULL;
+}
+
+/*
+ * callback for changes of in-progress transactions
+ */
+static void
+pg_decode_stream_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
+						Relation relation, ReorderBufferChange *change)
+{
+	decode_change(ctx, txn, relation, change, true);
+}
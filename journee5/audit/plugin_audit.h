@@ -0,0 +1,84 @@
+/*
+ * plugin_audit.h, binary output format of plugin_audit, shared with audit
+ *
+ * This software is released under the PostgreSQL Licence.
+ *
+ * Guillaume Lelarge, guillaume@lelarge.info, 2024.
+ *
+ */
+
+#ifndef PLUGIN_AUDIT_H
+#define PLUGIN_AUDIT_H
+
+/*
+ * With the option "format" set to "binary", each message of the plugin is
+ * a version byte, then one or more records. A record is a type byte, the
+ * length of its body as a 32-bit integer, then its body. Integers are in
+ * network byte order, and strings come after their length, without a
+ * terminating zero.
+ *
+ * AUDIT_RECORD_RELATION comes before the first change of a relation, and
+ * again after the relation changed:
+ *   uint32 relid, uint16 length and qualified name (quoted),
+ *   uint16 number of columns, then for each column uint16 length and name
+ *
+ * AUDIT_RECORD_INSERT, AUDIT_RECORD_UPDATE and AUDIT_RECORD_DELETE:
+ *   uint32 xid of the subtransaction (or transaction) of the change,
+ *   uint64 LSN, uint32 relid, uint8 tuple flags, then the old tuple with
+ *   AUDIT_TUPLE_OLD, the new tuple with AUDIT_TUPLE_NEW, and the changed
+ *   tuple with AUDIT_TUPLE_CHANGED
+ *
+ * With the option "stream-changes", the changes of large transactions come
+ * before their commit, between AUDIT_RECORD_STREAM_START and
+ * AUDIT_RECORD_STREAM_STOP, each with the uint32 xid of the transaction.
+ * Then comes AUDIT_RECORD_STREAM_COMMIT (uint32 xid, uint64 commit LSN), or
+ * AUDIT_RECORD_STREAM_ABORT (uint32 xid, uint32 xid of the aborted
+ * subtransaction, the same for the whole transaction) whose changes are
+ * void: each change carries the xid of its subtransaction. In the text
+ * format, streamed changes start with "XID" and that xid. Streams and
+ * transactions without any change are not sent.
+ *
+ * With the option "summary", changes are not sent. Each transaction that
+ * changed audited relations is an AUDIT_RECORD_SUMMARY at its commit:
+ *   uint32 xid, uint64 commit LSN, int64 commit time (microseconds since
+ *   2000-01-01), uint16 number of relations, then for each relation uint16
+ *   length and qualified name, uint64 inserts, updates and deletes
+ *
+ * Tuples are only sent with the option "include-tuples". A tuple is the
+ * uint16 number of columns, as in the relation record, then for each a kind
+ * byte: AUDIT_VALUE_NULL, AUDIT_VALUE_UNCHANGED (TOASTed value not in the
+ * WAL), or AUDIT_VALUE_TEXT followed by uint32 length and the value in text
+ * format.
+ *
+ * With the option "changed-columns", UPDATEs come with a changed tuple
+ * instead of their old and new tuples: the new values of the primary key
+ * (or of the replica identity index without one) and of the changed
+ * columns, the others being AUDIT_VALUE_UNCHANGED. Old values are only in
+ * the WAL with REPLICA IDENTITY FULL: otherwise every column is sent.
+ *
+ * With the option "batch-size", a message holds the records of several
+ * changes, after a single version byte.
+ *
+ * Readers check the version, and skip the records of unknown types.
+ */
+#define AUDIT_BINARY_VERSION	1
+
+#define AUDIT_RECORD_RELATION	'R'
+#define AUDIT_RECORD_INSERT		'I'
+#define AUDIT_RECORD_UPDATE		'U'
+#define AUDIT_RECORD_DELETE		'D'
+#define AUDIT_RECORD_STREAM_START	'S'
+#define AUDIT_RECORD_STREAM_STOP	'E'
+#define AUDIT_RECORD_STREAM_COMMIT	'C'
+#define AUDIT_RECORD_STREAM_ABORT	'A'
+#define AUDIT_RECORD_SUMMARY	'T'
+
+#define AUDIT_TUPLE_OLD			0x01
+#define AUDIT_TUPLE_NEW			0x02
+#define AUDIT_TUPLE_CHANGED		0x04
+
+#define AUDIT_VALUE_NULL		'n'
+#define AUDIT_VALUE_UNCHANGED	'u'
+#define AUDIT_VALUE_TEXT		't'
+
+#endif							/* PLUGIN_AUDIT_H */